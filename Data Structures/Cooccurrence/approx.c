@@ -0,0 +1,455 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "approx.h"
+#include "cmsketch.h"
+#include "kwtable.h"
+
+typedef struct approx_slot
+{
+  uint64_t hash;
+  char *word;
+  uint64_t count;    // estimate when the pair was last counted
+} approx_slot;
+
+struct approx_counter
+{
+  kwtable *keywords;
+  uint64_t *key_hash; // hash of each keyword, to skip it in its own row
+  uint64_t *diag;     // exact number of contexts each keyword is in
+  cmsketch *sketch;   // of (keyword, word) pairs
+  size_t heavy;       // candidates kept per keyword
+  approx_slot *slots; // heavy for each keyword
+  size_t *fill;       // how many of them are in use
+  size_t word_bytes;  // total size of the candidates' words
+  uint64_t contexts;
+
+  // the context being counted: the line read, its words and their
+  // hashes, and a table of the hashes seen so far to drop repeated words
+  char *text;
+  size_t text_cap;
+  const char **words;
+  size_t *lengths;
+  uint64_t *hashes;
+  size_t *present;    // keyword indices in the context
+  size_t token_cap;
+  uint64_t *seen;
+  size_t seen_mask;   // number of slots - 1
+};
+
+/**
+ * Computes a well-mixed nonzero hash of the given slice (FNV-1a followed
+ * by the splitmix64 finalizer).  Words with the same hash are taken to
+ * be the same word.
+ */
+uint64_t approx_hash(const char *s, size_t len);
+
+/**
+ * Computes the sketch key of the pair of the keyword with the given
+ * index and the word with the given hash.
+ */
+uint64_t approx_pair(size_t index, uint64_t hash);
+
+/**
+ * Makes room for at least n words in the buffers for a context.
+ *
+ * @return false if there was an allocation error
+ */
+bool approx_reserve(approx_counter *a, size_t n);
+
+/**
+ * Counts the context of n words in the buffers.
+ */
+void approx_count(approx_counter *a, size_t n);
+
+/**
+ * Offers the given word, whose pair with the keyword with the given
+ * index has the given estimate, as a candidate for that keyword.  It
+ * takes the place of the candidate with the smallest estimate if all
+ * the slots are in use.
+ */
+void approx_offer(approx_counter *a, size_t index, const char *word, size_t len, uint64_t hash, uint64_t count);
+
+approx_counter *approx_create(char *key[], size_t n, size_t bytes, size_t heavy)
+{
+  approx_counter *a = malloc(sizeof(approx_counter));
+  if (a == NULL) {
+    return NULL;
+  }
+  a->heavy = heavy > 0 ? heavy : 1;
+  a->keywords = kwtable_create(key, n);
+  a->key_hash = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+  a->diag = calloc(n > 0 ? n : 1, sizeof(uint64_t));
+  a->sketch = cmsketch_create(bytes);
+  a->slots = malloc(sizeof(approx_slot) * a->heavy * (n > 0 ? n : 1));
+  a->fill = calloc(n > 0 ? n : 1, sizeof(size_t));
+  a->word_bytes = 0;
+  a->contexts = 0;
+  a->text = NULL;
+  a->text_cap = 0;
+  a->words = NULL;
+  a->lengths = NULL;
+  a->hashes = NULL;
+  a->present = NULL;
+  a->token_cap = 0;
+  a->seen = NULL;
+  a->seen_mask = 0;
+  if (a->keywords == NULL || a->key_hash == NULL || a->diag == NULL || a->sketch == NULL
+      || a->slots == NULL || a->fill == NULL || !approx_reserve(a, 16)) {
+    approx_destroy(a);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    a->key_hash[i] = approx_hash(key[i], strlen(key[i]));
+  }
+  return a;
+}
+
+bool approx_reserve(approx_counter *a, size_t n)
+{
+  if (n <= a->token_cap) {
+    return true;
+  }
+  size_t cap = a->token_cap > 0 ? a->token_cap : 1;
+  while (cap < n) {
+    cap *= 2;
+  }
+
+  // each array is replaced as soon as it is reallocated, so a failure
+  // leaves them all at least as big as token_cap
+  const char **words = realloc(a->words, sizeof(const char *) * cap);
+  if (words == NULL) {
+    return false;
+  }
+  a->words = words;
+  size_t *lengths = realloc(a->lengths, sizeof(size_t) * cap);
+  if (lengths == NULL) {
+    return false;
+  }
+  a->lengths = lengths;
+  uint64_t *hashes = realloc(a->hashes, sizeof(uint64_t) * cap);
+  if (hashes == NULL) {
+    return false;
+  }
+  a->hashes = hashes;
+  size_t *present = realloc(a->present, sizeof(size_t) * cap);
+  if (present == NULL) {
+    return false;
+  }
+  a->present = present;
+
+  // at most half full
+  uint64_t *seen = malloc(sizeof(uint64_t) * cap * 2);
+  if (seen == NULL) {
+    return false;
+  }
+  free(a->seen);
+  a->seen = seen;
+  a->seen_mask = cap * 2 - 1;
+  a->token_cap = cap;
+  return true;
+}
+
+bool approx_update(approx_counter *a, char **context, size_t n)
+{
+  if (!approx_reserve(a, n)) {
+    return false;
+  }
+  for (size_t i = 0; i < n; i++) {
+    a->words[i] = context[i];
+    a->lengths[i] = strlen(context[i]);
+  }
+  approx_count(a, n);
+  return true;
+}
+
+bool approx_read_context(approx_counter *a, FILE *stream)
+{
+  int c = getc(stream);
+  if (c == EOF) {
+    return false;
+  }
+
+  size_t used = 0;
+  while (c != '\n' && c != EOF) {
+    if (used == a->text_cap) {
+      size_t cap = a->text_cap > 0 ? a->text_cap * 2 : 256;
+      char *bigger = realloc(a->text, cap);
+      if (bigger == NULL) {
+        return false;
+      }
+      a->text = bigger;
+      a->text_cap = cap;
+    }
+    a->text[used++] = c;
+    c = getc(stream);
+  }
+  return approx_count_line(a, a->text, used);
+}
+
+bool approx_count_line(approx_counter *a, const char *line, size_t len)
+{
+  size_t n = 0;
+  size_t pos = 0;
+  while (pos < len) {
+    if (line[pos] == ' ') {
+      pos++;
+      continue;
+    }
+    if (!approx_reserve(a, n + 1)) {
+      return false;
+    }
+    const char *space = memchr(line + pos, ' ', len - pos);
+    size_t end = space != NULL ? (size_t)(space - line) : len;
+    a->words[n] = line + pos;
+    a->lengths[n] = end - pos;
+    n++;
+    pos = end;
+  }
+  approx_count(a, n);
+  return true;
+}
+
+void approx_count(approx_counter *a, size_t n)
+{
+  // drop repeated words and find the keywords
+  memset(a->seen, 0, sizeof(uint64_t) * (a->seen_mask + 1));
+  size_t unique = 0;
+  size_t present = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint64_t h = approx_hash(a->words[i], a->lengths[i]);
+    size_t slot = h & a->seen_mask;
+    while (a->seen[slot] != 0 && a->seen[slot] != h) {
+      slot = (slot + 1) & a->seen_mask;
+    }
+    if (a->seen[slot] == h) {
+      continue;
+    }
+    a->seen[slot] = h;
+    a->words[unique] = a->words[i];
+    a->lengths[unique] = a->lengths[i];
+    a->hashes[unique] = h;
+    unique++;
+
+    long index = kwtable_find(a->keywords, a->words[i], a->lengths[i]);
+    if (index >= 0) {
+      a->present[present++] = index;
+    }
+  }
+
+  for (size_t p = 0; p < present; p++) {
+    size_t index = a->present[p];
+    a->diag[index]++;
+    for (size_t u = 0; u < unique; u++) {
+      if (a->hashes[u] != a->key_hash[index]) {
+        uint32_t count = cmsketch_add(a->sketch, approx_pair(index, a->hashes[u]));
+        approx_offer(a, index, a->words[u], a->lengths[u], a->hashes[u], count);
+      }
+    }
+  }
+  a->contexts++;
+}
+
+void approx_offer(approx_counter *a, size_t index, const char *word, size_t len, uint64_t hash, uint64_t count)
+{
+  approx_slot *slots = a->slots + index * a->heavy;
+  size_t fill = a->fill[index];
+  size_t min = 0;
+  for (size_t j = 0; j < fill; j++) {
+    if (slots[j].hash == hash) {
+      slots[j].count = count;
+      return;
+    }
+    if (slots[j].count < slots[min].count) {
+      min = j;
+    }
+  }
+
+  size_t j;
+  if (fill < a->heavy) {
+    j = fill;
+  }
+  else if (count > slots[min].count) {
+    j = min;
+  }
+  else {
+    return;
+  }
+
+  // a candidate that cannot be copied is dropped; the sketch still has
+  // its count
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    return;
+  }
+  memcpy(copy, word, len);
+  copy[len] = '\0';
+  if (j < fill) {
+    a->word_bytes -= strlen(slots[j].word) + 1;
+    free(slots[j].word);
+  }
+  else {
+    a->fill[index]++;
+  }
+  slots[j].hash = hash;
+  slots[j].word = copy;
+  slots[j].count = count;
+  a->word_bytes += len + 1;
+}
+
+uint64_t approx_estimate(const approx_counter *a, const char *keyword, const char *word)
+{
+  long index = kwtable_find(a->keywords, keyword, strlen(keyword));
+  if (index < 0) {
+    return 0;
+  }
+  uint64_t h = approx_hash(word, strlen(word));
+  if (h == a->key_hash[index]) {
+    return a->diag[index];
+  }
+  return cmsketch_estimate(a->sketch, approx_pair(index, h));
+}
+
+size_t approx_top(const approx_counter *a, size_t index, size_t k, const char **words, uint64_t *counts)
+{
+  // the stored counts may be stale, since other pairs' updates can raise
+  // an estimate, so each candidate is estimated again; the list is then
+  // built by selection, largest count first and ties by word
+  const approx_slot *slots = a->slots + index * a->heavy;
+  size_t fill = a->fill[index];
+  size_t found = 0;
+  while (found < k) {
+    const char *best = NULL;
+    uint64_t best_count = 0;
+    for (size_t j = 0; j < fill; j++) {
+      uint64_t c = cmsketch_estimate(a->sketch, approx_pair(index, slots[j].hash));
+      if (found > 0 && (c > counts[found - 1] || (c == counts[found - 1] && strcmp(slots[j].word, words[found - 1]) <= 0))) {
+        // already in the list
+        continue;
+      }
+      if (best == NULL || c > best_count || (c == best_count && strcmp(slots[j].word, best) < 0)) {
+        best = slots[j].word;
+        best_count = c;
+      }
+    }
+    if (best == NULL) {
+      break;
+    }
+    words[found] = best;
+    counts[found] = best_count;
+    found++;
+  }
+  return found;
+}
+
+double approx_error(const approx_counter *a)
+{
+  return cmsketch_epsilon(a->sketch) * cmsketch_total(a->sketch);
+}
+
+double approx_confidence(const approx_counter *a)
+{
+  return 1.0 - cmsketch_delta(a->sketch);
+}
+
+uint64_t approx_contexts(const approx_counter *a)
+{
+  return a->contexts;
+}
+
+size_t approx_size(const approx_counter *a)
+{
+  return kwtable_size(a->keywords);
+}
+
+const char *approx_keyword(const approx_counter *a, size_t index)
+{
+  return kwtable_word(a->keywords, index);
+}
+
+size_t approx_memory(const approx_counter *a, size_t *width, size_t *depth)
+{
+  if (width != NULL) {
+    *width = cmsketch_width(a->sketch);
+  }
+  if (depth != NULL) {
+    *depth = cmsketch_depth(a->sketch);
+  }
+  size_t n = kwtable_size(a->keywords);
+  return sizeof(approx_counter) + cmsketch_memory(a->sketch) + kwtable_memory(a->keywords)
+    + n * (sizeof(uint64_t) * 2 + sizeof(size_t) + sizeof(approx_slot) * a->heavy) + a->word_bytes;
+}
+
+bool approx_parse_bytes(const char *text, size_t *bytes)
+{
+  char *end;
+  double value = strtod(text, &end);
+  const char *units = "KMG";
+  const char *unit = *end != '\0' ? strchr(units, *end) : NULL;
+  if (unit != NULL) {
+    value *= (double)(1ULL << (10 * (unit - units + 1)));
+    end++;
+  }
+  if (end == text || *end != '\0' || !(value >= 1.0) || value > (double)SIZE_MAX / 2) {
+    return false;
+  }
+  *bytes = (size_t)value;
+  return true;
+}
+
+uint64_t approx_hash(const char *s, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h != 0 ? h : 1;
+}
+
+uint64_t approx_pair(size_t index, uint64_t hash)
+{
+  uint64_t x = hash + (index + 1) * 0x9E3779B97F4A7C15ULL;
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+void approx_destroy(approx_counter *a)
+{
+  if (a == NULL) {
+    return;
+  }
+  if (a->slots != NULL && a->fill != NULL) {
+    size_t n = a->keywords != NULL ? kwtable_size(a->keywords) : 0;
+    for (size_t i = 0; i < n; i++) {
+      for (size_t j = 0; j < a->fill[i]; j++) {
+        free(a->slots[i * a->heavy + j].word);
+      }
+    }
+  }
+  kwtable_destroy(a->keywords);
+  free(a->key_hash);
+  free(a->diag);
+  cmsketch_destroy(a->sketch);
+  free(a->slots);
+  free(a->fill);
+  free(a->text);
+  free(a->words);
+  free(a->lengths);
+  free(a->hashes);
+  free(a->present);
+  free(a->seen);
+  free(a);
+}
@@ -0,0 +1,170 @@
+#ifndef __APPROX_H__
+#define __APPROX_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct approx_counter;
+typedef struct approx_counter approx_counter;
+
+/**
+ * Creates a counter of approximate cooccurrences between the given
+ * keywords and every word, in memory that does not grow with the
+ * vocabulary.  The number of contexts containing both a keyword and a
+ * word is counted in a Count-Min sketch keyed by a hash of the pair, and
+ * for each keyword the words with the largest estimates are kept as
+ * candidates for its top cooccurrences.  Estimates are never too low; see
+ * approx_error for how high they may be.
+ *
+ * @param key an array of distinct non-NULL strings, non-NULL
+ * @param n the size of that array
+ * @param bytes the size of the sketch in bytes
+ * @param heavy the number of candidates to keep for each keyword, at
+ * least 1; a top-k list is reliable when this is a few times k
+ * @return a pointer to the new counter, or NULL if the keywords are not
+ * distinct or there was an allocation error; it is the caller's
+ * responsibility to destroy the counter
+ */
+approx_counter *approx_create(char *key[], size_t n, size_t bytes, size_t heavy);
+
+/**
+ * Counts one context given as an array of words.  Repeated words are
+ * counted once, as by cooccur_update.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param context an array of n non-NULL strings
+ * @param n the number of words in the context
+ * @return false if there was an allocation error, in which case the
+ * context was not counted
+ */
+bool approx_update(approx_counter *a, char **context, size_t n);
+
+/**
+ * Reads and counts one context, a line of words separated by spaces,
+ * from the given stream.  Every word is counted, however long.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param stream a stream, non-NULL
+ * @return false at the end of the stream or if there was an allocation
+ * error
+ */
+bool approx_read_context(approx_counter *a, FILE *stream);
+
+/**
+ * Counts the words on the given line, separated by spaces, as one
+ * context.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param line a pointer to the first character of the line, which need
+ * not be NUL-terminated and should not include the newline
+ * @param len the length of the line
+ * @return false if there was an allocation error, in which case the
+ * context was not counted
+ */
+bool approx_count_line(approx_counter *a, const char *line, size_t len);
+
+/**
+ * Returns the estimated number of contexts containing both of the given
+ * words.  The count for a keyword with itself, the number of contexts it
+ * is in, is exact.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param keyword a keyword of the counter, non-NULL
+ * @param word a string, non-NULL
+ * @return the estimate, or 0 if keyword is not a keyword
+ */
+uint64_t approx_estimate(const approx_counter *a, const char *keyword, const char *word);
+
+/**
+ * Finds the words with the largest estimated cooccurrence counts with
+ * the keyword with the given index, other than the keyword itself, in
+ * decreasing order of count.  The counter retains ownership of the
+ * strings, which remain valid until the next update.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param index an index less than approx_size(a)
+ * @param k the number of words to find
+ * @param words an array of k pointers for the words
+ * @param counts an array of k counts for their estimates
+ * @return the number of words found, at most k
+ */
+size_t approx_top(const approx_counter *a, size_t index, size_t k, const char **words, uint64_t *counts);
+
+/**
+ * Returns how much too high an estimate may be: with probability
+ * approx_confidence(a) an estimate is at most this much above the true
+ * count.  The bound grows with the number of (keyword, word) pairs
+ * counted, so it is worth comparing to the counts it applies to.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @return the error bound
+ */
+double approx_error(const approx_counter *a);
+
+/**
+ * Returns the probability that an estimate is within approx_error(a) of
+ * the true count.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @return the confidence of the error bound
+ */
+double approx_confidence(const approx_counter *a);
+
+/**
+ * Returns the number of contexts counted.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @return the number of contexts
+ */
+uint64_t approx_contexts(const approx_counter *a);
+
+/**
+ * Returns the number of keywords of the given counter.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @return the number of keywords
+ */
+size_t approx_size(const approx_counter *a);
+
+/**
+ * Returns the keyword with the given index.  The counter retains
+ * ownership of the string.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param index an index less than approx_size(a)
+ * @return the keyword
+ */
+const char *approx_keyword(const approx_counter *a, size_t index);
+
+/**
+ * Returns the number of bytes allocated for the keywords, the sketch and
+ * the candidates of the given counter, and the width and depth of the
+ * sketch.
+ *
+ * @param a a pointer to a counter, non-NULL
+ * @param width a pointer to the width, or NULL
+ * @param depth a pointer to the depth, or NULL
+ * @return the size of the counter in bytes
+ */
+size_t approx_memory(const approx_counter *a, size_t *width, size_t *depth);
+
+/**
+ * Reads a size in bytes for approx_create, optionally followed by K, M
+ * or G.
+ *
+ * @param text a string, non-NULL
+ * @param bytes a pointer to a location for the size
+ * @return false if the text is not a positive size
+ */
+bool approx_parse_bytes(const char *text, size_t *bytes);
+
+/**
+ * Destroys the given counter.
+ *
+ * @param a a pointer to a counter
+ */
+void approx_destroy(approx_counter *a);
+
+#endif
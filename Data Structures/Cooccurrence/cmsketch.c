@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "cmsketch.h"
+
+// rows of counters; each row makes a bad estimate e times less likely
+#define CMSKETCH_DEPTH 4
+
+// widths are kept below 2^32 so a column is a 32-bit hash times the width
+#define CMSKETCH_MAX_WIDTH 0xffffffffULL
+
+struct cmsketch
+{
+  size_t width;
+  uint32_t *counters; // CMSKETCH_DEPTH rows of width counters
+  uint64_t total;
+};
+
+/**
+ * Computes the column of the given key in the given row, by double
+ * hashing from the two halves of the key.
+ */
+size_t cmsketch_column(const cmsketch *s, uint64_t key, size_t row);
+
+cmsketch *cmsketch_create(size_t bytes)
+{
+  cmsketch *s = malloc(sizeof(cmsketch));
+  if (s == NULL) {
+    return NULL;
+  }
+  s->width = bytes / (sizeof(uint32_t) * CMSKETCH_DEPTH);
+  if (s->width < 1) {
+    s->width = 1;
+  }
+  if (s->width > CMSKETCH_MAX_WIDTH) {
+    s->width = CMSKETCH_MAX_WIDTH;
+  }
+  s->counters = calloc(s->width * CMSKETCH_DEPTH, sizeof(uint32_t));
+  s->total = 0;
+  if (s->counters == NULL) {
+    free(s);
+    return NULL;
+  }
+  return s;
+}
+
+size_t cmsketch_column(const cmsketch *s, uint64_t key, size_t row)
+{
+  uint32_t h = (uint32_t)key + (uint32_t)row * ((uint32_t)(key >> 32) | 1);
+  return ((uint64_t)h * s->width) >> 32;
+}
+
+uint32_t cmsketch_add(cmsketch *s, uint64_t key)
+{
+  uint32_t *cells[CMSKETCH_DEPTH];
+  uint32_t min = UINT32_MAX;
+  for (size_t r = 0; r < CMSKETCH_DEPTH; r++) {
+    cells[r] = s->counters + r * s->width + cmsketch_column(s, key, r);
+    if (*cells[r] < min) {
+      min = *cells[r];
+    }
+  }
+  s->total++;
+  if (min == UINT32_MAX) {
+    return min;
+  }
+
+  // counters above the minimum already count this occurrence
+  for (size_t r = 0; r < CMSKETCH_DEPTH; r++) {
+    if (*cells[r] == min) {
+      (*cells[r])++;
+    }
+  }
+  return min + 1;
+}
+
+uint32_t cmsketch_estimate(const cmsketch *s, uint64_t key)
+{
+  uint32_t min = UINT32_MAX;
+  for (size_t r = 0; r < CMSKETCH_DEPTH; r++) {
+    uint32_t c = s->counters[r * s->width + cmsketch_column(s, key, r)];
+    if (c < min) {
+      min = c;
+    }
+  }
+  return min;
+}
+
+uint64_t cmsketch_total(const cmsketch *s)
+{
+  return s->total;
+}
+
+double cmsketch_epsilon(const cmsketch *s)
+{
+  return exp(1.0) / s->width;
+}
+
+double cmsketch_delta(const cmsketch *s)
+{
+  return exp(-(double)CMSKETCH_DEPTH);
+}
+
+size_t cmsketch_width(const cmsketch *s)
+{
+  return s->width;
+}
+
+size_t cmsketch_depth(const cmsketch *s)
+{
+  return CMSKETCH_DEPTH;
+}
+
+size_t cmsketch_memory(const cmsketch *s)
+{
+  return sizeof(cmsketch) + sizeof(uint32_t) * s->width * CMSKETCH_DEPTH;
+}
+
+void cmsketch_destroy(cmsketch *s)
+{
+  if (s != NULL) {
+    free(s->counters);
+    free(s);
+  }
+}
@@ -0,0 +1,102 @@
+#ifndef __CMSKETCH_H__
+#define __CMSKETCH_H__
+
+#include <stdlib.h>
+#include <stdint.h>
+
+struct cmsketch;
+typedef struct cmsketch cmsketch;
+
+/**
+ * Creates a Count-Min sketch that fits in the given number of bytes.  A
+ * sketch counts occurrences of 64-bit keys in fixed memory: each key has
+ * a counter in every row of the sketch, and its estimate is the smallest
+ * of them.  Estimates are never too low, and with probability at least
+ * 1 - cmsketch_delta they are at most cmsketch_epsilon times the total
+ * count too high.  Keys should already be well-mixed hashes.
+ *
+ * @param bytes the size of the counters in bytes
+ * @return a pointer to the new sketch, or NULL if there was an allocation
+ * error; it is the caller's responsibility to destroy the sketch
+ */
+cmsketch *cmsketch_create(size_t bytes);
+
+/**
+ * Counts one occurrence of the given key.  Only the counters that hold
+ * the key's current estimate are incremented (a conservative update),
+ * which keeps the guarantees and makes the other keys' estimates lower.
+ * Counters stop at UINT32_MAX.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @param key a key
+ * @return the new estimate for that key
+ */
+uint32_t cmsketch_add(cmsketch *s, uint64_t key);
+
+/**
+ * Returns the estimated count of the given key.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @param key a key
+ * @return the estimate
+ */
+uint32_t cmsketch_estimate(const cmsketch *s, uint64_t key);
+
+/**
+ * Returns the number of occurrences counted by the given sketch.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @return the total count
+ */
+uint64_t cmsketch_total(const cmsketch *s);
+
+/**
+ * Returns the error of the given sketch's estimates as a fraction of its
+ * total count.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @return e divided by the width of the sketch
+ */
+double cmsketch_epsilon(const cmsketch *s);
+
+/**
+ * Returns the probability that an estimate is off by more than the
+ * epsilon of the given sketch times its total count.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @return e to the minus depth of the sketch
+ */
+double cmsketch_delta(const cmsketch *s);
+
+/**
+ * Returns the number of counters in each row of the given sketch.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @return the width
+ */
+size_t cmsketch_width(const cmsketch *s);
+
+/**
+ * Returns the number of rows in the given sketch.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @return the depth
+ */
+size_t cmsketch_depth(const cmsketch *s);
+
+/**
+ * Returns the number of bytes allocated for the given sketch.
+ *
+ * @param s a pointer to a sketch, non-NULL
+ * @return the size of the sketch in bytes
+ */
+size_t cmsketch_memory(const cmsketch *s);
+
+/**
+ * Destroys the given sketch.
+ *
+ * @param s a pointer to a sketch
+ */
+void cmsketch_destroy(cmsketch *s);
+
+#endif
@@ -1,292 +1,1634 @@
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
-#include "gmap.h"
+#include <math.h>
 
 #include "cooccur.h"
+#include "kwtable.h"
+#include "parallel.h"
 #include "string_key.h"
+#include "vecops.h"
 
 struct cooccurrence_matrix
 {
-  int size;
-  gmap *indices;
-  gmap *vectors;
-  //char **keywords;
-  int max;
-  //int *check;
+  size_t size;
+  size_t capacity;   // keywords there is room for in each row and array
+  bool grow;         // whether words that are not keywords are added
+  kwtable *keywords; // compiled in cooccur_create, extended as it grows
+  void **vectors;    // one row per keyword, in keyword order
+  unsigned char *cells; // how the counts in each row are stored
+  size_t cell_bytes; // total size of the rows
+  double *expanded;  // two rows converted to doubles for dot products
+  size_t *scratch;   // keyword indices of the context being updated
+  size_t *seen;      // stamp of the last context each keyword was read in
+  size_t stamp;
+  char *word;        // buffer for the word being read
+  size_t word_cap;   // and its size
+  double *norms;     // Euclidean norm of each row, for similarity queries
+  bool norms_valid;  // false once an update has changed a row
+
+  // streaming mode: the keyword index (or -1) of each of the last
+  // window - 1 tokens, oldest first starting at ring_start
+  size_t window;
+  long *ring;
+  size_t ring_start;
+  size_t ring_fill;
+
+  // exponential decay: the true value of a count in row r is its stored
+  // value times exp(-rate * (clock - row_time[r])), so decaying costs
+  // nothing until a row's increments get large enough to rescale it
+  double rate;
+  uint64_t clock;
+  uint64_t *row_time;
+
+  // the number of contexts counted (tokens in streaming mode), decayed
+  // along with the counts; with the diagonal counts as marginals this is
+  // what association metrics need
+  double total;
+
+  size_t threads;    // for queries over the whole matrix
+  parallel_pool *pool; // and their threads, kept between queries
+
+  // batched updates: the contexts queued by cooccur_update_text, each as
+  // its length followed by its keyword indices, and the increments they
+  // make, bucketed by row when the batch is applied
+  size_t *batch;
+  size_t batch_used;
+  size_t batch_pairs;
+  size_t batch_limit;   // increments the batch has room for
+  bool batch_failed;    // the batch could not be allocated, so contexts
+                        // are counted one at a time from then on
+  size_t *batch_sorted;
+  size_t *batch_rows;   // the distinct rows the batch increments
+  size_t *batch_count;  // per keyword, the increments to its row
+  size_t batch_cap;     // size of batch_count
 };
 
-//taken from chomp_main.c to free the values in 
-void free_value(const void *key, void *value, void *arg);
+// how the counts in a row are stored, narrowest first; a row starts
+// with 16-bit counts and is widened when a count in it would overflow,
+// and rows of a decaying matrix hold doubles since their stored values
+// are scaled
+enum {COOCCUR_CELLS_U16, COOCCUR_CELLS_U32, COOCCUR_CELLS_U64, COOCCUR_CELLS_F64};
+
+// the number of increments gathered before a batch is applied: enough
+// for each row to get a run of them, within limits; the batch takes 32
+// bytes per increment (two places for the contexts, one for the sorted
+// increments and one for the rows), 128MB at the most
+#define COOCCUR_BATCH_PER_ROW 256
+#define COOCCUR_MIN_BATCH (1 << 16)
+#define COOCCUR_MAX_BATCH (1 << 22)
+
+// a row is rescaled once its increment weight reaches this (2^64)
+#define COOCCUR_RESCALE_LIMIT 18446744073709551616.0
+
+// checkpoint files start with the magic bytes and the format version
+#define COOCCUR_MAGIC "COOCMAT"
+#define COOCCUR_FORMAT_VERSION 2
+#define COOCCUR_MAX_KEYWORD_LENGTH (1 << 20)
+
+// how the cells of a row are stored in a checkpoint file
+enum {COOCCUR_ROW_F64, COOCCUR_ROW_U16, COOCCUR_ROW_U32, COOCCUR_ROW_U64};
+
+/**
+ * A checkpoint file being written or read, with a running FNV-1a
+ * checksum of every byte so that truncated or corrupted files are
+ * rejected.  Multi-byte values are little-endian regardless of the host.
+ */
+typedef struct cooccur_io
+{
+  FILE *stream;
+  uint64_t sum;
+  bool ok;
+} cooccur_io;
+
+void cooccur_io_write(cooccur_io *io, const void *p, size_t n);
+void cooccur_io_write_u64(cooccur_io *io, uint64_t v, size_t bytes);
+void cooccur_io_write_f64(cooccur_io *io, double v);
+void cooccur_io_read(cooccur_io *io, void *p, size_t n);
+uint64_t cooccur_io_read_u64(cooccur_io *io, size_t bytes);
+double cooccur_io_read_f64(cooccur_io *io);
+void cooccur_io_sum(cooccur_io *io, const void *p, size_t n);
+
+/**
+ * Returns the number of bytes taken by one count stored the given way.
+ */
+size_t cooccur_cell_size(unsigned char cells);
+
+/**
+ * Converts the given row to the given wider storage.
+ *
+ * @return false if there was an allocation error, in which case the row
+ * is unchanged
+ */
+bool cooccur_convert_row(cooccurrence_matrix *mat, size_t row, unsigned char cells);
+
+/**
+ * Adds the given weight (1.0 unless the row holds doubles) to the counts
+ * in the given columns of the given row, widening the row as needed.  An
+ * increment that would need a wider row that cannot be allocated is
+ * dropped.
+ */
+void cooccur_count_row(cooccurrence_matrix *mat, size_t row, const size_t *cols, size_t n, double w);
+
+/**
+ * Adds the given whole number to one count in the given integer row,
+ * widening the row as needed.
+ */
+void cooccur_add_count(cooccurrence_matrix *mat, size_t row, size_t col, uint64_t amount);
+
+/**
+ * Returns the stored value of one count in the given row.
+ */
+double cooccur_cell(const cooccurrence_matrix *mat, size_t row, size_t col);
+
+/**
+ * Returns one count in the given integer row.
+ */
+uint64_t cooccur_count(const cooccurrence_matrix *mat, size_t row, size_t col);
+
+/**
+ * Writes the stored values of the counts in the given row as doubles.
+ */
+void cooccur_expand_row(const cooccurrence_matrix *mat, size_t row, double *out);
+
+/**
+ * Makes room for at least the given number of keywords, at least
+ * doubling the capacity so that growing costs amortized O(1) per cell.
+ *
+ * @return false if there was an allocation error
+ */
+bool cooccur_reserve(cooccurrence_matrix *mat, size_t n);
+
+/**
+ * Returns the index of the given word, adding it as a keyword if it is
+ * not one and the matrix grows.  The word need not be NUL-terminated.
+ *
+ * @return the index, or -1 if the word is not (and could not be made) a
+ * keyword
+ */
+long cooccur_find_or_add(cooccurrence_matrix *mat, const char *word, size_t len);
+
+/**
+ * Counts one more context (or token) in the total, decaying the total
+ * first if the matrix decays.
+ */
+void cooccur_count_total(cooccurrence_matrix *mat);
+
+/**
+ * Writes the decayed diagonal count of every row to the given array.
+ */
+void cooccur_marginals(const cooccurrence_matrix *mat, double *out);
+
+/**
+ * Writes the given metric for one row, given the marginals.
+ */
+void cooccur_metric_row(const cooccurrence_matrix *mat, cooccur_metric metric, size_t row, const double *marginals, double *out);
+
+/**
+ * Computes a block of the rows requested from cooccur_get_metric_rows;
+ * arg points to a cooccur_metric_job.
+ */
+void cooccur_metric_block(size_t begin, size_t end, void *arg);
+
+typedef struct cooccur_metric_job
+{
+  const cooccurrence_matrix *mat;
+  cooccur_metric metric;
+  size_t first;
+  const double *marginals;
+  double *out;
+} cooccur_metric_job;
+
+/**
+ * Adds the keyword with the given index to the context being read, unless
+ * it has already been read in that context.
+ */
+void cooccur_add_read(cooccurrence_matrix *mat, char **context, size_t *count, long index);
+
+/**
+ * Reads the next word on the current line of the given stream into the
+ * matrix's word buffer, skipping leading spaces.  The word is truncated
+ * to the length of the longest keyword but its full length is reported,
+ * so that kwtable_find rejects longer words.
+ *
+ * @return the character that ended the word: a space, a newline or EOF
+ */
+int cooccur_read_word(cooccurrence_matrix *mat, FILE *stream, size_t *len);
+
+/**
+ * Finds the next word in the given line at or after the given position,
+ * skipping leading spaces.
+ *
+ * @return the length of the word, which starts at *pos, or 0 if there
+ * are no more words
+ */
+size_t cooccur_next_word(const char *line, size_t len, size_t *pos);
+
+/**
+ * Counts one context: the n distinct keywords whose indices are in the
+ * scratch array.
+ */
+void cooccur_count_context(cooccurrence_matrix *mat, size_t n);
+
+/**
+ * Adds the context on the given line to the batch, applying the batch
+ * first if it is full.  A context without keywords or too big for a
+ * batch, and every context once the batch could not be allocated, is
+ * counted at once.
+ */
+void cooccur_batch_line(cooccurrence_matrix *mat, const char *line, size_t len);
+
+/**
+ * Applies the increments of the contexts in the batch a row at a time
+ * and empties it.
+ */
+void cooccur_apply_batch(cooccurrence_matrix *mat);
+
+/**
+ * Returns the amount to add to a stored count in the given row for one
+ * cooccurrence at the current time, rescaling the row first if needed.
+ */
+double cooccur_weight(cooccurrence_matrix *mat, size_t row);
+
+/**
+ * Recomputes the cached row norms if an update has invalidated them.
+ */
+void cooccur_refresh_norms(cooccurrence_matrix *mat);
+
+/**
+ * Returns the cosine similarity of the two given rows, or 0.0 if either
+ * row is all zero.  The first row must already be expanded into the
+ * first half of the matrix's expanded buffer.
+ */
+double cooccur_cosine(cooccurrence_matrix *mat, size_t i, size_t j);
 
 cooccurrence_matrix *cooccur_create(char *key[], size_t n)
 {
-  gmap *check = gmap_create(duplicate, compare_keys, hash29, free);
-  if (check == NULL) {
-    return NULL;
-  }
-  for (int i = 0; i < n; i++) {
-    if (gmap_contains_key(check, key[i])) {
-      gmap_destroy(check);
-      return NULL;
-    }
-    else {
-      if (!gmap_put(check, key[i], NULL)) {
-        gmap_destroy(check);
-        return NULL;
-      }
-    }
-  }
-  gmap_destroy(check);
-  // need to add all the malloc fail checks!!
   cooccurrence_matrix *new = malloc(sizeof(cooccurrence_matrix));
   if (new == NULL) {
     return NULL;
   }
-  new->indices = gmap_create(duplicate, compare_keys, hash29, free);
-  if (new->indices == NULL) {
+
+  // also rejects duplicate keywords
+  new->keywords = kwtable_create(key, n);
+  if (new->keywords == NULL) {
     free(new);
     return NULL;
   }
-  new->vectors = gmap_create(duplicate, compare_keys, hash29, free);
-  if (new->vectors == NULL) {
-    gmap_destroy(new->indices);
+
+  size_t cap = n > 0 ? n : 1;
+  new->size = n;
+  new->capacity = cap;
+  new->grow = false;
+  new->stamp = 0;
+  new->vectors = malloc(sizeof(void *) * cap);
+  new->cells = malloc(cap);
+  new->cell_bytes = 0;
+  new->expanded = malloc(sizeof(double) * 2 * cap);
+  new->scratch = malloc(sizeof(size_t) * cap);
+  new->seen = calloc(cap, sizeof(size_t));
+  new->word_cap = kwtable_max_length(new->keywords) + 1;
+  new->word = malloc(new->word_cap);
+  new->norms = malloc(sizeof(double) * cap);
+  new->norms_valid = false;
+  new->window = 0;
+  new->ring = NULL;
+  new->ring_start = 0;
+  new->ring_fill = 0;
+  new->rate = 0.0;
+  new->clock = 0;
+  new->total = 0.0;
+  new->threads = 1;
+  new->pool = NULL;
+  new->batch = NULL;
+  new->batch_used = 0;
+  new->batch_pairs = 0;
+  new->batch_limit = 0;
+  new->batch_failed = false;
+  new->batch_sorted = NULL;
+  new->batch_rows = NULL;
+  new->batch_count = NULL;
+  new->batch_cap = 0;
+  new->row_time = calloc(cap, sizeof(uint64_t));
+  if (new->vectors == NULL || new->cells == NULL || new->expanded == NULL || new->scratch == NULL
+      || new->seen == NULL || new->word == NULL || new->norms == NULL || new->row_time == NULL) {
+    free(new->vectors);
+    free(new->cells);
+    free(new->expanded);
+    free(new->scratch);
+    free(new->seen);
+    free(new->word);
+    free(new->norms);
+    free(new->row_time);
+    kwtable_destroy(new->keywords);
     free(new);
     return NULL;
   }
-  new->size = n;
-  new->max = 0;
-  //new->check = calloc(n, sizeof(int));
-  // new->keywords = malloc(sizeof(char *)*n);
-  // if (new->keywords == NULL) {
-  //   gmap_destroy(new->indices);
-  //   gmap_destroy(new->vectors);
-  //   free(new);
-  //   return NULL;
-  // }
-  for (int i = 0; i < n; i++) {
-    int length = strlen(key[i]);
-    if (length > new->max) {
-      new->max = length;
-    }
-    // new->keywords[i] = duplicate(key[i]);
-  }
-
-  for (int i = 0; i < n; i++) {
-    double *ptr = calloc(n, sizeof(double));
-    if (ptr == NULL) {
-      gmap_for_each(new->vectors, free_value, NULL);
-      gmap_destroy(new->indices);
-      gmap_destroy(new->vectors);
-      free(new);
-    }
-    if (!gmap_put(new->vectors, key[i], ptr)) {
-      // free(new->keywords);
-      free(ptr);
-      gmap_for_each(new->vectors, free_value, NULL);
-      gmap_destroy(new->indices);
-      gmap_destroy(new->vectors);
-      free(new);
+
+  for (size_t i = 0; i < n; i++) {
+    new->vectors[i] = calloc(cap, cooccur_cell_size(COOCCUR_CELLS_U16));
+    if (new->vectors[i] == NULL) {
+      new->size = i;
+      cooccur_destroy(new);
       return NULL;
     }
-    // fprintf(stderr, "%lf\n", ptr[0]);
+    new->cells[i] = COOCCUR_CELLS_U16;
+    new->cell_bytes += cap * cooccur_cell_size(COOCCUR_CELLS_U16);
   }
 
-  for (int i = 0; i < n; i++) {
-    int *ptr = malloc(sizeof(int));
-    if (ptr == NULL) {
-      gmap_for_each(new->vectors, free_value, NULL);
-      gmap_for_each(new->indices, free_value, NULL);
-      gmap_destroy(new->indices);
-      gmap_destroy(new->vectors);
-      free(new); 
-      return NULL;
+  return new;
+}
+
+void cooccur_update(cooccurrence_matrix *mat, char **context, size_t n)
+{
+  for (size_t i = 0; i < n && mat->grow; i++) {
+    cooccur_find_or_add(mat, context[i], strlen(context[i]));
+  }
+  if (n > mat->size) {
+    return;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    long index = kwtable_find(mat->keywords, context[i], strlen(context[i]));
+    if (index < 0) {
+      return;
     }
-    *ptr = i;
-    if (!gmap_put(new->indices, key[i], ptr)) {
-      free(ptr);
-      gmap_for_each(new->vectors, free_value, NULL);
-      gmap_for_each(new->indices, free_value, NULL);
-      gmap_destroy(new->indices);
-      gmap_destroy(new->vectors);
-      free(new); 
-      return NULL;
+    mat->scratch[i] = index;
+  }
+  cooccur_count_context(mat, n);
+}
+
+void cooccur_update_line(cooccurrence_matrix *mat, const char *line, size_t len)
+{
+  size_t n = 0;
+  size_t pos = 0;
+  size_t word_len;
+  mat->stamp++;
+  while ((word_len = cooccur_next_word(line, len, &pos)) > 0) {
+    long index = cooccur_find_or_add(mat, line + pos, word_len);
+    if (index >= 0 && mat->seen[index] != mat->stamp) {
+      mat->seen[index] = mat->stamp;
+      mat->scratch[n++] = index;
     }
+    pos += word_len;
   }
+  cooccur_count_context(mat, n);
+}
 
-  // if (gmap_size(new->vectors) != n) {
-  //     gmap_for_each(new->vectors, free_value, NULL);
-  //     gmap_for_each(new->indices, free_value, NULL);
-  //     gmap_destroy(new->indices);
-  //     gmap_destroy(new->vectors);
-  //     free(new); 
-  //     return NULL;
-  // }
+void cooccur_update_text(cooccurrence_matrix *mat, const char *text, size_t len)
+{
+  // a decaying matrix weights each context by when it came, so only
+  // whole counts are batched
+  size_t pos = 0;
+  while (pos < len) {
+    const char *newline = memchr(text + pos, '\n', len - pos);
+    size_t end = newline != NULL ? (size_t)(newline - text) : len;
+    if (mat->rate != 0.0) {
+      cooccur_update_line(mat, text + pos, end - pos);
+    }
+    else {
+      cooccur_batch_line(mat, text + pos, end - pos);
+    }
+    pos = end + 1;
+  }
+  cooccur_apply_batch(mat);
+}
 
-  return new;
+void cooccur_batch_line(cooccurrence_matrix *mat, const char *line, size_t len)
+{
+  size_t n = 0;
+  size_t pos = 0;
+  size_t word_len;
+  mat->stamp++;
+  while ((word_len = cooccur_next_word(line, len, &pos)) > 0) {
+    long index = cooccur_find_or_add(mat, line + pos, word_len);
+    if (index >= 0 && mat->seen[index] != mat->stamp) {
+      mat->seen[index] = mat->stamp;
+      mat->scratch[n++] = index;
+    }
+    pos += word_len;
+  }
+
+  // a context without keywords adds only to the total, and would take a
+  // place in the batch without any increments to account for it
+  if (n == 0) {
+    cooccur_count_total(mat);
+    return;
+  }
+
+  // the batch grows with the matrix; a context of n > 0 keywords takes
+  // n + 1 places in it, at most twice its n * n increments
+  size_t limit = mat->size * COOCCUR_BATCH_PER_ROW;
+  limit = limit < COOCCUR_MIN_BATCH ? COOCCUR_MIN_BATCH : (limit > COOCCUR_MAX_BATCH ? COOCCUR_MAX_BATCH : limit);
+  if (limit > mat->batch_limit && !mat->batch_failed) {
+    cooccur_apply_batch(mat);
+    free(mat->batch);
+    free(mat->batch_sorted);
+    free(mat->batch_rows);
+    mat->batch = malloc(sizeof(size_t) * 2 * limit);
+    mat->batch_sorted = malloc(sizeof(size_t) * limit);
+    mat->batch_rows = malloc(sizeof(size_t) * limit);
+    mat->batch_limit = limit;
+    if (mat->batch == NULL || mat->batch_sorted == NULL || mat->batch_rows == NULL) {
+      free(mat->batch);
+      free(mat->batch_sorted);
+      free(mat->batch_rows);
+      mat->batch = NULL;
+      mat->batch_sorted = NULL;
+      mat->batch_rows = NULL;
+      mat->batch_limit = 0;
+      mat->batch_failed = true;
+    }
+  }
+  if (mat->batch == NULL || n * n > mat->batch_limit) {
+    cooccur_count_context(mat, n);
+    return;
+  }
+
+  // in increasing order the context's columns are written front to back
+  // in each of its rows
+  for (size_t i = 1; i < n; i++) {
+    size_t k = mat->scratch[i];
+    size_t j = i;
+    for (; j > 0 && mat->scratch[j - 1] > k; j--) {
+      mat->scratch[j] = mat->scratch[j - 1];
+    }
+    mat->scratch[j] = k;
+  }
+
+  if (mat->batch_pairs + n * n > mat->batch_limit) {
+    cooccur_apply_batch(mat);
+  }
+  cooccur_count_total(mat);
+  mat->batch[mat->batch_used++] = n;
+  memcpy(mat->batch + mat->batch_used, mat->scratch, sizeof(size_t) * n);
+  mat->batch_used += n;
+  mat->batch_pairs += n * n;
 }
 
-void cooccur_update(cooccurrence_matrix *mat, char **context, size_t n)
+void cooccur_apply_batch(cooccurrence_matrix *mat)
+{
+  if (mat->batch_pairs == 0) {
+    mat->batch_used = 0;
+    return;
+  }
+  mat->norms_valid = false;
+
+  // keywords added since the last batch need counters too
+  if (mat->batch_cap < mat->size) {
+    size_t *count = realloc(mat->batch_count, sizeof(size_t) * mat->capacity);
+    if (count == NULL) {
+      // count each context on its own instead
+      for (size_t c = 0; c < mat->batch_used; c += mat->batch[c] + 1) {
+        const size_t *keys = mat->batch + c + 1;
+        for (size_t i = 0; i < mat->batch[c]; i++) {
+          cooccur_count_row(mat, keys[i], keys, mat->batch[c], 1.0);
+        }
+      }
+      mat->batch_used = 0;
+      mat->batch_pairs = 0;
+      return;
+    }
+    memset(count + mat->batch_cap, 0, sizeof(size_t) * (mat->capacity - mat->batch_cap));
+    mat->batch_count = count;
+    mat->batch_cap = mat->capacity;
+  }
+
+  // a counting sort of the increments by row: count each row's, turn the
+  // counts into where each row's columns start, then copy the columns
+  size_t rows = 0;
+  for (size_t c = 0; c < mat->batch_used; c += mat->batch[c] + 1) {
+    for (size_t i = 0; i < mat->batch[c]; i++) {
+      size_t r = mat->batch[c + 1 + i];
+      if (mat->batch_count[r] == 0) {
+        mat->batch_rows[rows++] = r;
+      }
+      mat->batch_count[r] += mat->batch[c];
+    }
+  }
+  size_t offset = 0;
+  for (size_t i = 0; i < rows; i++) {
+    size_t r = mat->batch_rows[i];
+    size_t n = mat->batch_count[r];
+    mat->batch_count[r] = offset;
+    offset += n;
+  }
+  for (size_t c = 0; c < mat->batch_used; c += mat->batch[c] + 1) {
+    const size_t *keys = mat->batch + c + 1;
+    for (size_t i = 0; i < mat->batch[c]; i++) {
+      memcpy(mat->batch_sorted + mat->batch_count[keys[i]], keys, sizeof(size_t) * mat->batch[c]);
+      mat->batch_count[keys[i]] += mat->batch[c];
+    }
+  }
+
+  // each row's increments are now together, and each row ends where the
+  // next one in the list starts
+  size_t begin = 0;
+  for (size_t i = 0; i < rows; i++) {
+    size_t r = mat->batch_rows[i];
+    cooccur_count_row(mat, r, mat->batch_sorted + begin, mat->batch_count[r] - begin, 1.0);
+    begin = mat->batch_count[r];
+    mat->batch_count[r] = 0;
+  }
+  mat->batch_used = 0;
+  mat->batch_pairs = 0;
+}
+
+void cooccur_count_context(cooccurrence_matrix *mat, size_t n)
+{
+  if (n > 0) {
+    mat->norms_valid = false;
+  }
+
+  // outside streaming mode time advances one tick per context
+  if (mat->rate != 0.0) {
+    mat->clock++;
+  }
+  cooccur_count_total(mat);
+  for (size_t i = 0; i < n; i++) {
+    cooccur_count_row(mat, mat->scratch[i], mat->scratch, n, cooccur_weight(mat, mat->scratch[i]));
+  }
+}
+
+size_t cooccur_next_word(const char *line, size_t len, size_t *pos)
+{
+  size_t start = *pos;
+  while (start < len && line[start] == ' ') {
+    start++;
+  }
+  *pos = start;
+  if (start == len) {
+    return 0;
+  }
+  const char *space = memchr(line + start, ' ', len - start);
+  return (space != NULL ? (size_t)(space - line) : len) - start;
+}
+
+long cooccur_add_keyword(cooccurrence_matrix *mat, const char *word)
+{
+  long index = cooccur_index(mat, word);
+  if (index >= 0) {
+    return index;
+  }
+
+  size_t len = strlen(word);
+  if (len + 1 > mat->word_cap) {
+    char *bigger = realloc(mat->word, len + 1);
+    if (bigger == NULL) {
+      return -1;
+    }
+    mat->word = bigger;
+    mat->word_cap = len + 1;
+  }
+
+  // a new row and column of zeros; rows of a decaying matrix hold doubles
+  unsigned char cells = mat->rate != 0.0 ? COOCCUR_CELLS_F64 : COOCCUR_CELLS_U16;
+  if (!cooccur_reserve(mat, mat->size + 1)) {
+    return -1;
+  }
+  void *row = calloc(mat->capacity, cooccur_cell_size(cells));
+  if (row == NULL) {
+    return -1;
+  }
+  index = kwtable_add(mat->keywords, word);
+  if (index < 0) {
+    free(row);
+    return -1;
+  }
+
+  mat->vectors[index] = row;
+  mat->cells[index] = cells;
+  mat->cell_bytes += mat->capacity * cooccur_cell_size(cells);
+  mat->row_time[index] = mat->clock;
+  mat->seen[index] = 0;
+  mat->size++;
+  mat->norms_valid = false;
+  return index;
+}
+
+void cooccur_set_grow(cooccurrence_matrix *mat, bool grow)
+{
+  mat->grow = grow;
+}
+
+bool cooccur_reserve(cooccurrence_matrix *mat, size_t n)
 {
-  for (int i = 0; i < n; i++) {
-    //fprintf(stderr, "%s\n", context[i]);
-    if (!gmap_contains_key(mat->vectors, context[i])) {
+  if (n <= mat->capacity) {
+    return true;
+  }
+
+  size_t cap = 2 * mat->capacity > n ? 2 * mat->capacity : n;
+  void **vectors = realloc(mat->vectors, sizeof(void *) * cap);
+  if (vectors != NULL) {
+    mat->vectors = vectors;
+  }
+  unsigned char *cells = realloc(mat->cells, cap);
+  if (cells != NULL) {
+    mat->cells = cells;
+  }
+  double *expanded = realloc(mat->expanded, sizeof(double) * 2 * cap);
+  if (expanded != NULL) {
+    mat->expanded = expanded;
+  }
+  size_t *scratch = realloc(mat->scratch, sizeof(size_t) * cap);
+  if (scratch != NULL) {
+    mat->scratch = scratch;
+  }
+  size_t *seen = realloc(mat->seen, sizeof(size_t) * cap);
+  if (seen != NULL) {
+    mat->seen = seen;
+  }
+  double *norms = realloc(mat->norms, sizeof(double) * cap);
+  if (norms != NULL) {
+    mat->norms = norms;
+  }
+  uint64_t *row_time = realloc(mat->row_time, sizeof(uint64_t) * cap);
+  if (row_time != NULL) {
+    mat->row_time = row_time;
+  }
+  if (vectors == NULL || cells == NULL || expanded == NULL || scratch == NULL
+      || seen == NULL || norms == NULL || row_time == NULL) {
+    // whatever was enlarged stays enlarged, which is harmless
+    return false;
+  }
+
+  // widen every row, with zeros in the new columns
+  for (size_t r = 0; r < mat->size; r++) {
+    size_t bytes = cooccur_cell_size(mat->cells[r]);
+    char *row = realloc(mat->vectors[r], bytes * cap);
+    if (row == NULL) {
+      return false;
+    }
+    memset(row + bytes * mat->capacity, 0, bytes * (cap - mat->capacity));
+    mat->vectors[r] = row;
+  }
+
+  mat->cell_bytes = mat->cell_bytes / mat->capacity * cap;
+  mat->capacity = cap;
+  return true;
+}
+
+long cooccur_find_or_add(cooccurrence_matrix *mat, const char *word, size_t len)
+{
+  long index = kwtable_find(mat->keywords, word, len);
+  if (index >= 0 || !mat->grow) {
+    return index;
+  }
+
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    return -1;
+  }
+  memcpy(copy, word, len);
+  copy[len] = '\0';
+  index = cooccur_add_keyword(mat, copy);
+  free(copy);
+  return index;
+}
+
+size_t cooccur_cell_size(unsigned char cells)
+{
+  switch (cells) {
+  case COOCCUR_CELLS_U16:
+    return sizeof(uint16_t);
+  case COOCCUR_CELLS_U32:
+    return sizeof(uint32_t);
+  case COOCCUR_CELLS_U64:
+    return sizeof(uint64_t);
+  default:
+    return sizeof(double);
+  }
+}
+
+bool cooccur_convert_row(cooccurrence_matrix *mat, size_t row, unsigned char cells)
+{
+  if (mat->cells[row] == cells) {
+    return true;
+  }
+
+  // columns past the last keyword stay zero for keywords added later
+  size_t n = mat->size;
+  void *wide = calloc(mat->capacity, cooccur_cell_size(cells));
+  if (wide == NULL) {
+    return false;
+  }
+
+  // only integer rows are widened, so every count fits in a uint64_t
+  for (size_t j = 0; j < n; j++) {
+    uint64_t count = cooccur_count(mat, row, j);
+    switch (cells) {
+    case COOCCUR_CELLS_U32:
+      ((uint32_t *)wide)[j] = count;
+      break;
+    case COOCCUR_CELLS_U64:
+      ((uint64_t *)wide)[j] = count;
+      break;
+    case COOCCUR_CELLS_F64:
+      ((double *)wide)[j] = count;
+      break;
+    }
+  }
+
+  mat->cell_bytes += mat->capacity * cooccur_cell_size(cells);
+  mat->cell_bytes -= mat->capacity * cooccur_cell_size(mat->cells[row]);
+  free(mat->vectors[row]);
+  mat->vectors[row] = wide;
+  mat->cells[row] = cells;
+  return true;
+}
+
+void cooccur_count_row(cooccurrence_matrix *mat, size_t row, const size_t *cols, size_t n, double w)
+{
+  // count in the row's current storage until a count would overflow,
+  // then widen the row and carry on from there
+  size_t j = 0;
+  while (j < n) {
+    switch (mat->cells[row]) {
+    case COOCCUR_CELLS_U16: {
+      uint16_t *vec = mat->vectors[row];
+      for (; j < n && vec[cols[j]] != UINT16_MAX; j++) {
+        vec[cols[j]]++;
+      }
+      break;
+    }
+    case COOCCUR_CELLS_U32: {
+      uint32_t *vec = mat->vectors[row];
+      for (; j < n && vec[cols[j]] != UINT32_MAX; j++) {
+        vec[cols[j]]++;
+      }
+      break;
+    }
+    case COOCCUR_CELLS_U64: {
+      uint64_t *vec = mat->vectors[row];
+      for (; j < n && vec[cols[j]] != UINT64_MAX; j++) {
+        vec[cols[j]]++;
+      }
+      break;
+    }
+    default: {
+      double *vec = mat->vectors[row];
+      for (; j < n; j++) {
+        vec[cols[j]] += w;
+      }
+      break;
+    }
+    }
+
+    if (j < n && !cooccur_convert_row(mat, row, mat->cells[row] + 1)) {
+      j++;
+    }
+  }
+}
+
+void cooccur_add_count(cooccurrence_matrix *mat, size_t row, size_t col, uint64_t amount)
+{
+  while (true) {
+    switch (mat->cells[row]) {
+    case COOCCUR_CELLS_U16: {
+      uint16_t *vec = mat->vectors[row];
+      if (amount <= UINT16_MAX - vec[col]) {
+        vec[col] += amount;
+        return;
+      }
+      break;
+    }
+    case COOCCUR_CELLS_U32: {
+      uint32_t *vec = mat->vectors[row];
+      if (amount <= UINT32_MAX - vec[col]) {
+        vec[col] += amount;
+        return;
+      }
+      break;
+    }
+    case COOCCUR_CELLS_U64: {
+      uint64_t *vec = mat->vectors[row];
+      if (amount <= UINT64_MAX - vec[col]) {
+        vec[col] += amount;
+        return;
+      }
+      break;
+    }
+    default:
+      ((double *)mat->vectors[row])[col] += amount;
+      return;
+    }
+
+    if (!cooccur_convert_row(mat, row, mat->cells[row] + 1)) {
       return;
     }
   }
-  // fprintf(stderr, "first half\n");
+}
+
+double cooccur_cell(const cooccurrence_matrix *mat, size_t row, size_t col)
+{
+  switch (mat->cells[row]) {
+  case COOCCUR_CELLS_U16:
+    return ((const uint16_t *)mat->vectors[row])[col];
+  case COOCCUR_CELLS_U32:
+    return ((const uint32_t *)mat->vectors[row])[col];
+  case COOCCUR_CELLS_U64:
+    return ((const uint64_t *)mat->vectors[row])[col];
+  default:
+    return ((const double *)mat->vectors[row])[col];
+  }
+}
+
+uint64_t cooccur_count(const cooccurrence_matrix *mat, size_t row, size_t col)
+{
+  switch (mat->cells[row]) {
+  case COOCCUR_CELLS_U16:
+    return ((const uint16_t *)mat->vectors[row])[col];
+  case COOCCUR_CELLS_U32:
+    return ((const uint32_t *)mat->vectors[row])[col];
+  default:
+    return ((const uint64_t *)mat->vectors[row])[col];
+  }
+}
 
-  for (int i = 0; i < n; i++) {
-    double *vec = gmap_get(mat->vectors, context[i]);
-    // fprintf(stderr, "%lf\n", vec[0]);
-    for (int j = 0; j < n; j++) {
-      int *index = gmap_get(mat->indices, context[j]);
-      // fprintf(stderr, "%d\n", *index);
-      vec[*index]++;
+void cooccur_expand_row(const cooccurrence_matrix *mat, size_t row, double *out)
+{
+  size_t n = mat->size;
+  switch (mat->cells[row]) {
+  case COOCCUR_CELLS_U16: {
+    const uint16_t *vec = mat->vectors[row];
+    for (size_t j = 0; j < n; j++) {
+      out[j] = vec[j];
     }
+    break;
+  }
+  case COOCCUR_CELLS_U32: {
+    const uint32_t *vec = mat->vectors[row];
+    for (size_t j = 0; j < n; j++) {
+      out[j] = vec[j];
+    }
+    break;
+  }
+  case COOCCUR_CELLS_U64: {
+    const uint64_t *vec = mat->vectors[row];
+    for (size_t j = 0; j < n; j++) {
+      out[j] = vec[j];
+    }
+    break;
+  }
+  default:
+    memcpy(out, mat->vectors[row], sizeof(double) * n);
+    break;
   }
 }
 
 char **cooccur_read_context(cooccurrence_matrix *mat, FILE *stream, size_t *n)
 {
-  gmap *check = gmap_create(duplicate, compare_keys, hash29, free);
-  if (check == NULL) {
+  int c = getc(stream);
+  if (c == EOF) {
     return NULL;
   }
-  // TAKE CARE OF DOUBLE SHOWINGS CONTEXT WORDS
-  char **context = malloc(sizeof(char *) * mat->size);
+
+  size_t cap = mat->size > 0 ? mat->size : 1;
+  char **context = malloc(sizeof(char *) * cap);
   if (context == NULL) {
-    gmap_destroy(check);
-    return NULL;
-  }
-//which to do while loop
-  // char format[mat->max];
-  // sprintf(format, "%%%ds", mat->max);
-  char word[mat->max + 1];
-  int counter = 0;
-  char c;
-  int word_count = 0;
-  if ((c = getc(stream)) == '\n') {
-    *n = word_count;
-    gmap_destroy(check);
-
-    return context;
-  }
-  else if (c == EOF) {
-    gmap_destroy(check);
-    free(context);
     return NULL;
   }
+
+  ungetc(c, stream);
+  size_t len;
+  size_t count = 0;
+  mat->stamp++;
   do {
-    //fprintf(stderr, "next: %c\n", c);
-    // if (c == EOF) {
-    //   gmap_destroy(check);
-    //   free(context);
-    //   return NULL;
-    // }
-    if (c != ' ' && counter < mat->max + 1) {
-      word[counter] = c;
-      word[counter+1] = '\0';
-      counter++;
-    }
-    else if (c == ' ' && counter > 0) {
-      //fprintf(stderr, "first\n");
-      //word[counter] = '\0';
-      if (gmap_contains_key(mat->vectors, word)) {
-        if (!gmap_contains_key(check, word)) {
-          context[word_count] = duplicate(word);
-          word_count++;
-          if (!gmap_put(check, word, NULL)) {
-            free(context);
-            gmap_destroy(check);
-            return NULL;
-          }
+    c = cooccur_read_word(mat, stream, &len);
+    if (len > 0) {
+      long index = cooccur_find_or_add(mat, mat->word, len);
+      if (count == cap && index >= 0) {
+        // only a growing matrix gets more keywords than it had
+        char **bigger = realloc(context, sizeof(char *) * cap * 2);
+        if (bigger == NULL) {
+          index = -1;
+        }
+        else {
+          context = bigger;
+          cap *= 2;
         }
       }
-      counter = 0;
+      cooccur_add_read(mat, context, &count, index);
+    }
+  } while (c != '\n' && c != EOF);
+
+  *n = count;
+  return context;
+}
+
+int cooccur_read_word(cooccurrence_matrix *mat, FILE *stream, size_t *len)
+{
+  size_t max = kwtable_max_length(mat->keywords);
+  bool truncated = false;
+  int c;
+  *len = 0;
+  while ((c = getc(stream)) == ' ') {
+  }
+  while (c != ' ' && c != '\n' && c != EOF) {
+    if (mat->grow && *len + 1 == mat->word_cap) {
+      // any word may become a keyword, so it is read in full
+      char *bigger = realloc(mat->word, mat->word_cap * 2);
+      if (bigger != NULL) {
+        mat->word = bigger;
+        mat->word_cap *= 2;
+      }
+      else {
+        truncated = true;
+      }
+    }
+    if (*len < max || (mat->grow && *len + 1 < mat->word_cap)) {
+      mat->word[*len] = c;
+    }
+    if (!truncated) {
+      (*len)++;
+    }
+    c = getc(stream);
+  }
+  return c;
+}
+
+void cooccur_add_read(cooccurrence_matrix *mat, char **context, size_t *count, long index)
+{
+  if (index >= 0 && mat->seen[index] != mat->stamp) {
+    mat->seen[index] = mat->stamp;
+    context[(*count)++] = duplicate(kwtable_word(mat->keywords, index));
+  }
+}
+
+double *cooccur_get_vector(cooccurrence_matrix *mat, const char *word)
+{
+  double *get = malloc(sizeof(double) * (mat->size > 0 ? mat->size : 1));
+  if (get != NULL) {
+    cooccur_get_vector_into(mat, word, get);
+  }
+  return get;
+}
+
+bool cooccur_get_vector_into(const cooccurrence_matrix *mat, const char *word, double *out)
+{
+  long index = cooccur_index(mat, word);
+  if (index < 0) {
+    memset(out, 0, sizeof(double) * mat->size);
+    return false;
+  }
+
+  cooccur_get_row_into(mat, index, out);
+  return true;
+}
+
+void cooccur_get_row_into(const cooccurrence_matrix *mat, size_t index, double *out)
+{
+  // divide by diagonal; the counts are only converted to doubles here
+  double value = cooccur_cell(mat, index, index);
+  if (value == 0) {
+    memset(out, 0, sizeof(double) * mat->size);
+  }
+  else {
+    cooccur_expand_row(mat, index, out);
+    vec_divide(out, out, value, mat->size);
+  }
+}
+
+bool cooccur_set_window(cooccurrence_matrix *mat, size_t window)
+{
+  long *ring = NULL;
+  if (window > 1) {
+    ring = malloc(sizeof(long) * (window - 1));
+    if (ring == NULL) {
+      return false;
+    }
+  }
+
+  free(mat->ring);
+  mat->ring = ring;
+  mat->window = window;
+  mat->ring_start = 0;
+  mat->ring_fill = 0;
+  return true;
+}
+
+bool cooccur_set_decay(cooccurrence_matrix *mat, double half_life)
+{
+  // scaled counts are not whole numbers
+  for (size_t r = 0; r < mat->size && half_life > 0.0; r++) {
+    if (!cooccur_convert_row(mat, r, COOCCUR_CELLS_F64)) {
+      return false;
+    }
+  }
+
+  // fold the old decay into the stored counts before changing the rate
+  for (size_t r = 0; r < mat->size; r++) {
+    if (mat->rate != 0.0) {
+      double factor = exp(-mat->rate * (mat->clock - mat->row_time[r]));
+      double *vec = mat->vectors[r];
+      for (size_t j = 0; j < mat->size; j++) {
+        vec[j] *= factor;
+      }
+    }
+    mat->row_time[r] = mat->clock;
+  }
+  mat->rate = half_life > 0.0 ? log(2.0) / half_life : 0.0;
+  return true;
+}
+
+void cooccur_stream_token(cooccurrence_matrix *mat, const char *word, size_t len)
+{
+  long k = cooccur_find_or_add(mat, word, len);
+  mat->clock++;
+  cooccur_count_total(mat);
+
+  if (k >= 0) {
+    // k with itself, then with each distinct keyword among the previous
+    // window - 1 tokens, in both directions
+    mat->stamp++;
+    mat->seen[k] = mat->stamp;
+    size_t count = 0;
+    mat->scratch[count++] = k;
+    for (size_t p = 0; p < mat->ring_fill; p++) {
+      long j = mat->ring[(mat->ring_start + p) % (mat->window - 1)];
+      if (j >= 0 && mat->seen[j] != mat->stamp) {
+        mat->seen[j] = mat->stamp;
+        mat->scratch[count++] = j;
+        cooccur_count_row(mat, j, mat->scratch, 1, cooccur_weight(mat, j));
+      }
+    }
+    cooccur_count_row(mat, k, mat->scratch, count, cooccur_weight(mat, k));
+    mat->norms_valid = false;
+  }
+
+  if (mat->window > 1) {
+    if (mat->ring_fill < mat->window - 1) {
+      mat->ring[(mat->ring_start + mat->ring_fill++) % (mat->window - 1)] = k;
+    }
+    else {
+      mat->ring[mat->ring_start] = k;
+      mat->ring_start = (mat->ring_start + 1) % (mat->window - 1);
+    }
+  }
+}
+
+bool cooccur_read_stream(cooccurrence_matrix *mat, FILE *stream)
+{
+  int c = getc(stream);
+  if (c == EOF) {
+    return false;
+  }
+
+  ungetc(c, stream);
+  size_t len;
+  do {
+    c = cooccur_read_word(mat, stream, &len);
+    if (len > 0) {
+      cooccur_stream_token(mat, mat->word, len);
+    }
+  } while (c != '\n' && c != EOF);
+  return true;
+}
+
+void cooccur_stream_line(cooccurrence_matrix *mat, const char *line, size_t len)
+{
+  size_t pos = 0;
+  size_t word_len;
+  while ((word_len = cooccur_next_word(line, len, &pos)) > 0) {
+    cooccur_stream_token(mat, line + pos, word_len);
+    pos += word_len;
+  }
+}
+
+double cooccur_weight(cooccurrence_matrix *mat, size_t row)
+{
+  if (mat->rate == 0.0) {
+    return 1.0;
+  }
+
+  double w = exp(mat->rate * (mat->clock - mat->row_time[row]));
+  if (w >= COOCCUR_RESCALE_LIMIT) {
+    double *vec = mat->vectors[row];
+    for (size_t j = 0; j < mat->size; j++) {
+      vec[j] /= w;
+    }
+    mat->row_time[row] = mat->clock;
+    w = 1.0;
+  }
+  return w;
+}
+
+void cooccur_get_counts_into(const cooccurrence_matrix *mat, size_t index, double *out)
+{
+  cooccur_expand_row(mat, index, out);
+  if (mat->rate != 0.0) {
+    double factor = exp(-mat->rate * (mat->clock - mat->row_time[index]));
+    for (size_t j = 0; j < mat->size; j++) {
+      out[j] *= factor;
+    }
+  }
+}
+
+void cooccur_count_total(cooccurrence_matrix *mat)
+{
+  if (mat->rate == 0.0) {
+    mat->total++;
+  }
+  else {
+    mat->total = mat->total * exp(-mat->rate) + 1.0;
+  }
+}
+
+double cooccur_contexts(const cooccurrence_matrix *mat)
+{
+  return mat->total;
+}
+
+void cooccur_set_threads(cooccurrence_matrix *mat, size_t threads)
+{
+  mat->threads = threads > 0 ? threads : parallel_processors();
+
+  // without a pool the queries start their own threads
+  parallel_pool_destroy(mat->pool);
+  mat->pool = mat->threads > 1 ? parallel_pool_create(mat->threads) : NULL;
+}
+
+size_t cooccur_threads(const cooccurrence_matrix *mat)
+{
+  return mat->pool != NULL ? parallel_pool_size(mat->pool) : mat->threads;
+}
+
+void cooccur_parallel(const cooccurrence_matrix *mat, size_t n, void (*body)(size_t begin, size_t end, void *arg), void *arg)
+{
+  if (mat->pool != NULL) {
+    parallel_pool_for(mat->pool, n, body, arg);
+  }
+  else {
+    parallel_for(n, mat->threads, body, arg);
+  }
+}
+
+void cooccur_marginals(const cooccurrence_matrix *mat, double *out)
+{
+  for (size_t i = 0; i < mat->size; i++) {
+    out[i] = cooccur_cell(mat, i, i);
+    if (mat->rate != 0.0) {
+      out[i] *= exp(-mat->rate * (mat->clock - mat->row_time[i]));
+    }
+  }
+}
+
+void cooccur_metric_row(const cooccurrence_matrix *mat, cooccur_metric metric, size_t row, const double *marginals, double *out)
+{
+  if (metric == COOCCUR_PROPORTION) {
+    cooccur_get_row_into(mat, row, out);
+    return;
+  }
+
+  cooccur_get_counts_into(mat, row, out);
+  double ci = marginals[row];
+  for (size_t j = 0; j < mat->size; j++) {
+    double cij = out[j];
+    double cj = marginals[j];
+    if (cij <= 0.0 || ci <= 0.0 || cj <= 0.0) {
+      out[j] = 0.0;
+    }
+    else if (metric == COOCCUR_JACCARD) {
+      // in streaming mode a pair can be counted more often than one of
+      // its keywords, so the union is at least the larger marginal
+      double both = ci + cj - cij;
+      out[j] = cij / (both > ci && both > cj ? both : (ci > cj ? ci : cj));
+    }
+    else {
+      out[j] = log(cij * mat->total / (ci * cj));
+      if (metric == COOCCUR_PPMI && out[j] < 0.0) {
+        out[j] = 0.0;
+      }
+    }
+  }
+}
+
+bool cooccur_get_metric_into(const cooccurrence_matrix *mat, const char *word, cooccur_metric metric, double *out)
+{
+  long index = cooccur_index(mat, word);
+  if (index < 0) {
+    memset(out, 0, sizeof(double) * mat->size);
+    return false;
+  }
+  return cooccur_get_metric_rows(mat, metric, index, 1, out);
+}
+
+bool cooccur_get_metric_rows(const cooccurrence_matrix *mat, cooccur_metric metric, size_t first, size_t count, double *out)
+{
+  double *marginals = malloc(sizeof(double) * (mat->size > 0 ? mat->size : 1));
+  if (marginals == NULL) {
+    return false;
+  }
+  cooccur_marginals(mat, marginals);
+
+  cooccur_metric_job job = {mat, metric, first, marginals, out};
+  cooccur_parallel(mat, count, cooccur_metric_block, &job);
+  free(marginals);
+  return true;
+}
+
+void cooccur_metric_block(size_t begin, size_t end, void *arg)
+{
+  cooccur_metric_job *job = arg;
+  for (size_t r = begin; r < end; r++) {
+    cooccur_metric_row(job->mat, job->metric, job->first + r, job->marginals, job->out + r * job->mat->size);
+  }
+}
+
+size_t cooccur_size(const cooccurrence_matrix *mat)
+{
+  return mat->size;
+}
+
+const char *cooccur_keyword(const cooccurrence_matrix *mat, size_t index)
+{
+  return kwtable_word(mat->keywords, index);
+}
+
+long cooccur_index(const cooccurrence_matrix *mat, const char *word)
+{
+  return kwtable_find(mat->keywords, word, strlen(word));
+}
+
+double cooccur_similarity(cooccurrence_matrix *mat, const char *word1, const char *word2)
+{
+  long i = cooccur_index(mat, word1);
+  long j = cooccur_index(mat, word2);
+  if (i < 0 || j < 0) {
+    return 0.0;
+  }
+
+  cooccur_refresh_norms(mat);
+  cooccur_expand_row(mat, i, mat->expanded);
+  return cooccur_cosine(mat, i, j);
+}
+
+bool cooccur_similarities(cooccurrence_matrix *mat, const char *word, double *out)
+{
+  long i = cooccur_index(mat, word);
+  if (i < 0) {
+    memset(out, 0, sizeof(double) * mat->size);
+    return false;
+  }
+
+  cooccur_refresh_norms(mat);
+  cooccur_expand_row(mat, i, mat->expanded);
+  for (size_t j = 0; j < mat->size; j++) {
+    out[j] = cooccur_cosine(mat, i, j);
+  }
+  return true;
+}
+
+size_t cooccur_nearest(cooccurrence_matrix *mat, const char *word, size_t k, size_t *indices, double *similarities)
+{
+  long i = cooccur_index(mat, word);
+  double *all = malloc(sizeof(double) * (mat->size > 0 ? mat->size : 1));
+  if (i < 0 || all == NULL) {
+    free(all);
+    return 0;
+  }
+
+  cooccur_similarities(mat, word, all);
+  size_t found = vec_top_k(all, mat->size, k, i, indices);
+  if (similarities != NULL) {
+    for (size_t j = 0; j < found; j++) {
+      similarities[j] = all[indices[j]];
+    }
+  }
+  free(all);
+  return found;
+}
+
+void cooccur_refresh_norms(cooccurrence_matrix *mat)
+{
+  if (!mat->norms_valid) {
+    for (size_t i = 0; i < mat->size; i++) {
+      cooccur_expand_row(mat, i, mat->expanded);
+      mat->norms[i] = sqrt(vec_dot(mat->expanded, mat->expanded, mat->size));
+    }
+    mat->norms_valid = true;
+  }
+}
+
+double cooccur_cosine(cooccurrence_matrix *mat, size_t i, size_t j)
+{
+  if (mat->norms[i] == 0.0 || mat->norms[j] == 0.0) {
+    return 0.0;
+  }
+  double *row_j = mat->expanded + mat->size;
+  cooccur_expand_row(mat, j, row_j);
+  return vec_dot(mat->expanded, row_j, mat->size) / (mat->norms[i] * mat->norms[j]);
+}
+
+bool cooccur_save(const cooccurrence_matrix *mat, FILE *stream)
+{
+  cooccur_io io = {stream, 0xcbf29ce484222325ULL, true};
+
+  // header
+  cooccur_io_write(&io, COOCCUR_MAGIC, sizeof(COOCCUR_MAGIC));
+  cooccur_io_write_u64(&io, COOCCUR_FORMAT_VERSION, 4);
+  cooccur_io_write_u64(&io, 0, 4);
+  cooccur_io_write_u64(&io, mat->size, 8);
+  cooccur_io_write_u64(&io, mat->window, 8);
+  cooccur_io_write_u64(&io, mat->clock, 8);
+  cooccur_io_write_f64(&io, mat->rate);
+  cooccur_io_write_f64(&io, mat->total);
+
+  // keyword table
+  for (size_t i = 0; i < mat->size; i++) {
+    const char *word = kwtable_word(mat->keywords, i);
+    size_t len = strlen(word);
+    cooccur_io_write_u64(&io, len, 4);
+    cooccur_io_write(&io, word, len);
+  }
+
+  // raw counts
+  for (size_t r = 0; r < mat->size && io.ok; r++) {
+    cooccur_io_write_u64(&io, mat->row_time[r], 8);
+    if (mat->cells[r] == COOCCUR_CELLS_F64) {
+      cooccur_io_write_u64(&io, COOCCUR_ROW_F64, 1);
+      for (size_t j = 0; j < mat->size; j++) {
+        cooccur_io_write_f64(&io, ((double *)mat->vectors[r])[j]);
+      }
     }
-    else if (c == ' ' && counter == 0){
-      continue;
+    else {
+      // integer rows are written at their current width
+      size_t bytes = cooccur_cell_size(mat->cells[r]);
+      cooccur_io_write_u64(&io, COOCCUR_ROW_U16 + mat->cells[r], 1);
+      for (size_t j = 0; j < mat->size; j++) {
+        cooccur_io_write_u64(&io, cooccur_count(mat, r, j), bytes);
+      }
+    }
+  }
+
+  uint64_t sum = io.sum;
+  cooccur_io_write_u64(&io, sum, 8);
+  return io.ok && fflush(stream) == 0;
+}
+
+cooccurrence_matrix *cooccur_load(FILE *stream)
+{
+  cooccur_io io = {stream, 0xcbf29ce484222325ULL, true};
+
+  char magic[sizeof(COOCCUR_MAGIC)];
+  cooccur_io_read(&io, magic, sizeof(magic));
+  uint64_t version = cooccur_io_read_u64(&io, 4);
+  if (!io.ok || memcmp(magic, COOCCUR_MAGIC, sizeof(magic)) != 0
+      || version < 1 || version > COOCCUR_FORMAT_VERSION) {
+    return NULL;
+  }
+  cooccur_io_read_u64(&io, 4);
+  uint64_t n = cooccur_io_read_u64(&io, 8);
+  uint64_t window = cooccur_io_read_u64(&io, 8);
+  uint64_t clock = cooccur_io_read_u64(&io, 8);
+  double rate = cooccur_io_read_f64(&io);
+  // version 1 did not record the number of contexts (see below)
+  double total = version >= 2 ? cooccur_io_read_f64(&io) : 0.0;
+  if (!io.ok || n > SIZE_MAX / sizeof(char *) || window > SIZE_MAX / sizeof(long)) {
+    return NULL;
+  }
+
+  char **keys = calloc(n > 0 ? n : 1, sizeof(char *));
+  if (keys == NULL) {
+    return NULL;
+  }
+  for (size_t i = 0; i < n && io.ok; i++) {
+    uint64_t len = cooccur_io_read_u64(&io, 4);
+    keys[i] = len <= COOCCUR_MAX_KEYWORD_LENGTH ? malloc(len + 1) : NULL;
+    if (keys[i] == NULL) {
+      io.ok = false;
     }
     else {
-      //fprintf(stderr, "%c\n", c);
-      counter++;
-    }
-  } while ((c = getc(stream)) != '\n' && c != EOF);
-  if (counter != 0) {
-    //fprintf(stderr, "last\n");
-    //word[counter] = '\0';
-    if (gmap_contains_key(mat->vectors, word)) {
-      //int *index = gmap_get(mat->indices, word);
-      //if (mat->check[*index] == 0) {
-      if (!gmap_contains_key(check, word)) {
-        context[word_count] = duplicate(word);
-        //fprintf(stderr, "%s\n", context[word_count]);
-        word_count++;
-        //mat->check[*index]++;
-        if (!gmap_put(check, word, NULL)) {
-          free(context);
-          gmap_destroy(check);
-          return NULL;
+      cooccur_io_read(&io, keys[i], len);
+      keys[i][len] = '\0';
+    }
+  }
+
+  cooccurrence_matrix *mat = io.ok ? cooccur_create(keys, n) : NULL;
+  for (size_t i = 0; i < n; i++) {
+    free(keys[i]);
+  }
+  free(keys);
+  if (mat == NULL) {
+    return NULL;
+  }
+
+  mat->clock = clock;
+  mat->rate = rate;
+  for (size_t r = 0; r < n && io.ok; r++) {
+    mat->row_time[r] = cooccur_io_read_u64(&io, 8);
+    uint64_t encoding = cooccur_io_read_u64(&io, 1);
+    if (encoding > COOCCUR_ROW_U64 || mat->row_time[r] > clock
+        || (rate != 0.0 && encoding != COOCCUR_ROW_F64)) {
+      io.ok = false;
+    }
+    else if (encoding == COOCCUR_ROW_F64) {
+      io.ok = cooccur_convert_row(mat, r, COOCCUR_CELLS_F64);
+      for (size_t j = 0; j < n && io.ok; j++) {
+        ((double *)mat->vectors[r])[j] = cooccur_io_read_f64(&io);
+      }
+    }
+    else {
+      unsigned char cells = encoding - COOCCUR_ROW_U16;
+      size_t bytes = cooccur_cell_size(cells);
+      io.ok = cooccur_convert_row(mat, r, cells);
+      for (size_t j = 0; j < n && io.ok; j++) {
+        uint64_t count = cooccur_io_read_u64(&io, bytes);
+        if (cells == COOCCUR_CELLS_U16) {
+          ((uint16_t *)mat->vectors[r])[j] = count;
+        }
+        else if (cells == COOCCUR_CELLS_U32) {
+          ((uint32_t *)mat->vectors[r])[j] = count;
+        }
+        else {
+          ((uint64_t *)mat->vectors[r])[j] = count;
         }
       }
     }
-  } 
-  //memset(mat->check, 0, mat->size*sizeof(mat->check[0]));
-  *n = word_count;
-  gmap_destroy(check);
+  }
 
-  return context;
+  uint64_t sum = io.sum;
+  if (!io.ok || cooccur_io_read_u64(&io, 8) != sum || !io.ok
+      || !cooccur_set_window(mat, window)) {
+    cooccur_destroy(mat);
+    return NULL;
+  }
+
+  // every context that contains a keyword was counted on its diagonal, so
+  // the largest diagonal count stands in for a missing total
+  for (size_t i = 0; i < n && version < 2; i++) {
+    double count = cooccur_cell(mat, i, i) * (rate == 0.0 ? 1.0 : exp(-rate * (clock - mat->row_time[i])));
+    if (count > total) {
+      total = count;
+    }
+  }
+  mat->total = total;
+
+  return mat;
 }
 
-double *cooccur_get_vector(cooccurrence_matrix *mat, const char *word)
+bool cooccur_merge(cooccurrence_matrix *into, const cooccurrence_matrix *from)
 {
-  // divide by diagonal
-  double *get = malloc(sizeof(double) * mat->size);
-  int *diag = gmap_get(mat->indices, word);
-  if (diag == NULL) {
-    for (int i = 0; i < mat->size; i++) {
-      get[i] = 0.0;
+  size_t *map = malloc(sizeof(size_t) * (from->size > 0 ? from->size : 1));
+  double *counts = malloc(sizeof(double) * (from->size > 0 ? from->size : 1));
+  uint64_t *whole = malloc(sizeof(uint64_t) * (from->size > 0 ? from->size : 1));
+  if (map == NULL || counts == NULL || whole == NULL) {
+    free(map);
+    free(counts);
+    free(whole);
+    return false;
+  }
+
+  // keywords may be in a different order in the two matrices, and are
+  // added to a growing matrix; a row that will get fractional counts
+  // must hold doubles
+  bool ok = true;
+  for (size_t i = 0; i < from->size && ok; i++) {
+    const char *word = kwtable_word(from->keywords, i);
+    long index = into->grow ? cooccur_add_keyword(into, word) : cooccur_index(into, word);
+    if (index < 0) {
+      ok = false;
+    }
+    else {
+      map[i] = index;
+      if (from->rate != 0.0 || from->cells[i] == COOCCUR_CELLS_F64) {
+        ok = cooccur_convert_row(into, index, COOCCUR_CELLS_F64);
+      }
     }
   }
-  
-  double *vector = gmap_get(mat->vectors, word);
-  double value = vector[*diag];
-  if (value == 0) {
-    for (int i = 0; i < mat->size; i++) {
-      get[i] = 0.0;
+  if (!ok) {
+    free(map);
+    free(counts);
+    free(whole);
+    return false;
+  }
+
+  for (size_t r = 0; r < from->size; r++) {
+    size_t dest = map[r];
+    if (into->cells[dest] != COOCCUR_CELLS_F64) {
+      // whole counts are added exactly; they are copied first in case
+      // the two matrices are the same
+      for (size_t j = 0; j < from->size; j++) {
+        whole[j] = cooccur_count(from, r, j);
+      }
+      for (size_t j = 0; j < from->size; j++) {
+        cooccur_add_count(into, dest, map[j], whole[j]);
+      }
+    }
+    else {
+      cooccur_get_counts_into(from, r, counts);
+      double w = into->rate == 0.0 ? 1.0 : exp(into->rate * (into->clock - into->row_time[dest]));
+      double *vec = into->vectors[dest];
+      for (size_t j = 0; j < from->size; j++) {
+        vec[map[j]] += counts[j] * w;
+      }
     }
-  } 
-  else {
-    for (int i = 0; i < mat->size; i++) {
-      get[i] = vector[i] / value;
-      //fprintf(stderr, "%d %lf\n",i, get[i]);
-    } 
   }
+  into->total += from->total;
+  into->norms_valid = false;
 
-  
-  return get;
+  free(map);
+  free(counts);
+  free(whole);
+  return true;
 }
 
-void cooccur_destroy(cooccurrence_matrix *mat)
+void cooccur_io_write(cooccur_io *io, const void *p, size_t n)
 {
-  if (mat != NULL) {
-    // for (int i = 0; i < mat->size; i++) {
-    //   // free(gmap_get(mat->indices, mat->keywords[i]));
-    //   // free(gmap_get(mat->vectors, mat->keywords[i]));
-    //   free(mat->keywords[i]);
-    // }
-    // free(mat->keywords);
-    gmap_for_each(mat->indices, free_value, NULL);
-    gmap_for_each(mat->vectors, free_value, NULL);
-    gmap_destroy(mat->indices);
-    gmap_destroy(mat->vectors);
-    //free(mat->check);
-    free(mat);
+  if (io->ok && fwrite(p, 1, n, io->stream) != n) {
+    io->ok = false;
+  }
+  cooccur_io_sum(io, p, n);
+}
+
+void cooccur_io_write_u64(cooccur_io *io, uint64_t v, size_t bytes)
+{
+  unsigned char b[8];
+  for (size_t i = 0; i < bytes; i++) {
+    b[i] = (v >> (8 * i)) & 0xff;
   }
+  cooccur_io_write(io, b, bytes);
+}
+
+void cooccur_io_write_f64(cooccur_io *io, double v)
+{
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  cooccur_io_write_u64(io, bits, 8);
+}
+
+void cooccur_io_read(cooccur_io *io, void *p, size_t n)
+{
+  if (io->ok && fread(p, 1, n, io->stream) != n) {
+    io->ok = false;
+  }
+  if (io->ok) {
+    cooccur_io_sum(io, p, n);
+  }
+}
+
+uint64_t cooccur_io_read_u64(cooccur_io *io, size_t bytes)
+{
+  unsigned char b[8] = {0};
+  cooccur_io_read(io, b, bytes);
+  uint64_t v = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    v |= (uint64_t)b[i] << (8 * i);
+  }
+  return v;
+}
+
+double cooccur_io_read_f64(cooccur_io *io)
+{
+  uint64_t bits = cooccur_io_read_u64(io, 8);
+  double v;
+  memcpy(&v, &bits, sizeof(v));
+  return v;
+}
+
+void cooccur_io_sum(cooccur_io *io, const void *p, size_t n)
+{
+  const unsigned char *b = p;
+  for (size_t i = 0; i < n; i++) {
+    io->sum ^= b[i];
+    io->sum *= 0x100000001b3ULL;
+  }
+}
 
+size_t cooccur_lookup_stats(const cooccurrence_matrix *mat, double *build_seconds)
+{
+  if (build_seconds != NULL) {
+    *build_seconds = kwtable_build_time(mat->keywords);
+  }
+  return kwtable_memory(mat->keywords);
 }
 
-void free_value(const void *key, void *value, void *arg)
+size_t cooccur_count_bytes(const cooccurrence_matrix *mat)
 {
-  free(value);
+  return mat->cell_bytes;
+}
+
+void cooccur_destroy(cooccurrence_matrix *mat)
+{
+  if (mat != NULL) {
+    for (size_t i = 0; i < mat->size; i++) {
+      free(mat->vectors[i]);
+    }
+    free(mat->vectors);
+    free(mat->cells);
+    free(mat->expanded);
+    free(mat->scratch);
+    free(mat->seen);
+    free(mat->word);
+    free(mat->norms);
+    free(mat->ring);
+    free(mat->row_time);
+    free(mat->batch);
+    free(mat->batch_sorted);
+    free(mat->batch_rows);
+    free(mat->batch_count);
+    parallel_pool_destroy(mat->pool);
+    kwtable_destroy(mat->keywords);
+    free(mat);
+  }
 }
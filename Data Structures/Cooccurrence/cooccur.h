@@ -2,27 +2,75 @@
 #define __COOCCUR_H__
 
 #include <stdio.h>
+#include <stdbool.h>
 
 struct cooccurrence_matrix;
 typedef struct cooccurrence_matrix cooccurrence_matrix;
 
+/**
+ * Association metrics that can be computed from a matrix.  With c(i, j)
+ * the count for keywords i and j, c(i) = c(i, i) the number of contexts
+ * containing i and N the number of contexts:
+ *
+ * COOCCUR_PROPORTION is c(i, j) / c(i), as for cooccur_get_vector;
+ * COOCCUR_PMI is log(c(i, j) N / (c(i) c(j))), the pointwise mutual
+ * information, or 0.0 for pairs that never cooccurred;
+ * COOCCUR_PPMI is the PMI or 0.0, whichever is larger; and
+ * COOCCUR_JACCARD is c(i, j) / (c(i) + c(j) - c(i, j)).
+ */
+typedef enum cooccur_metric {COOCCUR_PROPORTION, COOCCUR_PMI, COOCCUR_PPMI, COOCCUR_JACCARD} cooccur_metric;
+
 /**
  * Creates a cooccurrence matrix that counts cooccurrences of the
  * given keywords and is initialized to 0 for all entries.  The caller
  * retains ownership of the array of keywords and is responsible for
- * destroying the matrix.
+ * destroying the matrix.  The keywords are compiled into a static
+ * lookup table so that words read later are matched (or, usually,
+ * rejected) without a general-purpose map lookup.  Counts are stored as
+ * 16-bit integers; a row is widened to 32-bit and then 64-bit integers
+ * when one of its counts would overflow, so counts stay exact, and they
+ * are only converted to doubles when a vector is requested.  (If the
+ * memory for a wider row cannot be allocated the count stops growing.)
  *
  * @param key an array of distinct non-NULL strings, non-NULL
  * @param n the size of that array
- * @return a pointer to a new cooccurrence matrix
- * destroying the matrix
+ * @return a pointer to a new cooccurrence matrix, or NULL if the
+ * keywords are not distinct or there was an allocation error
  */
 cooccurrence_matrix *cooccur_create(char *key[], size_t n);
 
+/**
+ * Adds a keyword to the given matrix, with a row and column of zeros.
+ * Room for rows and columns is doubled when it runs out, so adding costs
+ * amortized O(1) per existing count, and the counts and keyword indices
+ * already there are unchanged.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a string, non-NULL
+ * @return the index of the word, which is cooccur_size(mat) before the
+ * call if it was not already a keyword, or -1 if there was an allocation
+ * error
+ */
+long cooccur_add_keyword(cooccurrence_matrix *mat, const char *word);
+
+/**
+ * Sets whether the given matrix grows.  A growing matrix adds every word
+ * it reads or is given that is not yet a keyword as a new keyword (see
+ * cooccur_add_keyword), so that no context is dropped; this includes
+ * cooccur_update, cooccur_read_context, cooccur_update_line,
+ * cooccur_update_text, cooccur_stream_token, cooccur_read_stream,
+ * cooccur_stream_line and the keywords of a matrix merged into it.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param grow true to add new words as keywords, false to ignore them
+ */
+void cooccur_set_grow(cooccurrence_matrix *mat, bool grow);
+
 /**
  * Updates the given cooccurrence matrix by incrementing the counts
  * for each pair of keywords in the given context.  The caller retains
- * ownership of the context.
+ * ownership of the context.  Unless the matrix grows, a context with a
+ * word that is not a keyword is ignored.
  *
  * @param mat a pointer to a cooccurrence matrix, non-NULL
  * @param context an array of distinct non-NULL strings that are keywords
@@ -48,6 +96,32 @@ void cooccur_update(cooccurrence_matrix *mat, char **context, size_t n);
  */
 char **cooccur_read_context(cooccurrence_matrix *mat, FILE *stream, size_t *n);
 
+/**
+ * Counts the keywords on the given line as one context, as if it had
+ * been read by cooccur_read_context and passed to cooccur_update, but
+ * without copying any words.  Words are separated by spaces.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param line a pointer to the first character of the line, which need
+ * not be NUL-terminated and should not include the newline
+ * @param len the length of the line
+ */
+void cooccur_update_line(cooccurrence_matrix *mat, const char *line, size_t len);
+
+/**
+ * Counts each line of the given text as a context, as cooccur_update_line
+ * would, but in batches: the increments of many contexts are gathered,
+ * sorted by row and then applied a row at a time, so each row is written
+ * in one pass instead of once per context it is in.  The counts are the
+ * same either way.  A last line without a newline is counted too.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param text a pointer to the first character of the text, which need
+ * not be NUL-terminated
+ * @param len the length of the text
+ */
+void cooccur_update_text(cooccurrence_matrix *mat, const char *text, size_t len);
+
 /**
  * Returns the vector (row) for the given word in the given matrix.
  * Values in the returned array correspond to the keywords for the
@@ -67,6 +141,306 @@ char **cooccur_read_context(cooccurrence_matrix *mat, FILE *stream, size_t *n);
  */
 double *cooccur_get_vector(cooccurrence_matrix *mat, const char *word);
 
+/**
+ * Writes the vector (row) for the given word in the given matrix to the
+ * given array.  The values are as for cooccur_get_vector, but no memory
+ * is allocated.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a string, non-NULL
+ * @param out an array that can hold cooccur_size(mat) doubles
+ * @return true if the word is a keyword for the given matrix, false if
+ * it is not (in which case out contains 0.0 in every entry)
+ */
+bool cooccur_get_vector_into(const cooccurrence_matrix *mat, const char *word, double *out);
+
+/**
+ * Writes the vector (row) for the keyword with the given index to the
+ * given array, as for cooccur_get_vector_into.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param index an index less than cooccur_size(mat)
+ * @param out an array that can hold cooccur_size(mat) doubles
+ */
+void cooccur_get_row_into(const cooccurrence_matrix *mat, size_t index, double *out);
+
+/**
+ * Writes the raw counts in the row for the keyword with the given index
+ * to the given array, with any decay applied.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param index an index less than cooccur_size(mat)
+ * @param out an array that can hold cooccur_size(mat) doubles
+ */
+void cooccur_get_counts_into(const cooccurrence_matrix *mat, size_t index, double *out);
+
+/**
+ * Sets the size of the sliding window used by cooccur_stream_token and
+ * cooccur_read_stream.  In streaming mode a keyword token cooccurs with
+ * itself and with each distinct keyword among the window - 1 tokens
+ * (keywords or not) before it, which may be on earlier lines.  Changing
+ * the window forgets the tokens already in it.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param window the number of tokens in the window, or 0 or 1 to count
+ * each keyword token only with itself
+ * @return true if the window was set, false if there was an allocation error
+ */
+bool cooccur_set_window(cooccurrence_matrix *mat, size_t window);
+
+/**
+ * Makes the counts in the given matrix decay exponentially.  Time is
+ * measured in tokens for cooccur_stream_token and cooccur_read_stream
+ * and in contexts for cooccur_update.  Decay is applied lazily: each
+ * row keeps its own scale factor and is only rescaled when a count in it
+ * is incremented after its scale has grown too large, so the cost does
+ * not depend on the size of the matrix.  Queries may be made at any time
+ * and see the decayed counts; the proportions returned by
+ * cooccur_get_vector are ratios of decayed counts.  Decayed counts are
+ * not whole numbers, so every row is converted to doubles when decay is
+ * turned on.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param half_life the number of time steps it takes a count to halve,
+ * or 0 to stop decaying
+ * @return true if the decay was set, false if there was an allocation
+ * error (in which case the counts do not decay)
+ */
+bool cooccur_set_decay(cooccurrence_matrix *mat, double half_life);
+
+/**
+ * Adds the given token to the end of the stream of tokens counted by the
+ * given matrix in streaming mode (see cooccur_set_window).  Tokens that
+ * are not keywords still take up a place in the window.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a pointer to the first character of the token
+ * @param len the length of the token
+ */
+void cooccur_stream_token(cooccurrence_matrix *mat, const char *word, size_t len);
+
+/**
+ * Reads the current line of the given stream and adds its words to the
+ * stream of tokens counted by the given matrix in streaming mode.  The
+ * newline is read and removed from the stream.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param stream a stream, non-NULL
+ * @return false if the stream was already at EOF, true otherwise
+ */
+bool cooccur_read_stream(cooccurrence_matrix *mat, FILE *stream);
+
+/**
+ * Adds the words on the given line to the stream of tokens counted by
+ * the given matrix in streaming mode, as cooccur_read_stream does.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param line a pointer to the first character of the line, which need
+ * not be NUL-terminated and should not include the newline
+ * @param len the length of the line
+ */
+void cooccur_stream_line(cooccurrence_matrix *mat, const char *line, size_t len);
+
+/**
+ * Returns the number of contexts counted by the given matrix: calls to
+ * cooccur_update, or tokens in streaming mode, decayed like the counts.
+ * Together with the diagonal counts it is kept up to date as the counts
+ * are, so association metrics need no extra pass over the corpus.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @return the number of contexts
+ */
+double cooccur_contexts(const cooccurrence_matrix *mat);
+
+/**
+ * Sets the number of threads used by queries over many rows, such as
+ * cooccur_get_metric_rows.  The default is 1.  The threads are started
+ * here and kept until the matrix is destroyed or this is called again.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param threads the number of threads, or 0 for one per processor
+ */
+void cooccur_set_threads(cooccurrence_matrix *mat, size_t threads);
+
+/**
+ * Returns the number of threads used by queries over many rows.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @return the number of threads, at least 1
+ */
+size_t cooccur_threads(const cooccurrence_matrix *mat);
+
+/**
+ * Splits [0, n) into blocks and calls body(begin, end, arg) for each on
+ * the matrix's threads, as parallel_for does, so that work a caller does
+ * on query results, such as formatting rows, can use the same threads.
+ * Must not be called from inside another such loop or query.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param n the number of items
+ * @param body a pointer to the function that does the items in
+ * [begin, end), which must be safe to call concurrently on disjoint blocks
+ * @param arg an argument passed to every call to body
+ */
+void cooccur_parallel(const cooccurrence_matrix *mat, size_t n, void (*body)(size_t begin, size_t end, void *arg), void *arg);
+
+/**
+ * Writes the given association metric between the given word and every
+ * keyword to the given array.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a string, non-NULL
+ * @param metric the metric to compute
+ * @param out an array that can hold cooccur_size(mat) doubles
+ * @return true if the word is a keyword for the given matrix and the
+ * values were computed, false if it is not a keyword (in which case out
+ * contains 0.0 in every entry) or there was an allocation error
+ */
+bool cooccur_get_metric_into(const cooccurrence_matrix *mat, const char *word, cooccur_metric metric, double *out);
+
+/**
+ * Writes the given association metric for a range of rows to the given
+ * array, row after row, computing the rows in parallel (see
+ * cooccur_set_threads).
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param metric the metric to compute
+ * @param first the index of the first row
+ * @param count the number of rows, with first + count at most
+ * cooccur_size(mat)
+ * @param out an array that can hold count * cooccur_size(mat) doubles
+ * @return true if the values were computed, false if there was an
+ * allocation error
+ */
+bool cooccur_get_metric_rows(const cooccurrence_matrix *mat, cooccur_metric metric, size_t first, size_t count, double *out);
+
+/**
+ * Returns the number of keywords for the given matrix.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @return the number of keywords
+ */
+size_t cooccur_size(const cooccurrence_matrix *mat);
+
+/**
+ * Returns the keyword with the given index in the given matrix.  The
+ * matrix retains ownership of the string.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param index an index less than cooccur_size(mat)
+ * @return the keyword
+ */
+const char *cooccur_keyword(const cooccurrence_matrix *mat, size_t index);
+
+/**
+ * Returns the index of the given word in the given matrix.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a string, non-NULL
+ * @return the index of the word, or -1 if it is not a keyword
+ */
+long cooccur_index(const cooccurrence_matrix *mat, const char *word);
+
+/**
+ * Returns the cosine similarity of the rows of the two given words.
+ * Norms of the rows are cached until the next update, so repeated
+ * queries against an unchanged matrix cost one dot product each.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word1 a string, non-NULL
+ * @param word2 a string, non-NULL
+ * @return the cosine similarity, or 0.0 if either word is not a keyword
+ * or has never appeared in a context
+ */
+double cooccur_similarity(cooccurrence_matrix *mat, const char *word1, const char *word2);
+
+/**
+ * Writes the cosine similarity of the row of the given word with every
+ * row of the given matrix to the given array.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a string, non-NULL
+ * @param out an array that can hold cooccur_size(mat) doubles
+ * @return true if the word is a keyword for the given matrix, false if
+ * it is not (in which case out contains 0.0 in every entry)
+ */
+bool cooccur_similarities(cooccurrence_matrix *mat, const char *word, double *out);
+
+/**
+ * Finds the keywords whose rows are most similar (by cosine similarity)
+ * to the row of the given word, excluding the word itself.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param word a string, non-NULL
+ * @param k the number of keywords to find
+ * @param indices an array that can hold k indices, where the indices of
+ * the nearest keywords will be written, most similar first
+ * @param similarities an array that can hold k doubles, where their
+ * similarities will be written, or NULL
+ * @return the number of keywords found, which is 0 if the word is not a
+ * keyword and otherwise the smaller of k and cooccur_size(mat) - 1
+ */
+size_t cooccur_nearest(cooccurrence_matrix *mat, const char *word, size_t k, size_t *indices, double *similarities);
+
+/**
+ * Writes the given matrix to the given stream as a binary checkpoint:
+ * a header (format version, window size, clock, decay rate and number
+ * of contexts), the keywords, and the raw counts of each row, followed
+ * by a checksum.  The tokens in the current window are not saved.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param stream a stream opened for binary writing, non-NULL
+ * @return true if the checkpoint was written, false if there was a
+ * write error
+ */
+bool cooccur_save(const cooccurrence_matrix *mat, FILE *stream);
+
+/**
+ * Reads a matrix written by cooccur_save from the given stream.  The
+ * caller is responsible for destroying the matrix.  Checkpoints from
+ * before the number of contexts was saved are accepted, with that number
+ * taken to be the largest diagonal count.
+ *
+ * @param stream a stream opened for binary reading, non-NULL
+ * @return a pointer to the matrix, or NULL if the stream does not hold
+ * a complete, valid checkpoint or there was an allocation error
+ */
+cooccurrence_matrix *cooccur_load(FILE *stream);
+
+/**
+ * Adds the counts in one matrix to the counts in another, matching rows
+ * and columns by keyword, so that matrices built from separate shards of
+ * a corpus can be combined.  Decayed counts are added at their current
+ * values.  The keywords may be in different orders in the two matrices.
+ *
+ * @param into a pointer to the matrix to add to, non-NULL
+ * @param from a pointer to the matrix to add, non-NULL
+ * @return true if the counts were added, false if some keyword of from
+ * is not a keyword of into (and into does not grow) or there was an
+ * allocation error (in which case the counts in into are unchanged)
+ */
+bool cooccur_merge(cooccurrence_matrix *into, const cooccurrence_matrix *from);
+
+/**
+ * Reports the cost of the keyword lookup table compiled when the given
+ * matrix was created.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @param build_seconds a pointer to where the time taken to build the
+ * table will be written, or NULL
+ * @return the number of bytes used by the table
+ */
+size_t cooccur_lookup_stats(const cooccurrence_matrix *mat, double *build_seconds);
+
+/**
+ * Returns the number of bytes used to store the counts in the given
+ * matrix, which grows as rows are widened.
+ *
+ * @param mat a pointer to a cooccurrence matrix, non-NULL
+ * @return the size of the rows in bytes
+ */
+size_t cooccur_count_bytes(const cooccurrence_matrix *mat);
+
 /**
  * Destroys the given matrix.
  * 
@@ -0,0 +1,603 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "cooccur.h"
+#include "gmap.h"
+#include "string_key.h"
+#ifndef BENCH_CORE_ONLY
+#include "approx.h"
+#include "inbuf.h"
+#endif
+
+/**
+ * Benchmarks the phases of building a cooccurrence matrix: create,
+ * read_context, update and get_vector.  Only the functions in cooccur.h
+ * that every version of the matrix has are used for those, so the same
+ * driver measures whichever implementation it is linked with.  The corpus
+ * is then counted again by parsing it in place with inbuf, a context at a
+ * time with cooccur_update_line and in batches with cooccur_update_text,
+ * for comparison with read_context and update.  Compiled with
+ * -DBENCH_CORE_ONLY the driver leaves out those passes and -approx, and
+ * needs nothing from the matrix but create, read_context, update,
+ * get_vector and destroy.
+ *
+ * USAGE: CooccurBench [-vocab V] [-keywords F] [-contexts N] [-length L]
+ *                     [-zipf S] [-seed X] [-corpus FILE] [-approx BYTES[K|M|G]]
+ *
+ * By default the corpus is N lines of L words drawn from a vocabulary of
+ * V words with Zipf exponent S; a fraction F of the words, spread evenly
+ * over the frequency ranks, are keywords.  With -corpus the lines of the
+ * given file are used instead and the keywords are the fraction F of its
+ * distinct words that are most frequent.
+ *
+ * With -approx the corpus is also counted by an approximate counter with
+ * a sketch of the given size, and its estimates of the counts between
+ * keywords are checked against the exact counts.  Keep the corpus small
+ * enough for the exact matrix when using it.
+ */
+
+// candidates kept per keyword by the approximate counter
+#define BENCH_APPROX_HEAVY 32
+
+// contexts are read and then counted in batches of this many, so the
+// phases are timed separately without holding the whole corpus
+#define BENCH_BATCH 4096
+
+typedef struct word_count
+{
+    const char *word;
+    size_t count;
+} word_count;
+
+/**
+ * Returns the next value of the given splitmix64 generator, so that the
+ * generated corpus is the same on every platform.
+ */
+uint64_t next_random(uint64_t *state);
+
+/**
+ * Writes a Zipf-distributed corpus to the given stream and chooses the
+ * keywords.
+ *
+ * @return the array of keywords, or NULL if there was an allocation error
+ */
+char **generate_corpus(FILE *out, size_t vocab, double fraction, size_t contexts, size_t length,
+                       double exponent, uint64_t seed, size_t *keyword_count, size_t *tokens);
+
+/**
+ * Copies the given file to the given stream and chooses its most
+ * frequent words as keywords.
+ *
+ * @return the array of keywords, or NULL if the file could not be read
+ * or there was an allocation error
+ */
+char **scan_corpus(const char *path, FILE *out, double fraction, size_t *keyword_count,
+                   size_t *tokens, size_t *contexts, size_t *distinct);
+
+void add_word_count(const void *key, void *value, void *arg);
+int compare_word_counts(const void *p1, const void *p2);
+void free_count(const void *key, void *value, void *arg);
+
+double now();
+long peak_rss_kb();
+
+#ifndef BENCH_CORE_ONLY
+/**
+ * Counts the corpus in the given stream into the given matrix, parsing
+ * it in place with inbuf, either a line at a time or in batches.
+ *
+ * @return the time taken in seconds, or -1 if there was an allocation
+ * error
+ */
+double count_in_place(FILE *text, cooccurrence_matrix *matrix, bool batched, bool *mapped);
+
+/**
+ * Determines whether the given matrices, which have the same keywords,
+ * have the same counts.
+ */
+bool same_counts(const cooccurrence_matrix *m1, const cooccurrence_matrix *m2);
+
+/**
+ * Counts the corpus in the given stream approximately and compares the
+ * estimates for every pair of keywords to the counts in the given matrix.
+ *
+ * @return false if there was an allocation error
+ */
+bool validate_approx(FILE *text, cooccurrence_matrix *matrix, char **keys, size_t count, size_t bytes);
+#endif
+
+int main(int argc, char **argv)
+{
+    size_t vocab = 50000;
+    double fraction = 0.02;
+    size_t contexts = 200000;
+    size_t length = 20;
+    double exponent = 1.0;
+    uint64_t seed = 1;
+    const char *corpus = NULL;
+#ifndef BENCH_CORE_ONLY
+    size_t approx = 0;
+#endif
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-vocab") == 0 && a + 1 < argc && atol(argv[a + 1]) > 0) {
+            vocab = atol(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-keywords") == 0 && a + 1 < argc && atof(argv[a + 1]) > 0 && atof(argv[a + 1]) <= 1) {
+            fraction = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-contexts") == 0 && a + 1 < argc && atol(argv[a + 1]) > 0) {
+            contexts = atol(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-length") == 0 && a + 1 < argc && atol(argv[a + 1]) > 0) {
+            length = atol(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-zipf") == 0 && a + 1 < argc && atof(argv[a + 1]) >= 0) {
+            exponent = atof(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-seed") == 0 && a + 1 < argc) {
+            seed = strtoull(argv[++a], NULL, 10);
+        }
+        else if (strcmp(argv[a], "-corpus") == 0 && a + 1 < argc) {
+            corpus = argv[++a];
+        }
+#ifndef BENCH_CORE_ONLY
+        else if (strcmp(argv[a], "-approx") == 0 && a + 1 < argc && approx_parse_bytes(argv[a + 1], &approx)) {
+            a++;
+        }
+#endif
+        else {
+            fprintf(stderr, "USAGE: %s [-vocab V] [-keywords F] [-contexts N] [-length L] [-zipf S] [-seed X] [-corpus FILE] [-approx BYTES[K|M|G]]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *text = tmpfile();
+    if (text == NULL) {
+        fprintf(stderr, "Could not create temporary file\n");
+        return 1;
+    }
+    size_t count;
+    size_t tokens;
+    char **keys;
+    if (corpus == NULL) {
+        keys = generate_corpus(text, vocab, fraction, contexts, length, exponent, seed, &count, &tokens);
+    }
+    else {
+        keys = scan_corpus(corpus, text, fraction, &count, &tokens, &contexts, &vocab);
+    }
+    if (keys == NULL) {
+        fclose(text);
+        return 1;
+    }
+    printf("corpus: %zu contexts, %zu tokens, %zu words, %zu keywords\n", contexts, tokens, vocab, count);
+
+    // create
+    double start = now();
+    cooccurrence_matrix *matrix = cooccur_create(keys, count);
+    double create_time = now() - start;
+    if (matrix == NULL) {
+        fprintf(stderr, "Matrix create Error\n");
+        fclose(text);
+        return 1;
+    }
+
+    // read_context and update, alternating a batch at a time
+    char **read[BENCH_BATCH];
+    size_t sizes[BENCH_BATCH];
+    size_t lines = 0;
+    size_t pairs = 0;
+    double read_time = 0.0;
+    double update_time = 0.0;
+    rewind(text);
+    bool more = true;
+    while (more) {
+        size_t batch = 0;
+        start = now();
+        while (batch < BENCH_BATCH && (read[batch] = cooccur_read_context(matrix, text, &sizes[batch])) != NULL) {
+            batch++;
+        }
+        more = batch == BENCH_BATCH;
+        read_time += now() - start;
+
+        start = now();
+        for (size_t i = 0; i < batch; i++) {
+            cooccur_update(matrix, read[i], sizes[i]);
+        }
+        update_time += now() - start;
+
+        for (size_t i = 0; i < batch; i++) {
+            pairs += sizes[i] * sizes[i];
+            for (size_t j = 0; j < sizes[i]; j++) {
+                free(read[i][j]);
+            }
+            free(read[i]);
+        }
+        lines += batch;
+    }
+
+    // get_vector; the checksum makes sure the results are used and lets
+    // runs of different implementations be compared
+    double checksum = 0.0;
+    start = now();
+    for (size_t i = 0; i < count; i++) {
+        double *row = cooccur_get_vector(matrix, keys[i]);
+        if (row == NULL) {
+            fprintf(stderr, "Allocation error\n");
+            return 1;
+        }
+        for (size_t j = 0; j < count; j++) {
+            checksum += row[j];
+        }
+        free(row);
+    }
+    double get_time = now() - start;
+
+    printf("create       %10.6f s %14.0f keywords/s\n", create_time, count / create_time);
+    printf("read_context %10.6f s %14.0f tokens/s %14.0f contexts/s\n", read_time, tokens / read_time, lines / read_time);
+    printf("update       %10.6f s %14.0f contexts/s %14.0f pairs/s\n", update_time, lines / update_time, pairs / update_time);
+    printf("get_vector   %10.6f s %14.0f rows/s\n", get_time, count / get_time);
+
+#ifndef BENCH_CORE_ONLY
+    // the same corpus parsed in place, as Cooccur reads its input, a
+    // context at a time and then in batches
+    cooccurrence_matrix *lined = cooccur_create(keys, count);
+    cooccurrence_matrix *batched = cooccur_create(keys, count);
+    bool mapped;
+    double line_time = count_in_place(text, lined, false, &mapped);
+    double text_time = count_in_place(text, batched, true, &mapped);
+    if (line_time < 0.0 || text_time < 0.0) {
+        fprintf(stderr, "Allocation error\n");
+        return 1;
+    }
+    bool line_same = same_counts(matrix, lined);
+    bool text_same = same_counts(matrix, batched);
+    cooccur_destroy(lined);
+    cooccur_destroy(batched);
+
+    printf("update_line  %10.6f s %14.0f tokens/s %14.0f contexts/s, %s, %.2fx read_context + update, counts %s\n",
+           line_time, tokens / line_time, lines / line_time, mapped ? "mapped" : "buffered",
+           (read_time + update_time) / line_time, line_same ? "match" : "DIFFER");
+    printf("update_text  %10.6f s %14.0f tokens/s %14.0f contexts/s, %.2fx update_line, counts %s\n",
+           text_time, tokens / text_time, lines / text_time, line_time / text_time, text_same ? "match" : "DIFFER");
+#endif
+    printf("checksum: %.6f\n", checksum);
+#ifndef BENCH_CORE_ONLY
+    if (approx > 0 && !validate_approx(text, matrix, keys, count, approx)) {
+        fprintf(stderr, "Allocation error\n");
+        return 1;
+    }
+#endif
+    fclose(text);
+    printf("peak RSS: %ld KB\n", peak_rss_kb());
+
+    for (size_t i = 0; i < count; i++) {
+        free(keys[i]);
+    }
+    free(keys);
+    cooccur_destroy(matrix);
+
+    return 0;
+}
+
+#ifndef BENCH_CORE_ONLY
+double count_in_place(FILE *text, cooccurrence_matrix *matrix, bool batched, bool *mapped)
+{
+    rewind(text);
+    double start = now();
+    inbuf *in = matrix != NULL ? inbuf_open(text) : NULL;
+    if (in == NULL) {
+        return -1.0;
+    }
+    const char *data;
+    size_t len;
+    while (batched && (data = inbuf_lines(in, &len)) != NULL) {
+        cooccur_update_text(matrix, data, len);
+    }
+    while (!batched && (data = inbuf_line(in, &len)) != NULL) {
+        cooccur_update_line(matrix, data, len);
+    }
+    double elapsed = now() - start;
+    *mapped = inbuf_mapped(in);
+    inbuf_close(in);
+    return elapsed;
+}
+
+bool same_counts(const cooccurrence_matrix *m1, const cooccurrence_matrix *m2)
+{
+    size_t count = cooccur_size(m1);
+    double *row1 = malloc(sizeof(double) * (count > 0 ? count : 1));
+    double *row2 = malloc(sizeof(double) * (count > 0 ? count : 1));
+    bool same = row1 != NULL && row2 != NULL && cooccur_contexts(m1) == cooccur_contexts(m2);
+    for (size_t i = 0; i < count && same; i++) {
+        cooccur_get_counts_into(m1, i, row1);
+        cooccur_get_counts_into(m2, i, row2);
+        same = memcmp(row1, row2, sizeof(double) * count) == 0;
+    }
+    free(row1);
+    free(row2);
+    return same;
+}
+
+bool validate_approx(FILE *text, cooccurrence_matrix *matrix, char **keys, size_t count, size_t bytes)
+{
+    approx_counter *counter = approx_create(keys, count, bytes, BENCH_APPROX_HEAVY);
+    double *row = malloc(sizeof(double) * (count > 0 ? count : 1));
+    if (counter == NULL || row == NULL) {
+        approx_destroy(counter);
+        free(row);
+        return false;
+    }
+
+    rewind(text);
+    double start = now();
+    size_t lines = 0;
+    while (approx_read_context(counter, text)) {
+        lines++;
+    }
+    double approx_time = now() - start;
+
+    // estimates must never be too low, and should be within the bound
+    // about as often as its confidence says
+    double bound = approx_error(counter);
+    uint64_t max_error = 0;
+    double total_error = 0.0;
+    size_t over = 0;
+    size_t under = 0;
+    for (size_t i = 0; i < count; i++) {
+        cooccur_get_counts_into(matrix, i, row);
+        for (size_t j = 0; j < count; j++) {
+            uint64_t estimate = approx_estimate(counter, keys[i], keys[j]);
+            if (estimate < row[j]) {
+                under++;
+                continue;
+            }
+            uint64_t error = estimate - (uint64_t)row[j];
+            total_error += error;
+            if (error > max_error) {
+                max_error = error;
+            }
+            if (error > bound) {
+                over++;
+            }
+        }
+    }
+
+    size_t width;
+    size_t depth;
+    size_t memory = approx_memory(counter, &width, &depth);
+    size_t pairs = count * count;
+    printf("approx       %10.6f s %14.0f contexts/s\n", approx_time, lines / approx_time);
+    printf("approx sketch: %zu x %zu, %zu bytes with candidates\n", depth, width, memory);
+    printf("approx error: max %llu, mean %.3f, bound %.0f at %.4f; %zu of %zu pairs over the bound, %zu too low\n",
+           (unsigned long long)max_error, pairs > 0 ? total_error / pairs : 0.0, bound, approx_confidence(counter), over, pairs, under);
+
+    approx_destroy(counter);
+    free(row);
+    return true;
+}
+#endif
+
+uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+char **generate_corpus(FILE *out, size_t vocab, double fraction, size_t contexts, size_t length,
+                       double exponent, uint64_t seed, size_t *keyword_count, size_t *tokens)
+{
+    // cumulative distribution over the frequency ranks
+    double *cdf = malloc(sizeof(double) * vocab);
+    char **keys = malloc(sizeof(char *) * vocab);
+    if (cdf == NULL || keys == NULL) {
+        free(cdf);
+        free(keys);
+        fprintf(stderr, "Allocation error\n");
+        return NULL;
+    }
+    double total = 0.0;
+    for (size_t r = 0; r < vocab; r++) {
+        total += pow(r + 1, -exponent);
+        cdf[r] = total;
+    }
+
+    // rank r is a keyword when the running count of keywords goes up there,
+    // which spreads the keywords over frequent and rare words alike
+    size_t count = 0;
+    for (size_t r = 0; r < vocab; r++) {
+        if ((size_t)((r + 1) * fraction) > (size_t)(r * fraction)) {
+            keys[count] = malloc(24);
+            if (keys[count] == NULL) {
+                for (size_t i = 0; i < count; i++) {
+                    free(keys[i]);
+                }
+                free(keys);
+                free(cdf);
+                fprintf(stderr, "Allocation error\n");
+                return NULL;
+            }
+            sprintf(keys[count++], "w%zu", r);
+        }
+    }
+
+    uint64_t state = seed;
+    for (size_t c = 0; c < contexts; c++) {
+        for (size_t t = 0; t < length; t++) {
+            double u = (next_random(&state) >> 11) * (total / 9007199254740992.0);
+            size_t lo = 0;
+            size_t hi = vocab - 1;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (cdf[mid] <= u) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            fprintf(out, t + 1 < length ? "w%zu " : "w%zu\n", lo);
+        }
+    }
+    free(cdf);
+
+    *keyword_count = count;
+    *tokens = contexts * length;
+    return keys;
+}
+
+char **scan_corpus(const char *path, FILE *out, double fraction, size_t *keyword_count,
+                   size_t *tokens, size_t *contexts, size_t *distinct)
+{
+    FILE *in = fopen(path, "r");
+    gmap *counts = gmap_create(duplicate, compare_keys, hash29, free);
+    size_t cap = 64;
+    char *word = malloc(cap);
+    if (in == NULL || counts == NULL || word == NULL) {
+        fprintf(stderr, "Could not read %s\n", path);
+        if (in != NULL) {
+            fclose(in);
+        }
+        if (counts != NULL) {
+            gmap_destroy(counts);
+        }
+        free(word);
+        return NULL;
+    }
+
+    // copy the file and count its words, which are separated by spaces
+    // as for cooccur_read_context
+    bool ok = true;
+    size_t len = 0;
+    *tokens = 0;
+    *contexts = 0;
+    int last = '\n';
+    int c;
+    do {
+        c = getc(in);
+        if (c != EOF) {
+            putc(c, out);
+        }
+        if (c == ' ' || c == '\n' || c == EOF) {
+            if (len > 0) {
+                word[len] = '\0';
+                size_t *n = gmap_get(counts, word);
+                if (n == NULL) {
+                    n = malloc(sizeof(size_t));
+                    if (n == NULL || !gmap_put(counts, word, n)) {
+                        free(n);
+                        ok = false;
+                        break;
+                    }
+                    *n = 0;
+                }
+                (*n)++;
+                (*tokens)++;
+                len = 0;
+            }
+            if (c == '\n' || (c == EOF && last != '\n')) {
+                (*contexts)++;
+            }
+        }
+        else {
+            if (len + 1 == cap) {
+                char *bigger = realloc(word, cap * 2);
+                if (bigger == NULL) {
+                    ok = false;
+                    break;
+                }
+                word = bigger;
+                cap *= 2;
+            }
+            word[len++] = c;
+        }
+        last = c;
+    } while (c != EOF);
+    fclose(in);
+    free(word);
+
+    // the most frequent words, ties broken alphabetically
+    *distinct = gmap_size(counts);
+    word_count *all = malloc(sizeof(word_count) * (*distinct > 0 ? *distinct : 1));
+    char **keys = malloc(sizeof(char *) * (*distinct > 0 ? *distinct : 1));
+    size_t count = 0;
+    if (ok && all != NULL && keys != NULL) {
+        word_count *next = all;
+        gmap_for_each(counts, add_word_count, &next);
+        qsort(all, *distinct, sizeof(word_count), compare_word_counts);
+        size_t wanted = ceil(*distinct * fraction);
+        for (count = 0; count < wanted; count++) {
+            keys[count] = duplicate(all[count].word);
+            if (keys[count] == NULL) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    else {
+        ok = false;
+    }
+    free(all);
+    gmap_for_each(counts, free_count, NULL);
+    gmap_destroy(counts);
+
+    if (!ok) {
+        fprintf(stderr, "Allocation error\n");
+        for (size_t i = 0; i < count; i++) {
+            free(keys[i]);
+        }
+        free(keys);
+        return NULL;
+    }
+    *keyword_count = count;
+    return keys;
+}
+
+void add_word_count(const void *key, void *value, void *arg)
+{
+    word_count **next = arg;
+    (*next)->word = key;
+    (*next)->count = *(size_t *)value;
+    (*next)++;
+}
+
+int compare_word_counts(const void *p1, const void *p2)
+{
+    const word_count *a = p1;
+    const word_count *b = p2;
+    if (a->count != b->count) {
+        return a->count > b->count ? -1 : 1;
+    }
+    return strcmp(a->word, b->word);
+}
+
+void free_count(const void *key, void *value, void *arg)
+{
+    free(value);
+}
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_rss_kb()
+{
+    // ru_maxrss is in kilobytes on Linux
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
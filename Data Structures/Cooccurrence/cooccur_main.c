@@ -1,44 +1,615 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
 
+#include "approx.h"
 #include "cooccur.h"
+#include "inbuf.h"
+#include "outbuf.h"
+#include "vecops.h"
+
+// output formats
+enum {FORMAT_TEXT, FORMAT_SPARSE, FORMAT_BINARY};
+
+// binary output starts with the magic bytes and the format version
+#define BINARY_MAGIC "COOCVEC"
+#define BINARY_VERSION 1
+
+// the number of values computed at a time for printing
+#define PRINT_BLOCK_CELLS (1 << 16)
+
+// in approximate mode, the number of top words printed for each keyword
+// unless -top is given, and how many candidates are kept per word printed
+#define APPROX_DEFAULT_TOP 10
+#define APPROX_CANDIDATES_PER_TOP 4
+
+/**
+ * Prints the results for each keyword: its vector of the given metric,
+ * the top keywords in that vector if top is positive, or the nearest
+ * keywords to it if nearest is positive.
+ *
+ * In text format each keyword's results are on one line: the whole
+ * vector, or the keywords and values of the top or nearest keywords.  In
+ * sparse format only the keywords and values of the nonzero entries of
+ * each vector are printed.  Binary format is little-endian: the 8 magic
+ * bytes, a 4-byte version, a 4-byte kind (0 for whole vectors, 1 for
+ * lists), the 8-byte number of keywords and the keywords (each a 4-byte
+ * length and the characters); then for each keyword either its vector as
+ * doubles or a 4-byte list length followed by a 4-byte keyword index and
+ * a double for each keyword in the list.
+ *
+ * @return false if there was an allocation error
+ */
+bool print_results(cooccurrence_matrix *matrix, size_t nearest, size_t top, int format, cooccur_metric metric, outbuf *out);
+
+/**
+ * Reads the name of an association metric.
+ *
+ * @return false if the name is not that of a metric
+ */
+bool parse_metric(const char *name, cooccur_metric *metric);
+
+/**
+ * Prints the keywords and values in the given list for the given
+ * keyword, in text format after the keyword's name, or in binary format.
+ */
+void print_list(const cooccurrence_matrix *matrix, size_t row, const size_t *list, const double *values, size_t n, int format, outbuf *out);
+
+// a block of rows to print, split into parts that are formatted in
+// parallel, each with its own top-k arrays and buffer
+typedef struct print_job
+{
+    const cooccurrence_matrix *matrix;
+    size_t top;
+    int format;
+    size_t first;    // the index of the first row of the block
+    size_t count;    // the number of rows in the block
+    double *rows;    // the values of the rows, row after row
+    size_t *lists;   // top keywords, top per part
+    double *values;  // and their values
+    outbuf **outs;   // where each part is formatted
+    size_t parts;
+} print_job;
+
+/**
+ * Formats the rows of the given parts of a print_job, each into the
+ * part's buffer.
+ */
+void print_part(size_t begin, size_t end, void *arg);
+
+/**
+ * Counts the contexts on standard input approximately, in a sketch of
+ * the given size, and prints the top words for each keyword with their
+ * estimated counts followed by the error bound of the estimates.
+ *
+ * @return the exit status
+ */
+int run_approx(char **keys, size_t count, size_t bytes, size_t top, size_t every, bool stats);
+
+/**
+ * Prints the top words for each keyword counted by the given counter and
+ * their estimated counts, one keyword per line.
+ *
+ * @return false if there was an allocation error
+ */
+bool print_approx(const approx_counter *approx, size_t top, outbuf *out);
+
+/**
+ * Loads the checkpoint in the given file.
+ *
+ * @return a pointer to the matrix, or NULL if it could not be loaded
+ */
+cooccurrence_matrix *load_file(const char *path);
+
+/**
+ * Writes a checkpoint of the given matrix to the given file.  The
+ * checkpoint is written to a temporary file that then replaces the
+ * given one, so a crash while saving leaves the previous checkpoint.
+ *
+ * @return false if the checkpoint could not be written
+ */
+bool save_file(const cooccurrence_matrix *matrix, const char *path);
 
 int main(int argc, char **argv)
 {
-    if (argc < 2) {
+    // options come before the keywords; "--" ends them so that
+    // keywords may start with '-'
+    bool stats = false;
+    size_t nearest = 0;
+    size_t window = 0;
+    double half_life = 0.0;
+    size_t every = 0;
+    size_t top = 0;
+    int format = FORMAT_TEXT;
+    cooccur_metric metric = COOCCUR_PROPORTION;
+    size_t threads = 1;
+    bool grow = false;
+    size_t approx = 0;
+    char *save = NULL;
+    char **loads = malloc(sizeof(char *) * argc);
+    int load_count = 0;
+    if (loads == NULL) {
+        fprintf(stderr, "Allocation error\n");
+        return 1;
+    }
+    int first = 1;
+    while (first < argc && argv[first][0] == '-') {
+        if (strcmp(argv[first], "--") == 0) {
+            first++;
+            break;
+        }
+        else if (strcmp(argv[first], "-stats") == 0) {
+            stats = true;
+        }
+        else if (strcmp(argv[first], "-grow") == 0) {
+            grow = true;
+        }
+        else if (strcmp(argv[first], "-nearest") == 0 && first + 1 < argc && atoi(argv[first + 1]) > 0) {
+            nearest = atoi(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-window") == 0 && first + 1 < argc && atoi(argv[first + 1]) > 0) {
+            window = atoi(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-halflife") == 0 && first + 1 < argc && atof(argv[first + 1]) > 0) {
+            half_life = atof(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-every") == 0 && first + 1 < argc && atoi(argv[first + 1]) > 0) {
+            every = atoi(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-top") == 0 && first + 1 < argc && atoi(argv[first + 1]) > 0) {
+            top = atoi(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-format") == 0 && first + 1 < argc && strcmp(argv[first + 1], "text") == 0) {
+            format = FORMAT_TEXT;
+            first++;
+        }
+        else if (strcmp(argv[first], "-format") == 0 && first + 1 < argc && strcmp(argv[first + 1], "sparse") == 0) {
+            format = FORMAT_SPARSE;
+            first++;
+        }
+        else if (strcmp(argv[first], "-format") == 0 && first + 1 < argc && strcmp(argv[first + 1], "binary") == 0) {
+            format = FORMAT_BINARY;
+            first++;
+        }
+        else if (strcmp(argv[first], "-metric") == 0 && first + 1 < argc && parse_metric(argv[first + 1], &metric)) {
+            first++;
+        }
+        else if (strcmp(argv[first], "-threads") == 0 && first + 1 < argc && atoi(argv[first + 1]) >= 0) {
+            threads = atoi(argv[++first]);
+        }
+        else if (strcmp(argv[first], "-approx") == 0 && first + 1 < argc && approx_parse_bytes(argv[first + 1], &approx)) {
+            first++;
+        }
+        else if (strcmp(argv[first], "-save") == 0 && first + 1 < argc) {
+            save = argv[++first];
+        }
+        else if (strcmp(argv[first], "-load") == 0 && first + 1 < argc) {
+            loads[load_count++] = argv[++first];
+        }
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[first]);
+            free(loads);
+            return 1;
+        }
+        first++;
+    }
+
+    if (first >= argc && load_count == 0 && !grow) {
         fprintf(stderr, "Usage error");
+        free(loads);
         return 1;
     }
-    
-    cooccurrence_matrix *matrix = cooccur_create(argv + 1, argc - 1);
+    char **keys = argv + first;
+    int count = argc - first;
+
+    // approximate mode counts every word with the keywords, and only
+    // supports the options that make sense for top lists of counts
+    if (approx > 0) {
+        free(loads);
+        if (count == 0 || grow || nearest > 0 || window > 0 || half_life > 0.0 || save != NULL || load_count > 0
+            || format == FORMAT_BINARY || metric != COOCCUR_PROPORTION) {
+            fprintf(stderr, "Usage error: -approx takes keywords and only -stats, -top, -every and -format text or sparse\n");
+            return 1;
+        }
+        return run_approx(keys, count, approx, top > 0 ? top : APPROX_DEFAULT_TOP, every, stats);
+    }
+
+    // keywords on the command line fix the keyword order; without them
+    // the first checkpoint does, and any others are merged into it; with
+    // -grow every word read is added as a keyword
+    cooccurrence_matrix *matrix;
+    int merged = 0;
+    if (count > 0 || load_count == 0) {
+        matrix = cooccur_create(keys, count);
+    }
+    else {
+        matrix = load_file(loads[merged++]);
+    }
     if (matrix == NULL) {
         fprintf(stderr, "Matrix create Error\n");
+        free(loads);
         return 1;
     }
-    //fprintf(stderr, "here");
-    size_t n;
-    char **context;
-    while ((context = cooccur_read_context(matrix, stdin, &n)) != NULL) {
-        cooccur_update(matrix, context, n);
-        for (int i = 0; i < n; i++) {
-            free(context[i]);
+    cooccur_set_grow(matrix, grow);
+    for (; merged < load_count; merged++) {
+        cooccurrence_matrix *shard = load_file(loads[merged]);
+        if (shard == NULL || !cooccur_merge(matrix, shard)) {
+            fprintf(stderr, "Could not merge %s\n", loads[merged]);
+            cooccur_destroy(shard);
+            cooccur_destroy(matrix);
+            free(loads);
+            return 1;
         }
-        free(context);
+        cooccur_destroy(shard);
     }
+    free(loads);
 
-    for (int i = 1; i < argc; i++) {
-        double *out = cooccur_get_vector(matrix, argv[i]);
-        printf("%s: [", argv[i]);
-        for (int j = 0; j < argc - 2; j++) {
-            printf("%lf, ", out[j]);
+    if (stats) {
+        double seconds;
+        size_t bytes = cooccur_lookup_stats(matrix, &seconds);
+        fprintf(stderr, "keyword table: %zu keywords, %zu bytes, built in %.6f s\n", cooccur_size(matrix), bytes, seconds);
+    }
+    if (window > 0 && !cooccur_set_window(matrix, window)) {
+        fprintf(stderr, "Window create Error\n");
+        cooccur_destroy(matrix);
+        return 1;
+    }
+    cooccur_set_threads(matrix, threads);
+    if (half_life > 0.0 && !cooccur_set_decay(matrix, half_life)) {
+        fprintf(stderr, "Allocation error\n");
+        cooccur_destroy(matrix);
+        return 1;
+    }
+
+    // input is parsed a line at a time straight out of a mapping of the
+    // file, or out of large reads when stdin is not a file
+    outbuf *out = outbuf_create(stdout, 1 << 16);
+    inbuf *in = inbuf_open(stdin);
+    if (out == NULL || in == NULL) {
+        fprintf(stderr, "Allocation error\n");
+        if (out != NULL) {
+            outbuf_destroy(out);
         }
-        printf("%lf]\n", out[argc - 2]);
-        free(out);
+        cooccur_destroy(matrix);
+        return 1;
+    }
+
+    // without -every the input is counted in bulk, with the increments of
+    // many contexts applied together a row at a time; with -every the
+    // results so far are printed every that many lines, so a
+    // long-running stream can be watched without stopping it
+    size_t lines = 0;
+    const char *line;
+    size_t len;
+    while (window == 0 && every == 0 && (line = inbuf_lines(in, &len)) != NULL) {
+        cooccur_update_text(matrix, line, len);
+    }
+    while ((window > 0 || every > 0) && (line = inbuf_line(in, &len)) != NULL) {
+        if (window > 0) {
+            cooccur_stream_line(matrix, line, len);
+        }
+        else {
+            cooccur_update_line(matrix, line, len);
+        }
+
+        if (every > 0 && ++lines % every == 0) {
+            if (!print_results(matrix, nearest, top, format, metric, out) || (save != NULL && !save_file(matrix, save))) {
+                inbuf_close(in);
+                outbuf_destroy(out);
+                cooccur_destroy(matrix);
+                return 1;
+            }
+            if (format != FORMAT_BINARY) {
+                outbuf_char(out, '\n');
+            }
+            outbuf_flush(out);
+        }
+    }
+    bool read_error = inbuf_error(in);
+    inbuf_close(in);
+    if (read_error) {
+        fprintf(stderr, "Read error\n");
+        outbuf_destroy(out);
+        cooccur_destroy(matrix);
+        return 1;
+    }
+
+    if (!print_results(matrix, nearest, top, format, metric, out) || (save != NULL && !save_file(matrix, save))) {
+        outbuf_destroy(out);
+        cooccur_destroy(matrix);
+        return 1;
+    }
+    if (!outbuf_destroy(out)) {
+        fprintf(stderr, "Write error\n");
+        cooccur_destroy(matrix);
+        return 1;
+    }
+    if (stats) {
+        fprintf(stderr, "counts: %zu bytes\n", cooccur_count_bytes(matrix));
     }
     cooccur_destroy(matrix);
 
-    
+    return 0;
+}
+
+bool print_results(cooccurrence_matrix *matrix, size_t nearest, size_t top, int format, cooccur_metric metric, outbuf *out)
+{
+    // vectors are computed a block of rows at a time, the rows of a
+    // block in parallel; with more than one thread the block is then
+    // formatted in parallel too, a part per thread into a buffer of its
+    // own, and the parts are written in order
+    size_t count = cooccur_size(matrix);
+    size_t k = nearest > 0 ? nearest : top;
+    size_t block = count > 0 ? (PRINT_BLOCK_CELLS + count - 1) / count : 1;
+    size_t parts = nearest > 0 ? 1 : cooccur_threads(matrix);
+    print_job job = {matrix, top, format, 0, 0, NULL, NULL, NULL, NULL, parts};
+    job.rows = malloc(sizeof(double) * block * (count > 0 ? count : 1));
+    job.lists = malloc(sizeof(size_t) * parts * (k > 0 ? k : 1));
+    job.values = malloc(sizeof(double) * parts * (k > 0 ? k : 1));
+    job.outs = calloc(parts, sizeof(outbuf *));
+    bool ok = job.rows != NULL && job.lists != NULL && job.values != NULL && job.outs != NULL;
+    for (size_t p = 0; ok && p < parts; p++) {
+        job.outs[p] = parts > 1 ? outbuf_create(NULL, PRINT_BLOCK_CELLS) : out;
+        ok = job.outs[p] != NULL;
+    }
+
+    if (ok && format == FORMAT_BINARY) {
+        outbuf_write(out, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        outbuf_le(out, BINARY_VERSION, 4);
+        outbuf_le(out, k > 0, 4);
+        outbuf_le(out, count, 8);
+        for (size_t i = 0; i < count; i++) {
+            const char *key = cooccur_keyword(matrix, i);
+            outbuf_le(out, strlen(key), 4);
+            outbuf_string(out, key);
+        }
+    }
+
+    for (size_t i = 0; ok && nearest > 0 && i < count; i++) {
+        // most similar keywords by cosine similarity of their rows
+        size_t found = cooccur_nearest(matrix, cooccur_keyword(matrix, i), nearest, job.lists, job.values);
+        print_list(matrix, i, job.lists, job.values, found, format, out);
+    }
+    for (job.first = 0; ok && nearest == 0 && job.first < count; job.first += block) {
+        job.count = count - job.first < block ? count - job.first : block;
+        ok = cooccur_get_metric_rows(matrix, metric, job.first, job.count, job.rows);
+        if (ok && parts > 1) {
+            cooccur_parallel(matrix, parts, print_part, &job);
+            for (size_t p = 0; p < parts; p++) {
+                outbuf_append(out, job.outs[p]);
+            }
+        }
+        else if (ok) {
+            print_part(0, 1, &job);
+        }
+    }
+
+    for (size_t p = 0; parts > 1 && job.outs != NULL && p < parts; p++) {
+        if (job.outs[p] != NULL) {
+            outbuf_destroy(job.outs[p]);
+        }
+    }
+    free(job.rows);
+    free(job.lists);
+    free(job.values);
+    free(job.outs);
+    if (!ok) {
+        fprintf(stderr, "Allocation error\n");
+    }
+    return ok;
+}
+
+void print_part(size_t begin, size_t end, void *arg)
+{
+    print_job *job = arg;
+    const cooccurrence_matrix *matrix = job->matrix;
+    size_t count = cooccur_size(matrix);
+    size_t k = job->top > 0 ? job->top : 1;
+    for (size_t p = begin; p < end; p++) {
+        outbuf *out = job->outs[p];
+        size_t *list = job->lists + p * k;
+        double *values = job->values + p * k;
+        for (size_t r = p * job->count / job->parts; r < (p + 1) * job->count / job->parts; r++) {
+            size_t i = job->first + r;
+            const char *key = cooccur_keyword(matrix, i);
+            const double *row = job->rows + r * count;
+            if (job->top > 0) {
+                // the keyword itself always has the largest value
+                size_t found = vec_top_k(row, count, job->top, i, list);
+                for (size_t j = 0; j < found; j++) {
+                    values[j] = row[list[j]];
+                }
+                print_list(matrix, i, list, values, found, job->format, out);
+            }
+            else if (job->format == FORMAT_BINARY) {
+                for (size_t j = 0; j < count; j++) {
+                    outbuf_f64(out, row[j]);
+                }
+            }
+            else if (job->format == FORMAT_SPARSE) {
+                outbuf_string(out, key);
+                outbuf_char(out, ':');
+                for (size_t j = 0; j < count; j++) {
+                    if (row[j] != 0.0) {
+                        outbuf_char(out, ' ');
+                        outbuf_string(out, cooccur_keyword(matrix, j));
+                        outbuf_char(out, ' ');
+                        outbuf_double(out, row[j]);
+                    }
+                }
+                outbuf_char(out, '\n');
+            }
+            else {
+                outbuf_string(out, key);
+                outbuf_string(out, ": [");
+                for (size_t j = 0; j + 1 < count; j++) {
+                    outbuf_double(out, row[j]);
+                    outbuf_string(out, ", ");
+                }
+                outbuf_double(out, row[count - 1]);
+                outbuf_string(out, "]\n");
+            }
+        }
+    }
+}
+
+bool parse_metric(const char *name, cooccur_metric *metric)
+{
+    const char *names[] = {"proportion", "pmi", "ppmi", "jaccard"};
+    const cooccur_metric metrics[] = {COOCCUR_PROPORTION, COOCCUR_PMI, COOCCUR_PPMI, COOCCUR_JACCARD};
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (strcmp(name, names[i]) == 0) {
+            *metric = metrics[i];
+            return true;
+        }
+    }
+    return false;
+}
 
+void print_list(const cooccurrence_matrix *matrix, size_t row, const size_t *list, const double *values, size_t n, int format, outbuf *out)
+{
+    if (format == FORMAT_BINARY) {
+        outbuf_le(out, n, 4);
+        for (size_t j = 0; j < n; j++) {
+            outbuf_le(out, list[j], 4);
+            outbuf_f64(out, values[j]);
+        }
+        return;
+    }
+
+    outbuf_string(out, cooccur_keyword(matrix, row));
+    outbuf_char(out, ':');
+    for (size_t j = 0; j < n; j++) {
+        outbuf_char(out, ' ');
+        outbuf_string(out, cooccur_keyword(matrix, list[j]));
+        outbuf_char(out, ' ');
+        outbuf_double(out, values[j]);
+    }
+    outbuf_char(out, '\n');
+}
+
+int run_approx(char **keys, size_t count, size_t bytes, size_t top, size_t every, bool stats)
+{
+    approx_counter *approx = approx_create(keys, count, bytes, top * APPROX_CANDIDATES_PER_TOP);
+    outbuf *out = outbuf_create(stdout, 1 << 16);
+    inbuf *in = inbuf_open(stdin);
+    if (approx == NULL || out == NULL || in == NULL) {
+        fprintf(stderr, "Approximate counter create Error\n");
+        approx_destroy(approx);
+        if (out != NULL) {
+            outbuf_destroy(out);
+        }
+        inbuf_close(in);
+        return 1;
+    }
+
+    size_t lines = 0;
+    const char *line;
+    size_t len;
+    bool ok = true;
+    while (ok && (line = inbuf_line(in, &len)) != NULL) {
+        ok = approx_count_line(approx, line, len);
+        if (ok && every > 0 && ++lines % every == 0) {
+            ok = print_approx(approx, top, out);
+            outbuf_char(out, '\n');
+            outbuf_flush(out);
+        }
+    }
+    if (!ok || inbuf_error(in)) {
+        fprintf(stderr, ok ? "Read error\n" : "Allocation error\n");
+        inbuf_close(in);
+        outbuf_destroy(out);
+        approx_destroy(approx);
+        return 1;
+    }
+    inbuf_close(in);
+
+    if (!print_approx(approx, top, out) || !outbuf_destroy(out)) {
+        fprintf(stderr, "Write error\n");
+        approx_destroy(approx);
+        return 1;
+    }
+
+    size_t width;
+    size_t depth;
+    size_t memory = approx_memory(approx, &width, &depth);
+    fprintf(stderr, "approximate counts: at most %.0f too high with probability %.4f\n", approx_error(approx), approx_confidence(approx));
+    if (stats) {
+        fprintf(stderr, "sketch: %zu x %zu counters, %zu bytes with keywords and candidates\n", depth, width, memory);
+    }
+    approx_destroy(approx);
     return 0;
 }
+
+bool print_approx(const approx_counter *approx, size_t top, outbuf *out)
+{
+    const char **words = malloc(sizeof(const char *) * top);
+    uint64_t *counts = malloc(sizeof(uint64_t) * top);
+    if (words == NULL || counts == NULL) {
+        free(words);
+        free(counts);
+        fprintf(stderr, "Allocation error\n");
+        return false;
+    }
+
+    char number[24];
+    for (size_t i = 0; i < approx_size(approx); i++) {
+        size_t found = approx_top(approx, i, top, words, counts);
+        outbuf_string(out, approx_keyword(approx, i));
+        outbuf_char(out, ':');
+        for (size_t j = 0; j < found; j++) {
+            outbuf_char(out, ' ');
+            outbuf_string(out, words[j]);
+            snprintf(number, sizeof(number), " %llu", (unsigned long long)counts[j]);
+            outbuf_string(out, number);
+        }
+        outbuf_char(out, '\n');
+    }
+
+    free(words);
+    free(counts);
+    return true;
+}
+
+cooccurrence_matrix *load_file(const char *path)
+{
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+        return NULL;
+    }
+    cooccurrence_matrix *matrix = cooccur_load(in);
+    fclose(in);
+    if (matrix == NULL) {
+        fprintf(stderr, "%s is not a valid checkpoint\n", path);
+    }
+    return matrix;
+}
+
+bool save_file(const cooccurrence_matrix *matrix, const char *path)
+{
+    size_t len = strlen(path);
+    char *temp = malloc(len + 5);
+    if (temp == NULL) {
+        fprintf(stderr, "Allocation error\n");
+        return false;
+    }
+    strcpy(temp, path);
+    strcpy(temp + len, ".tmp");
+
+    FILE *out = fopen(temp, "wb");
+    bool ok = out != NULL && cooccur_save(matrix, out);
+    if (out != NULL && fclose(out) != 0) {
+        ok = false;
+    }
+    if (ok && rename(temp, path) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Could not save %s\n", path);
+        remove(temp);
+    }
+    free(temp);
+    return ok;
+}
@@ -2,14 +2,19 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <math.h>
 
 #include "gmap_test_functions.h"
 
+#include "approx.h"
 #include "cooccur.h"
+#include "outbuf.h"
+#include "parallel.h"
 
 cooccurrence_matrix *make_matrix(const char *prefix, size_t size);
 cooccurrence_matrix *make_matrix_keywords(char * const *keys, size_t size);
 bool compare_string_arrays(char **a1, int sz1, char **a2, int sz2);
+void count_items(size_t begin, size_t end, void *arg);
 
 void test_create();
 void test_update_all_keywords(size_t size);
@@ -19,6 +24,18 @@ void test_read_mixed_words(size_t size, FILE *in);
 void test_get_returns_copy(size_t size);
 
 void test_create_duplicate_keywords(size_t size);
+void test_lookup_rejects_non_keywords(size_t size);
+void test_similarity_queries(size_t size);
+void test_stream_window_decay(size_t size);
+void test_save_load_merge(size_t size);
+void test_count_widening(size_t size);
+void test_format_double(size_t size);
+void test_association_metrics(size_t size);
+void test_add_keywords(size_t size);
+void test_approx_counts(size_t size);
+void test_batched_updates(size_t size);
+void test_batched_empty_contexts(size_t size);
+void test_thread_pool(size_t size);
 
 int main(int argc, char **argv)
 {
@@ -64,6 +81,58 @@ int main(int argc, char **argv)
     case 6:
       test_get_returns_copy(size);
       break;
+
+    case 7:
+      test_create_duplicate_keywords(size);
+      break;
+
+    case 8:
+      test_lookup_rejects_non_keywords(size);
+      break;
+
+    case 9:
+      test_similarity_queries(size);
+      break;
+
+    case 10:
+      test_stream_window_decay(size);
+      break;
+
+    case 11:
+      test_save_load_merge(size);
+      break;
+
+    case 12:
+      test_count_widening(size);
+      break;
+
+    case 13:
+      test_format_double(size);
+      break;
+
+    case 14:
+      test_association_metrics(size);
+      break;
+
+    case 15:
+      test_add_keywords(size);
+      break;
+
+    case 16:
+      test_approx_counts(size);
+      break;
+
+    case 17:
+      test_batched_updates(size);
+      break;
+
+    case 18:
+      test_thread_pool(size);
+      break;
+
+    case 19:
+      test_batched_empty_contexts(size);
+      break;
       
     default:
       fprintf(stderr, "USAGE: %s test-number [matrix-size]\n", argv[0]);
@@ -340,6 +409,748 @@ void test_get_returns_copy(size_t size)
   PRINT_PASSED;
 }
 
+void test_create_duplicate_keywords(size_t size)
+{
+  // "word0" ... "wordsize-1" followed by a second "word0"
+  char **keys = make_words("word", size + 1);
+  sprintf(keys[size], "word0");
+  cooccurrence_matrix *m = cooccur_create(keys, size + 1);
+  free_words(keys, size + 1);
+
+  if (m != NULL)
+    {
+      printf("FAILED -- created matrix with duplicate keywords\n");
+      cooccur_destroy(m);
+      return;
+    }
+
+  PRINT_PASSED;
+}
+
+void test_lookup_rejects_non_keywords(size_t size)
+{
+  char **keys = make_words("word", size);
+  cooccurrence_matrix *m = make_matrix_keywords(keys, size);
+
+  // prefixes, extensions and same-length near misses of every keyword
+  // must not be read; the keywords themselves must be
+  FILE *in = tmpfile();
+  for (size_t i = 0; i < size; i++)
+    {
+      fprintf(in, "word %sx x%s %.*sX %s ", keys[i], keys[i], (int)strlen(keys[i]) - 1, keys[i], keys[i]);
+    }
+  fprintf(in, "\n");
+  rewind(in);
+
+  size_t context_size = 0;
+  char **context_read = cooccur_read_context(m, in, &context_size);
+  fclose(in);
+
+  if (!compare_string_arrays(keys, size, context_read, context_size))
+    {
+      PRINT_FAILED;
+      free_words(keys, size);
+      free_words(context_read, context_size);
+      cooccur_destroy(m);
+      return;
+    }
+
+  double build_time = -1.0;
+  size_t bytes = cooccur_lookup_stats(m, &build_time);
+  if (bytes == 0 || build_time < 0.0)
+    {
+      printf("FAILED -- lookup stats %zu bytes %lf s\n", bytes, build_time);
+      free_words(keys, size);
+      free_words(context_read, context_size);
+      cooccur_destroy(m);
+      return;
+    }
+
+  free_words(keys, size);
+  free_words(context_read, context_size);
+  cooccur_destroy(m);
+  PRINT_PASSED;
+}
+
+void test_similarity_queries(size_t size)
+{
+  cooccurrence_matrix *m = make_matrix("word", size);
+  char **keys = make_words("word", size);
+
+  // same updates as test_update_all_keywords, so row i is the first
+  // i + 1 columns of row size - 1 scaled by its diagonal
+  for (size_t i = 1; i <= size; i++)
+    {
+      char **context = make_words("word", i);
+      cooccur_update(m, context, i);
+      free_words(context, i);
+    }
+
+  double *vec = cooccur_get_vector(m, keys[0]);
+  double *into = malloc(sizeof(double) * size);
+  double *sims = malloc(sizeof(double) * size);
+  double *rows = malloc(sizeof(double) * size * size);
+  size_t *near = malloc(sizeof(size_t) * size);
+  bool ok = cooccur_get_vector_into(m, keys[0], into) && !cooccur_get_vector_into(m, "not a keyword", sims);
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      ok = vec[i] == into[i] && sims[i] == 0.0;
+    }
+
+  // raw counts: row i has size - max(i, j) in column j
+  for (size_t i = 0; i < size; i++)
+    {
+      for (size_t j = 0; j < size; j++)
+	{
+	  rows[i * size + j] = size - (i > j ? i : j);
+	}
+    }
+  ok = ok && cooccur_similarities(m, keys[size / 2], sims);
+  for (size_t j = 0; j < size && ok; j++)
+    {
+      double dot = 0.0, norm1 = 0.0, norm2 = 0.0;
+      for (size_t c = 0; c < size; c++)
+	{
+	  dot += rows[(size / 2) * size + c] * rows[j * size + c];
+	  norm1 += rows[(size / 2) * size + c] * rows[(size / 2) * size + c];
+	  norm2 += rows[j * size + c] * rows[j * size + c];
+	}
+      double expected = dot / sqrt(norm1 * norm2);
+      ok = fabs(sims[j] - expected) < 1e-9 && fabs(cooccur_similarity(m, keys[size / 2], keys[j]) - expected) < 1e-9;
+    }
+
+  // the nearest rows must come out in decreasing order of similarity
+  size_t found = cooccur_nearest(m, keys[size / 2], size, near, NULL);
+  ok = ok && found == size - 1;
+  for (size_t j = 0; j < found && ok; j++)
+    {
+      ok = near[j] != size / 2 && (j == 0 || sims[near[j - 1]] >= sims[near[j]]);
+    }
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(vec);
+  free(into);
+  free(sims);
+  free(rows);
+  free(near);
+  free_words(keys, size);
+  cooccur_destroy(m);
+}
+
+void test_stream_window_decay(size_t size)
+{
+  char **keys = make_words("word", size);
+  cooccurrence_matrix *m = make_matrix_keywords(keys, size);
+  double *counts = malloc(sizeof(double) * size);
+  bool ok = cooccur_set_window(m, 3);
+
+  // "word0 x word1 x word2 ..." with a window of 3 pairs each keyword
+  // with the one before it across lines
+  FILE *in = tmpfile();
+  for (size_t i = 0; i < size; i++)
+    {
+      fprintf(in, "%s x%s", keys[i], i % 3 == 2 ? "\n" : " ");
+    }
+  rewind(in);
+  while (cooccur_read_stream(m, in))
+    {
+    }
+  fclose(in);
+
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      cooccur_get_counts_into(m, i, counts);
+      for (size_t j = 0; j < size && ok; j++)
+	{
+	  ok = counts[j] == (i == j || i == j + 1 || j == i + 1 ? 1.0 : 0.0);
+	}
+    }
+
+  // with a half-life of one token, word0's count halves with each token,
+  // including the one that increments it: (1 / 2 + 1) / 2^3
+  cooccur_set_decay(m, 1.0);
+  cooccur_stream_token(m, keys[0], strlen(keys[0]));
+  for (int t = 0; t < 3; t++)
+    {
+      cooccur_stream_token(m, "x", 1);
+    }
+  cooccur_get_counts_into(m, 0, counts);
+  ok = ok && fabs(counts[0] - 1.5 / 8.0) < 1e-12;
+
+  // a short half-life forces rows to be rescaled many times; the count
+  // of a keyword seen every token converges to 1 / (1 - 2^(-1 / half-life))
+  cooccur_set_decay(m, 0.5);
+  for (int t = 0; t < 1000; t++)
+    {
+      cooccur_stream_token(m, keys[0], strlen(keys[0]));
+    }
+  cooccur_get_counts_into(m, 0, counts);
+  ok = ok && fabs(counts[0] - 4.0 / 3.0) < 1e-9;
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(counts);
+  free_words(keys, size);
+  cooccur_destroy(m);
+}
+
+void test_save_load_merge(size_t size)
+{
+  char **keys = make_words("word", size);
+  cooccurrence_matrix *m = make_matrix_keywords(keys, size);
+  double *before = malloc(sizeof(double) * size);
+  double *after = malloc(sizeof(double) * size);
+
+  // same updates as test_update_all_keywords, with decay so that the
+  // clock and row times are saved too
+  cooccur_set_decay(m, 100.0);
+  for (size_t i = 0; i < size; i++)
+    {
+      char **context = make_words("word", i + 1);
+      cooccur_update(m, context, i + 1);
+      free_words(context, i + 1);
+    }
+
+  FILE *out = tmpfile();
+  bool ok = cooccur_save(m, out);
+  long length = ftell(out);
+  rewind(out);
+  cooccurrence_matrix *copy = cooccur_load(out);
+  ok = ok && copy != NULL && cooccur_size(copy) == size;
+
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      ok = strcmp(cooccur_keyword(copy, i), keys[i]) == 0;
+      cooccur_get_counts_into(m, i, before);
+      cooccur_get_counts_into(copy, i, after);
+      for (size_t j = 0; j < size && ok; j++)
+	{
+	  ok = before[j] == after[j];
+	}
+    }
+
+  // merging a copy into itself doubles every count
+  ok = ok && cooccur_merge(copy, m);
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      cooccur_get_counts_into(m, i, before);
+      cooccur_get_counts_into(copy, i, after);
+      for (size_t j = 0; j < size && ok; j++)
+	{
+	  ok = fabs(after[j] - 2 * before[j]) <= 1e-12 * before[j];
+	}
+    }
+
+  // merging a matrix with an unknown keyword fails
+  char *other[] = {"not a keyword"};
+  cooccurrence_matrix *stranger = cooccur_create(other, 1);
+  ok = ok && !cooccur_merge(copy, stranger);
+  cooccur_destroy(stranger);
+
+  // truncated and corrupted checkpoints are rejected
+  FILE *cut = tmpfile();
+  rewind(out);
+  for (long b = 0; b < length - 1; b++)
+    {
+      putc(getc(out), cut);
+    }
+  rewind(cut);
+  cooccurrence_matrix *bad = cooccur_load(cut);
+  ok = ok && bad == NULL;
+  cooccur_destroy(bad);
+  fclose(cut);
+
+  fseek(out, length / 2, SEEK_SET);
+  int c = getc(out);
+  fseek(out, length / 2, SEEK_SET);
+  putc(c ^ 0x40, out);
+  rewind(out);
+  bad = cooccur_load(out);
+  ok = ok && bad == NULL;
+  cooccur_destroy(bad);
+  fclose(out);
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(before);
+  free(after);
+  free_words(keys, size);
+  cooccur_destroy(copy);
+  cooccur_destroy(m);
+}
+
+void test_count_widening(size_t size)
+{
+  char **keys = make_words("word", size);
+  cooccurrence_matrix *m = make_matrix_keywords(keys, size);
+  double *counts = malloc(sizeof(double) * size);
+  size_t narrow = cooccur_count_bytes(m);
+
+  // past the largest 16-bit count
+  for (size_t t = 0; t < 70000; t++)
+    {
+      cooccur_update(m, keys, size);
+    }
+  bool ok = cooccur_count_bytes(m) == 2 * narrow;
+
+  // exact counts survive a checkpoint at the wider width
+  FILE *out = tmpfile();
+  ok = ok && cooccur_save(m, out);
+  rewind(out);
+  cooccurrence_matrix *copy = cooccur_load(out);
+  fclose(out);
+  ok = ok && copy != NULL && cooccur_count_bytes(copy) == 2 * narrow;
+
+  // doubling past the largest 32-bit count
+  for (int d = 0; d < 16 && ok; d++)
+    {
+      ok = cooccur_merge(copy, copy);
+    }
+  ok = ok && cooccur_count_bytes(copy) == 4 * narrow;
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      cooccur_get_counts_into(copy, i, counts);
+      for (size_t j = 0; j < size && ok; j++)
+	{
+	  ok = counts[j] == 70000.0 * 65536.0;
+	}
+    }
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(counts);
+  free_words(keys, size);
+  cooccur_destroy(copy);
+  cooccur_destroy(m);
+}
+
+void test_format_double(size_t size)
+{
+  double special[] = {0.0, -0.0, 1.0, -1.0, 0.5, 1.0 / 3, 2.0 / 3, 0.0000005, 0.0000015,
+		      0.0000025, 1e-300, -1e-9, 999999.9999995, 1e6, 1e300, -1e300,
+		      HUGE_VAL, -HUGE_VAL, NAN};
+  char fast[512];
+  char slow[512];
+  bool ok = true;
+
+  for (size_t i = 0; i < sizeof(special) / sizeof(special[0]) && ok; i++)
+    {
+      size_t len = outbuf_format_double(fast, sizeof(fast), special[i]);
+      ok = len == (size_t)snprintf(slow, sizeof(slow), "%f", special[i]) && strcmp(fast, slow) == 0;
+    }
+
+  // proportions, and values near halfway between two outputs
+  srand(size);
+  for (size_t i = 0; i < size * 10000 && ok; i++)
+    {
+      double v = (double)rand() / RAND_MAX * 2;
+      double tie = (rand() % 2000000 + 0.5) / 1e6;
+      double big = (double)rand() / RAND_MAX * 1e7;
+      for (int which = 0; which < 3 && ok; which++)
+	{
+	  double x = which == 0 ? v : (which == 1 ? tie : big);
+	  outbuf_format_double(fast, sizeof(fast), x);
+	  snprintf(slow, sizeof(slow), "%f", x);
+	  ok = strcmp(fast, slow) == 0;
+	}
+    }
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+}
+
+void test_association_metrics(size_t size)
+{
+  // contexts {a, b}, {a}, {b, c} and {}: N = 4, c(a) = c(b) = 2, c(c) = 1,
+  // c(a, b) = c(b, c) = 1
+  char *keys[] = {"a", "b", "c"};
+  cooccurrence_matrix *m = cooccur_create(keys, 3);
+  cooccur_update(m, keys, 2);
+  cooccur_update(m, keys, 1);
+  cooccur_update(m, keys + 1, 2);
+  cooccur_update(m, keys, 0);
+
+  double pmi[3];
+  double ppmi[3];
+  double jaccard[3];
+  double proportion[3];
+  double none[3];
+  bool ok = cooccur_contexts(m) == 4.0
+    && cooccur_get_metric_into(m, "b", COOCCUR_PMI, pmi)
+    && cooccur_get_metric_into(m, "b", COOCCUR_PPMI, ppmi)
+    && cooccur_get_metric_into(m, "b", COOCCUR_JACCARD, jaccard)
+    && cooccur_get_metric_into(m, "b", COOCCUR_PROPORTION, proportion)
+    && !cooccur_get_metric_into(m, "d", COOCCUR_PMI, none);
+  ok = ok && fabs(pmi[0]) < 1e-12 && fabs(pmi[1] - log(2)) < 1e-12 && fabs(pmi[2] - log(2)) < 1e-12;
+  ok = ok && fabs(ppmi[0]) < 1e-12 && fabs(ppmi[1] - log(2)) < 1e-12;
+  ok = ok && fabs(jaccard[0] - 1.0 / 3) < 1e-12 && jaccard[1] == 1.0 && fabs(jaccard[2] - 0.5) < 1e-12;
+  ok = ok && proportion[0] == 0.5 && proportion[1] == 1.0 && proportion[2] == 0.5;
+  cooccur_get_metric_into(m, "a", COOCCUR_PMI, pmi);
+  ok = ok && pmi[2] == 0.0;
+  cooccur_destroy(m);
+
+  // rows computed in parallel match rows computed one at a time
+  char **words = make_words("word", size);
+  m = make_matrix_keywords(words, size);
+  srand(size);
+  char **context = malloc(sizeof(char *) * size);
+  for (size_t t = 0; t < 20 * size; t++)
+    {
+      size_t n = 0;
+      for (size_t i = 0; i < size; i++)
+	{
+	  if (rand() % 4 == 0)
+	    {
+	      context[n++] = words[i];
+	    }
+	}
+      cooccur_update(m, context, n);
+    }
+  free(context);
+
+  double *all = malloc(sizeof(double) * size * size);
+  double *one = malloc(sizeof(double) * size);
+  for (cooccur_metric metric = COOCCUR_PROPORTION; metric <= COOCCUR_JACCARD && ok; metric++)
+    {
+      cooccur_set_threads(m, 4);
+      ok = cooccur_get_metric_rows(m, metric, 0, size, all);
+      cooccur_set_threads(m, 1);
+      for (size_t i = 0; i < size && ok; i++)
+	{
+	  ok = cooccur_get_metric_into(m, words[i], metric, one)
+	    && memcmp(one, all + i * size, sizeof(double) * size) == 0;
+	}
+    }
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(all);
+  free(one);
+  free_words(words, size);
+  cooccur_destroy(m);
+}
+
+void test_add_keywords(size_t size)
+{
+  // one matrix gets its keywords up front and the other one at a time,
+  // with the same updates in between
+  char **keys = make_words("word", size);
+  cooccurrence_matrix *full = make_matrix_keywords(keys, size);
+  cooccurrence_matrix *grown = cooccur_create(keys, 0);
+  bool ok = cooccur_size(grown) == 0;
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      ok = cooccur_add_keyword(grown, keys[i]) == (long)i
+	&& cooccur_add_keyword(grown, keys[i]) == (long)i
+	&& cooccur_size(grown) == i + 1;
+      cooccur_update(full, keys, i + 1);
+      cooccur_update(grown, keys, i + 1);
+      if (i + 2 <= size)
+	{
+	  cooccur_update(grown, keys, i + 2); // ignored: not all keywords yet
+	}
+    }
+  cooccur_update(full, keys, size);
+  cooccur_update(grown, keys, size);
+
+  double *a = malloc(sizeof(double) * size);
+  double *b = malloc(sizeof(double) * size);
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      ok = cooccur_get_vector_into(full, keys[i], a) && cooccur_get_vector_into(grown, keys[i], b)
+	&& memcmp(a, b, sizeof(double) * size) == 0;
+    }
+  free(a);
+  free(b);
+
+  // a growing matrix adds the words it reads, including long ones and
+  // enough of them to recompile the keyword table
+  cooccur_set_grow(grown, true);
+  FILE *in = tmpfile();
+  for (size_t i = 0; i < 200; i++)
+    {
+      fprintf(in, "%s new%zu new%zu_%s\n", keys[i % size], i, i, "with_a_much_longer_name_than_any_keyword_so_far");
+    }
+  rewind(in);
+  size_t n;
+  char **context;
+  while (ok && (context = cooccur_read_context(grown, in, &n)) != NULL)
+    {
+      ok = n == 3;
+      cooccur_update(grown, context, n);
+      free_words(context, n);
+    }
+  fclose(in);
+  ok = ok && cooccur_size(grown) == size + 400 && cooccur_index(grown, "new199") == (long)size + 398;
+
+  char *fresh[] = {"fresh0", "fresh1"};
+  cooccur_update(grown, fresh, 2);
+  ok = ok && cooccur_size(grown) == size + 402 && cooccur_similarity(grown, "fresh0", "fresh1") > 0.999;
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free_words(keys, size);
+  cooccur_destroy(full);
+  cooccur_destroy(grown);
+}
+
+void test_approx_counts(size_t size)
+{
+  // the exact matrix has every word as a keyword; the approximate
+  // counters only the first size of them
+  size_t others = 5;
+  char **words = malloc(sizeof(char *) * (size + others));
+  char **keys = make_words("word", size);
+  char **rest = make_words("other", others);
+  memcpy(words, keys, sizeof(char *) * size);
+  memcpy(words + size, rest, sizeof(char *) * others);
+  cooccurrence_matrix *exact = make_matrix_keywords(words, size + others);
+  approx_counter *big = approx_create(keys, size, 1 << 20, size + others);
+  approx_counter *tiny = approx_create(keys, size, 64, 2);
+
+  FILE *in = tmpfile();
+  for (size_t c = 0; c < size * 4; c++)
+    {
+      fprintf(in, "%s %s %s  %s\n", keys[c % size], keys[(c * 7 + 3) % size], rest[c % others], rest[c % others]);
+    }
+  rewind(in);
+  size_t n;
+  char **context;
+  while ((context = cooccur_read_context(exact, in, &n)) != NULL)
+    {
+      cooccur_update(exact, context, n);
+      free_words(context, n);
+    }
+  rewind(in);
+  while (approx_read_context(big, in))
+    {
+    }
+  rewind(in);
+  char *line[4];
+  for (size_t c = 0; c < size * 4; c++)
+    {
+      line[0] = keys[c % size];
+      line[1] = keys[(c * 7 + 3) % size];
+      line[2] = rest[c % others];
+      line[3] = rest[c % others];
+      approx_update(tiny, line, 4);
+    }
+  fclose(in);
+
+  // a big sketch is exact here and a tiny one is never too low
+  bool ok = approx_contexts(big) == size * 4 && approx_contexts(tiny) == size * 4 && approx_size(big) == size;
+  double *row = malloc(sizeof(double) * (size + others));
+  const char *top[3];
+  uint64_t counts[3];
+  for (size_t i = 0; i < size && ok; i++)
+    {
+      cooccur_get_counts_into(exact, i, row);
+      for (size_t j = 0; j < size + others && ok; j++)
+	{
+	  ok = approx_estimate(big, keys[i], words[j]) == row[j]
+	    && approx_estimate(tiny, keys[i], words[j]) >= row[j];
+	}
+
+      // the top list has the largest counts of the other words
+      row[i] = 0.0;
+      size_t found = approx_top(big, i, 3, top, counts);
+      for (size_t k = 0; k < found && ok; k++)
+	{
+	  size_t best = 0;
+	  for (size_t j = 1; j < size + others; j++)
+	    {
+	      if (row[j] > row[best])
+		{
+		  best = j;
+		}
+	    }
+	  ok = counts[k] == row[best] && counts[k] == approx_estimate(big, keys[i], top[k]) && strcmp(top[k], keys[i]) != 0;
+	  row[best] = 0.0;
+	}
+    }
+  ok = ok && approx_estimate(big, "none", keys[0]) == 0 && approx_error(tiny) > approx_error(big)
+    && approx_confidence(big) > 0.9 && approx_confidence(big) < 1.0;
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(row);
+  free(words);
+  free_words(keys, size);
+  free_words(rest, others);
+  cooccur_destroy(exact);
+  approx_destroy(big);
+  approx_destroy(tiny);
+}
+
+void test_batched_updates(size_t size)
+{
+  // the same text counted a line at a time and in batches, by a fixed,
+  // a growing and a decaying matrix; one line has every keyword, which
+  // is more increments than fit in a batch for large sizes
+  char **keys = make_words("word", size);
+  size_t cap = 64;
+  size_t len = 0;
+  char *text = malloc(cap);
+  for (size_t c = 0; c < size * 8 + 1; c++)
+    {
+      size_t words = c == size * 4 ? size : 1 + c % 5;
+      for (size_t w = 0; w < words; w++)
+	{
+	  const char *word = words == size ? keys[w] : keys[(c * 7 + w * 13) % size];
+	  if (len + strlen(word) + 16 > cap)
+	    {
+	      cap = cap * 2 + strlen(word) + 16;
+	      text = realloc(text, cap);
+	    }
+	  len += sprintf(text + len, w % 3 == 2 ? "%s  other " : "%s ", word);
+	}
+      text[len++] = c % 9 == 8 ? ' ' : '\n';
+    }
+
+  bool ok = true;
+  for (int mode = 0; mode < 3 && ok; mode++)
+    {
+      cooccurrence_matrix *lined = cooccur_create(keys, mode == 1 ? size / 2 : size);
+      cooccurrence_matrix *batched = cooccur_create(keys, mode == 1 ? size / 2 : size);
+      cooccur_set_grow(lined, mode == 1);
+      cooccur_set_grow(batched, mode == 1);
+      if (mode == 2)
+	{
+	  cooccur_set_decay(lined, 10.0);
+	  cooccur_set_decay(batched, 10.0);
+	}
+
+      size_t start = 0;
+      for (size_t i = 0; i <= len; i++)
+	{
+	  if (i == len || text[i] == '\n')
+	    {
+	      if (i > start || i < len)
+		{
+		  cooccur_update_line(lined, text + start, i - start);
+		}
+	      start = i + 1;
+	    }
+	}
+      // in two pieces, to be sure nothing is left over between calls
+      size_t half = len / 2;
+      while (half > 0 && text[half - 1] != '\n')
+	{
+	  half--;
+	}
+      cooccur_update_text(batched, text, half);
+      cooccur_update_text(batched, text + half, len - half);
+
+      size_t n = cooccur_size(lined);
+      ok = n == cooccur_size(batched) && cooccur_contexts(lined) == cooccur_contexts(batched);
+      double *a = malloc(sizeof(double) * n);
+      double *b = malloc(sizeof(double) * n);
+      for (size_t i = 0; i < n && ok; i++)
+	{
+	  ok = strcmp(cooccur_keyword(lined, i), cooccur_keyword(batched, i)) == 0;
+	  cooccur_get_counts_into(lined, i, a);
+	  cooccur_get_counts_into(batched, i, b);
+	  ok = ok && memcmp(a, b, sizeof(double) * n) == 0;
+	}
+      free(a);
+      free(b);
+      cooccur_destroy(lined);
+      cooccur_destroy(batched);
+    }
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(text);
+  free_words(keys, size);
+}
+
+void test_batched_empty_contexts(size_t size)
+{
+  // more contexts without keywords than a batch has places, then one
+  // with keywords; each counts toward the total
+  cooccurrence_matrix *m = make_matrix("word", size);
+  size_t lines = 2 * (1 << 16) + 1000;
+  char *text = malloc(lines * 2 + 64);
+  size_t len = 0;
+  for (size_t c = 0; c < lines; c++)
+    {
+      text[len++] = 'x';
+      text[len++] = '\n';
+    }
+  len += sprintf(text + len, "%s %s\n", cooccur_keyword(m, 0), cooccur_keyword(m, size - 1));
+  cooccur_update_text(m, text, len);
+
+  double *row = malloc(sizeof(double) * size);
+  cooccur_get_counts_into(m, 0, row);
+  bool ok = cooccur_contexts(m) == lines + 1 && row[0] == 1.0 && row[size - 1] == 1.0;
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+  free(row);
+  free(text);
+  cooccur_destroy(m);
+}
+
 int compare_strings(const void *p1, const void *p2)
 {
   const char * const *s1 = p1;
@@ -370,3 +1181,99 @@ bool compare_string_arrays(char **a1, int sz1, char **a2, int sz2)
       return true;
     }
 }
+
+void count_items(size_t begin, size_t end, void *arg)
+{
+  size_t *counts = arg;
+  for (size_t i = begin; i < end; i++)
+    {
+      counts[i]++;
+    }
+}
+
+void test_thread_pool(size_t size)
+{
+  // every item of every loop is done exactly once, including loops with
+  // fewer items than threads
+  parallel_pool *pool = parallel_pool_create(4);
+  size_t *counts = calloc(size + 8, sizeof(size_t));
+  bool ok = pool != NULL && counts != NULL && parallel_pool_size(pool) >= 1;
+  for (size_t round = 1; round <= 100 && ok; round++)
+    {
+      size_t n = round % (size + 8);
+      parallel_pool_for(pool, n, count_items, counts);
+      for (size_t i = 0; i < size + 8 && ok; i++)
+	{
+	  ok = counts[i] == (i < n ? 1 : 0);
+	  counts[i] = 0;
+	}
+    }
+  parallel_pool_destroy(pool);
+
+  // output formatted into in-memory buffers and appended in order is
+  // the same as output formatted directly
+  FILE *direct_file = tmpfile();
+  FILE *parts_file = tmpfile();
+  outbuf *direct = direct_file != NULL ? outbuf_create(direct_file, 64) : NULL;
+  outbuf *parts = parts_file != NULL ? outbuf_create(parts_file, 64) : NULL;
+  outbuf *part = outbuf_create(NULL, 64);
+  ok = ok && direct != NULL && parts != NULL && part != NULL;
+  for (size_t i = 0; i < size * 100 && ok; i++)
+    {
+      double v = (double)i / (size + 1);
+      outbuf_double(direct, v);
+      outbuf_char(direct, ' ');
+      outbuf_double(part, v);
+      outbuf_char(part, ' ');
+      if (i % 7 == 0)
+	{
+	  outbuf_append(parts, part);
+	}
+    }
+  if (ok)
+    {
+      outbuf_append(parts, part);
+      ok = outbuf_flush(direct) && outbuf_flush(parts) && outbuf_flush(part);
+    }
+  if (ok)
+    {
+      long len = ftell(direct_file);
+      ok = len == ftell(parts_file);
+      rewind(direct_file);
+      rewind(parts_file);
+      for (long i = 0; i < len && ok; i++)
+	{
+	  ok = fgetc(direct_file) == fgetc(parts_file);
+	}
+    }
+  if (direct != NULL)
+    {
+      outbuf_destroy(direct);
+    }
+  if (parts != NULL)
+    {
+      outbuf_destroy(parts);
+    }
+  if (part != NULL)
+    {
+      outbuf_destroy(part);
+    }
+  if (direct_file != NULL)
+    {
+      fclose(direct_file);
+    }
+  if (parts_file != NULL)
+    {
+      fclose(parts_file);
+    }
+  free(counts);
+
+  if (!ok)
+    {
+      PRINT_FAILED;
+    }
+  else
+    {
+      PRINT_PASSED;
+    }
+}
@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "inbuf.h"
+
+// the size of each read when the input cannot be mapped
+#define INBUF_BLOCK (1 << 20)
+
+struct inbuf
+{
+  FILE *stream;
+  char *map;      // the whole file, when it is mapped
+  size_t map_len;
+  char *data;     // the mapping, or the buffer for stream input
+  size_t cap;     // size of the buffer
+  size_t start;   // the unread characters are [start, end) of data
+  size_t end;
+  bool mapped;
+  bool eof;       // nothing more will come into the buffer
+  bool error;
+};
+
+/**
+ * Moves the unread characters to the front of the buffer and reads more
+ * after them, growing the buffer if it is full.
+ *
+ * @return false if nothing more could be read
+ */
+bool inbuf_refill(inbuf *b);
+
+inbuf *inbuf_open(FILE *stream)
+{
+  inbuf *b = malloc(sizeof(inbuf));
+  if (b == NULL) {
+    return NULL;
+  }
+  b->stream = stream;
+  b->map = NULL;
+  b->map_len = 0;
+  b->data = NULL;
+  b->cap = 0;
+  b->start = 0;
+  b->end = 0;
+  b->mapped = false;
+  b->eof = false;
+  b->error = false;
+
+  // a regular file is mapped from the stream's position on; anything
+  // else, or a file that cannot be mapped, is read in blocks
+  struct stat st;
+  off_t offset = ftello(stream);
+  if (fstat(fileno(stream), &st) == 0 && S_ISREG(st.st_mode) && offset >= 0 && st.st_size > offset
+      && (unsigned long long)st.st_size <= SIZE_MAX) {
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+    if (map != MAP_FAILED) {
+      posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+      b->map = map;
+      b->map_len = st.st_size;
+      b->data = map;
+      b->start = offset;
+      b->end = st.st_size;
+      b->mapped = true;
+      b->eof = true;
+      return b;
+    }
+  }
+
+  b->cap = INBUF_BLOCK;
+  b->data = malloc(b->cap);
+  if (b->data == NULL) {
+    free(b);
+    return NULL;
+  }
+  return b;
+}
+
+bool inbuf_refill(inbuf *b)
+{
+  if (b->eof) {
+    return false;
+  }
+  if (b->start > 0) {
+    memmove(b->data, b->data + b->start, b->end - b->start);
+    b->end -= b->start;
+    b->start = 0;
+  }
+  if (b->end == b->cap) {
+    char *bigger = realloc(b->data, b->cap * 2);
+    if (bigger == NULL) {
+      b->error = true;
+      b->eof = true;
+      return false;
+    }
+    b->data = bigger;
+    b->cap *= 2;
+  }
+
+  size_t got = fread(b->data + b->end, 1, b->cap - b->end, b->stream);
+  b->end += got;
+  if (got == 0) {
+    b->eof = true;
+    b->error = ferror(b->stream) != 0;
+  }
+  return got > 0;
+}
+
+const char *inbuf_line(inbuf *b, size_t *len)
+{
+  // characters already searched for a newline are not searched again
+  // after a refill
+  size_t searched = 0;
+  while (true) {
+    char *line = b->data + b->start;
+    char *newline = memchr(line + searched, '\n', b->end - b->start - searched);
+    if (newline != NULL) {
+      *len = newline - line;
+      b->start += *len + 1;
+      return line;
+    }
+    searched = b->end - b->start;
+    if (!inbuf_refill(b)) {
+      if (b->start == b->end || b->error) {
+        return NULL;
+      }
+      *len = b->end - b->start;
+      b->start = b->end;
+      return b->data + b->end - *len;
+    }
+  }
+}
+
+const char *inbuf_lines(inbuf *b, size_t *len)
+{
+  size_t searched = 0;
+  while (true) {
+    // the last newline ends the block; a line longer than what has been
+    // read so far needs more input first
+    const char *data = b->data + b->start;
+    size_t n = b->end - b->start;
+    while (n > searched && data[n - 1] != '\n') {
+      n--;
+    }
+    if (n > searched) {
+      *len = n;
+      b->start += n;
+      return data;
+    }
+    searched = b->end - b->start;
+    if (!inbuf_refill(b)) {
+      if (b->start == b->end || b->error) {
+        return NULL;
+      }
+      *len = b->end - b->start;
+      b->start = b->end;
+      return b->data + b->end - *len;
+    }
+  }
+}
+
+size_t inbuf_chunk(inbuf *b, const char **data)
+{
+  if (b->start == b->end && !inbuf_refill(b)) {
+    return 0;
+  }
+  *data = b->data + b->start;
+  size_t n = b->end - b->start;
+  b->start = b->end;
+  return n;
+}
+
+bool inbuf_error(const inbuf *b)
+{
+  return b->error;
+}
+
+bool inbuf_mapped(const inbuf *b)
+{
+  return b->mapped;
+}
+
+void inbuf_close(inbuf *b)
+{
+  if (b == NULL) {
+    return;
+  }
+  if (b->mapped) {
+    munmap(b->map, b->map_len);
+  }
+  else {
+    free(b->data);
+  }
+  free(b);
+}
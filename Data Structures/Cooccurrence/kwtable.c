@@ -0,0 +1,477 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "kwtable.h"
+
+#define KWTABLE_EMPTY UINT32_MAX
+#define KWTABLE_KEYS_PER_BUCKET 4
+#define KWTABLE_MAX_DISPLACEMENT (1 << 16)
+#define KWTABLE_DISPLACEMENT_STEP 0x9E3779B97F4A7C15ULL
+
+// keywords added after the table was compiled go in an ordinary hash
+// table until there are this many or as many as were compiled, whichever
+// is more, and then everything is compiled again
+#define KWTABLE_MIN_ADDED 64
+
+typedef struct kw_slot
+{
+  uint64_t hash;
+  uint32_t index;
+  uint32_t length;
+} kw_slot;
+
+struct kwtable
+{
+  size_t n;
+  size_t capacity;    // of words
+  char **words;
+  size_t word_bytes;  // total size of the copies of the keywords
+  kw_slot *slots;
+  size_t slot_mask;   // number of slots - 1
+  uint32_t *disp;     // displacement chosen for each bucket
+  size_t bucket_mask; // number of buckets - 1
+  size_t built;       // keywords [0, built) are in the perfect hash
+  kw_slot *added;     // the rest, by linear probing
+  size_t added_mask;  // number of slots for them - 1
+  size_t min_len;
+  size_t max_len;
+  double build_time;
+};
+
+/**
+ * Computes the 64-bit FNV-1a hash of the given slice.
+ */
+uint64_t kw_hash(const char *s, size_t len);
+
+/**
+ * Scrambles the bits of the given value (the splitmix64 finalizer).
+ */
+uint64_t kw_mix(uint64_t x);
+
+/**
+ * Compiles the perfect hash for all the keywords in the given table,
+ * replacing the one there and emptying the added keywords.
+ *
+ * @return false if the keywords are not distinct or there was an
+ * allocation error, in which case the table is unchanged
+ */
+bool kw_build(kwtable *t);
+
+/**
+ * Puts the keyword with the given index in the table of added keywords,
+ * which must have a free slot.
+ */
+void kw_insert_added(kwtable *t, size_t i);
+
+/**
+ * Tries to place every keyword in a table with the given number of
+ * slots.  Returns false if some bucket could not be displaced into free
+ * slots, in which case the caller should retry with a bigger table.
+ */
+bool kw_place(kwtable *t, const uint64_t *hashes, const size_t *lengths, const size_t *order, const size_t *start, const size_t *member);
+
+size_t kw_next_pow2(size_t x);
+
+double kw_now();
+
+kwtable *kwtable_create(char * const *words, size_t n)
+{
+  double began = kw_now();
+
+  kwtable *t = malloc(sizeof(kwtable));
+  if (t == NULL) {
+    return NULL;
+  }
+  t->n = 0;
+  t->capacity = n > 0 ? n : 1;
+  t->words = malloc(sizeof(char *) * t->capacity);
+  t->word_bytes = 0;
+  t->slots = NULL;
+  t->slot_mask = 0;
+  t->disp = NULL;
+  t->bucket_mask = 0;
+  t->built = 0;
+  t->added = NULL;
+  t->added_mask = 0;
+  t->min_len = SIZE_MAX;
+  t->max_len = 0;
+  t->build_time = 0.0;
+  if (t->words == NULL) {
+    free(t);
+    return NULL;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    size_t len = strlen(words[i]);
+    t->words[i] = malloc(len + 1);
+    if (t->words[i] == NULL || len >= KWTABLE_EMPTY) {
+      free(t->words[i]);
+      kwtable_destroy(t);
+      return NULL;
+    }
+    memcpy(t->words[i], words[i], len + 1);
+    t->n++;
+    t->word_bytes += len + 1;
+    if (len < t->min_len) {
+      t->min_len = len;
+    }
+    if (len > t->max_len) {
+      t->max_len = len;
+    }
+  }
+
+  // also rejects duplicate keywords
+  if (!kw_build(t)) {
+    kwtable_destroy(t);
+    return NULL;
+  }
+
+  t->build_time = kw_now() - began;
+  return t;
+}
+
+bool kw_build(kwtable *t)
+{
+  size_t n = t->n;
+  kwtable next = *t;
+  next.bucket_mask = kw_next_pow2((n + KWTABLE_KEYS_PER_BUCKET - 1) / KWTABLE_KEYS_PER_BUCKET) - 1;
+  next.slot_mask = kw_next_pow2(2 * n) - 1;
+  next.disp = calloc(next.bucket_mask + 1, sizeof(uint32_t));
+  next.slots = NULL;
+  next.added = NULL;
+  next.added_mask = 0;
+
+  uint64_t *hashes = malloc(sizeof(uint64_t) * (n > 0 ? n : 1));
+  size_t *lengths = malloc(sizeof(size_t) * (n > 0 ? n : 1));
+  size_t *start = calloc(next.bucket_mask + 2, sizeof(size_t));
+  size_t *member = malloc(sizeof(size_t) * (n > 0 ? n : 1));
+  size_t *order = malloc(sizeof(size_t) * (next.bucket_mask + 1));
+  size_t *fill = calloc(next.bucket_mask + 1, sizeof(size_t));
+  size_t *by_size = calloc(n + 2, sizeof(size_t));
+  bool ok = next.disp != NULL && hashes != NULL && lengths != NULL
+    && start != NULL && member != NULL && order != NULL && fill != NULL && by_size != NULL;
+
+  if (ok) {
+    for (size_t i = 0; i < n; i++) {
+      lengths[i] = strlen(t->words[i]);
+      hashes[i] = kw_hash(t->words[i], lengths[i]);
+      start[((hashes[i] >> 32) & next.bucket_mask) + 1]++;
+    }
+
+    // group the keywords by bucket
+    for (size_t b = 0; b <= next.bucket_mask; b++) {
+      start[b + 1] += start[b];
+    }
+    for (size_t i = 0; i < n; i++) {
+      size_t b = (hashes[i] >> 32) & next.bucket_mask;
+      member[start[b] + fill[b]++] = i;
+    }
+
+    // identical keywords hash identically, so they always share a bucket
+    for (size_t b = 0; b <= next.bucket_mask && ok; b++) {
+      for (size_t x = start[b]; x < start[b + 1] && ok; x++) {
+        for (size_t y = x + 1; y < start[b + 1]; y++) {
+          if (hashes[member[x]] == hashes[member[y]] && strcmp(t->words[member[x]], t->words[member[y]]) == 0) {
+            ok = false;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  if (ok) {
+    // place the biggest buckets first while the table is still empty
+    for (size_t b = 0; b <= next.bucket_mask; b++) {
+      by_size[start[b + 1] - start[b]]++;
+    }
+    size_t pos = 0;
+    for (size_t s = n + 1; s-- > 0; ) {
+      size_t count = by_size[s];
+      by_size[s] = pos;
+      pos += count;
+    }
+    for (size_t b = 0; b <= next.bucket_mask; b++) {
+      order[by_size[start[b + 1] - start[b]]++] = b;
+    }
+
+    while (ok) {
+      free(next.slots);
+      next.slots = malloc(sizeof(kw_slot) * (next.slot_mask + 1));
+      if (next.slots == NULL) {
+        ok = false;
+      }
+      else if (kw_place(&next, hashes, lengths, order, start, member)) {
+        break;
+      }
+      else if (next.slot_mask < 64 * (n + 1)) {
+        next.slot_mask = next.slot_mask * 2 + 1;
+      }
+      else {
+        // only distinct keywords with identical 64-bit hashes get here
+        ok = false;
+      }
+    }
+  }
+
+  free(hashes);
+  free(lengths);
+  free(start);
+  free(member);
+  free(order);
+  free(fill);
+  free(by_size);
+
+  if (!ok) {
+    free(next.disp);
+    free(next.slots);
+    return false;
+  }
+
+  next.built = n;
+  free(t->disp);
+  free(t->slots);
+  free(t->added);
+  *t = next;
+  return true;
+}
+
+long kwtable_add(kwtable *t, const char *word)
+{
+  double began = kw_now();
+  size_t len = strlen(word);
+  if (len >= KWTABLE_EMPTY || t->n >= KWTABLE_EMPTY - 1 || kwtable_find(t, word, len) >= 0) {
+    return -1;
+  }
+
+  if (t->n == t->capacity) {
+    char **words = realloc(t->words, sizeof(char *) * t->capacity * 2);
+    if (words == NULL) {
+      return -1;
+    }
+    t->words = words;
+    t->capacity *= 2;
+  }
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    return -1;
+  }
+  memcpy(copy, word, len + 1);
+
+  // keep the added keywords' table at most half full
+  size_t added = t->n - t->built + 1;
+  if (t->added == NULL || 2 * added > t->added_mask + 1) {
+    kw_slot *old = t->added;
+    size_t old_slots = old == NULL ? 0 : t->added_mask + 1;
+    size_t slots = old == NULL ? 2 * KWTABLE_MIN_ADDED : 2 * old_slots;
+    kw_slot *bigger = malloc(sizeof(kw_slot) * slots);
+    if (bigger == NULL) {
+      free(copy);
+      return -1;
+    }
+    t->added = bigger;
+    t->added_mask = slots - 1;
+    for (size_t s = 0; s < slots; s++) {
+      t->added[s].index = KWTABLE_EMPTY;
+    }
+    for (size_t s = 0; s < old_slots; s++) {
+      if (old[s].index != KWTABLE_EMPTY) {
+        kw_insert_added(t, old[s].index);
+      }
+    }
+    free(old);
+  }
+
+  size_t i = t->n++;
+  t->words[i] = copy;
+  t->word_bytes += len + 1;
+  if (len < t->min_len) {
+    t->min_len = len;
+  }
+  if (len > t->max_len) {
+    t->max_len = len;
+  }
+  kw_insert_added(t, i);
+
+  // recompiling costs O(n), so doing it only once the added keywords
+  // are as many as the compiled ones keeps the cost O(1) per keyword; if
+  // it fails the added keywords are still found, just more slowly
+  size_t limit = t->built > KWTABLE_MIN_ADDED ? t->built : KWTABLE_MIN_ADDED;
+  if (t->n - t->built >= limit) {
+    kw_build(t);
+  }
+
+  t->build_time += kw_now() - began;
+  return i;
+}
+
+void kw_insert_added(kwtable *t, size_t i)
+{
+  size_t len = strlen(t->words[i]);
+  uint64_t h = kw_hash(t->words[i], len);
+  size_t s = h & t->added_mask;
+  while (t->added[s].index != KWTABLE_EMPTY) {
+    s = (s + 1) & t->added_mask;
+  }
+  t->added[s].hash = h;
+  t->added[s].index = i;
+  t->added[s].length = len;
+}
+
+bool kw_place(kwtable *t, const uint64_t *hashes, const size_t *lengths, const size_t *order, const size_t *start, const size_t *member)
+{
+  for (size_t s = 0; s <= t->slot_mask; s++) {
+    t->slots[s].hash = 0;
+    t->slots[s].index = KWTABLE_EMPTY;
+    t->slots[s].length = 0;
+  }
+
+  for (size_t o = 0; o <= t->bucket_mask; o++) {
+    size_t b = order[o];
+    if (start[b] == start[b + 1]) {
+      // buckets are in decreasing order of size so the rest are empty
+      break;
+    }
+
+    bool placed = false;
+    for (uint32_t d = 0; d < KWTABLE_MAX_DISPLACEMENT && !placed; d++) {
+      size_t x = start[b];
+      while (x < start[b + 1]) {
+        size_t k = member[x];
+        size_t s = kw_mix(hashes[k] + d * KWTABLE_DISPLACEMENT_STEP) & t->slot_mask;
+        if (t->slots[s].index != KWTABLE_EMPTY) {
+          break;
+        }
+        t->slots[s].hash = hashes[k];
+        t->slots[s].index = k;
+        t->slots[s].length = lengths[k];
+        x++;
+      }
+
+      if (x == start[b + 1]) {
+        t->disp[b] = d;
+        placed = true;
+      }
+      else {
+        // undo the partial placement of this bucket
+        for (size_t y = start[b]; y < x; y++) {
+          size_t s = kw_mix(hashes[member[y]] + d * KWTABLE_DISPLACEMENT_STEP) & t->slot_mask;
+          t->slots[s].index = KWTABLE_EMPTY;
+        }
+      }
+    }
+
+    if (!placed) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+long kwtable_find(const kwtable *t, const char *word, size_t len)
+{
+  if (len < t->min_len || len > t->max_len) {
+    return -1;
+  }
+
+  uint64_t h = kw_hash(word, len);
+  uint32_t d = t->disp[(h >> 32) & t->bucket_mask];
+  const kw_slot *slot = &t->slots[kw_mix(h + d * KWTABLE_DISPLACEMENT_STEP) & t->slot_mask];
+  if (slot->index != KWTABLE_EMPTY && slot->hash == h && slot->length == len
+      && memcmp(t->words[slot->index], word, len) == 0) {
+    return slot->index;
+  }
+
+  if (t->n > t->built) {
+    for (size_t s = h & t->added_mask; t->added[s].index != KWTABLE_EMPTY; s = (s + 1) & t->added_mask) {
+      slot = &t->added[s];
+      if (slot->hash == h && slot->length == len && memcmp(t->words[slot->index], word, len) == 0) {
+        return slot->index;
+      }
+    }
+  }
+  return -1;
+}
+
+size_t kwtable_size(const kwtable *t)
+{
+  return t->n;
+}
+
+const char *kwtable_word(const kwtable *t, size_t i)
+{
+  return t->words[i];
+}
+
+size_t kwtable_max_length(const kwtable *t)
+{
+  return t->max_len;
+}
+
+double kwtable_build_time(const kwtable *t)
+{
+  return t->build_time;
+}
+
+size_t kwtable_memory(const kwtable *t)
+{
+  return sizeof(kwtable) + sizeof(char *) * t->capacity + t->word_bytes
+    + sizeof(kw_slot) * (t->slot_mask + 1) + sizeof(uint32_t) * (t->bucket_mask + 1)
+    + (t->added == NULL ? 0 : sizeof(kw_slot) * (t->added_mask + 1));
+}
+
+void kwtable_destroy(kwtable *t)
+{
+  if (t != NULL) {
+    for (size_t i = 0; i < t->n; i++) {
+      free(t->words[i]);
+    }
+    free(t->words);
+    free(t->slots);
+    free(t->disp);
+    free(t->added);
+    free(t);
+  }
+}
+
+uint64_t kw_hash(const char *s, size_t len)
+{
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    h ^= (unsigned char)s[i];
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+
+uint64_t kw_mix(uint64_t x)
+{
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  x ^= x >> 31;
+  return x;
+}
+
+size_t kw_next_pow2(size_t x)
+{
+  size_t p = 1;
+  while (p < x) {
+    p *= 2;
+  }
+  return p;
+}
+
+double kw_now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
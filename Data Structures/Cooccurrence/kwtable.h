@@ -0,0 +1,102 @@
+#ifndef __KWTABLE_H__
+#define __KWTABLE_H__
+
+#include <stdlib.h>
+
+struct kwtable;
+typedef struct kwtable kwtable;
+
+/**
+ * Compiles the given keywords into a static lookup table.  The table is
+ * a perfect hash (hash and displace): every keyword has its own slot, so
+ * a lookup is one hash, one slot probe and one verification compare, and
+ * most non-keywords are rejected by their length or by the hash stored
+ * in the slot without touching the keyword text.  The table keeps its
+ * own copies of the keywords.
+ *
+ * @param words an array of non-NULL strings, non-NULL
+ * @param n the size of that array
+ * @return a pointer to the new table, or NULL if the keywords are not
+ * distinct or there was an allocation error; it is the caller's
+ * responsibility to destroy the table
+ */
+kwtable *kwtable_create(char * const *words, size_t n);
+
+/**
+ * Returns the index of the given word in the given table.  The word is
+ * given as a slice and need not be NUL-terminated.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @param word a pointer to the first character of the word
+ * @param len the length of the word
+ * @return the position of the word in the array passed to kwtable_create,
+ * or -1 if it is not a keyword
+ */
+long kwtable_find(const kwtable *t, const char *word, size_t len);
+
+/**
+ * Adds a keyword to the given table.  It is found by kwtable_find at
+ * once, through a small ordinary hash table; once as many keywords have
+ * been added as were compiled, the whole table is compiled again, so
+ * adding costs amortized O(1) per keyword.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @param word a string, non-NULL
+ * @return the index of the new keyword, which is the number of keywords
+ * the table had before, or -1 if the word is already a keyword or there
+ * was an allocation error
+ */
+long kwtable_add(kwtable *t, const char *word);
+
+/**
+ * Returns the number of keywords in the given table.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @return the number of keywords
+ */
+size_t kwtable_size(const kwtable *t);
+
+/**
+ * Returns the keyword with the given index.  The table retains
+ * ownership of the string.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @param i an index less than kwtable_size(t)
+ * @return the keyword
+ */
+const char *kwtable_word(const kwtable *t, size_t i);
+
+/**
+ * Returns the length of the longest keyword in the given table.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @return the length of the longest keyword
+ */
+size_t kwtable_max_length(const kwtable *t);
+
+/**
+ * Returns the wall-clock time, in seconds, that kwtable_create and
+ * kwtable_add have taken to compile the given table.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @return the build time in seconds
+ */
+double kwtable_build_time(const kwtable *t);
+
+/**
+ * Returns the number of bytes allocated for the given table, including
+ * the copies of the keywords.
+ *
+ * @param t a pointer to a table, non-NULL
+ * @return the size of the table in bytes
+ */
+size_t kwtable_memory(const kwtable *t);
+
+/**
+ * Destroys the given table.
+ *
+ * @param t a pointer to a table
+ */
+void kwtable_destroy(kwtable *t);
+
+#endif
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "outbuf.h"
+
+// values below this are formatted without snprintf: scaled by 10^6 they
+// are below 2^40, so the scaled product is within 2^-13 of the true value
+#define OUTBUF_FAST_LIMIT 1e6
+
+// how close the scaled value may come to a rounding tie before the exact
+// (snprintf) formatting is used instead
+#define OUTBUF_TIE_MARGIN 1e-3
+
+struct outbuf
+{
+  FILE *stream;
+  char *data;
+  size_t used;
+  size_t capacity;
+  bool ok;
+};
+
+/**
+ * Makes room for at least n more bytes if the buffer can hold that many,
+ * writing out what is already there if needed.  An in-memory buffer
+ * grows instead; if it cannot, its contents are dropped and the error
+ * is reported by outbuf_flush.
+ */
+void outbuf_reserve(outbuf *b, size_t n);
+
+outbuf *outbuf_create(FILE *stream, size_t capacity)
+{
+  outbuf *b = malloc(sizeof(outbuf));
+  if (b == NULL) {
+    return NULL;
+  }
+  b->capacity = capacity < 64 ? 64 : capacity;
+  b->data = malloc(b->capacity);
+  if (b->data == NULL) {
+    free(b);
+    return NULL;
+  }
+  b->stream = stream;
+  b->used = 0;
+  b->ok = true;
+  return b;
+}
+
+void outbuf_reserve(outbuf *b, size_t n)
+{
+  if (b->stream == NULL) {
+    if (b->capacity - b->used < n) {
+      size_t capacity = b->capacity * 2 > b->used + n ? b->capacity * 2 : b->used + n;
+      char *bigger = realloc(b->data, capacity);
+      if (bigger == NULL) {
+        b->ok = false;
+        b->used = 0;
+        return;
+      }
+      b->data = bigger;
+      b->capacity = capacity;
+    }
+    return;
+  }
+  if (b->capacity - b->used < n && b->used > 0) {
+    if (fwrite(b->data, 1, b->used, b->stream) != b->used) {
+      b->ok = false;
+    }
+    b->used = 0;
+  }
+}
+
+void outbuf_write(outbuf *b, const void *p, size_t n)
+{
+  outbuf_reserve(b, n);
+  if (n > b->capacity - b->used) {
+    // too big to buffer, or an in-memory buffer that could not grow
+    if (b->stream == NULL || fwrite(p, 1, n, b->stream) != n) {
+      b->ok = false;
+    }
+  }
+  else {
+    memcpy(b->data + b->used, p, n);
+    b->used += n;
+  }
+}
+
+void outbuf_string(outbuf *b, const char *s)
+{
+  outbuf_write(b, s, strlen(s));
+}
+
+void outbuf_char(outbuf *b, char c)
+{
+  outbuf_reserve(b, 1);
+  b->data[b->used++] = c;
+}
+
+void outbuf_double(outbuf *b, double v)
+{
+  outbuf_reserve(b, 32);
+  size_t len = outbuf_format_double(b->data + b->used, b->capacity - b->used, v);
+  if (len < b->capacity - b->used) {
+    b->used += len;
+  }
+  else {
+    // only huge values get here
+    char *text = malloc(len + 1);
+    if (text == NULL) {
+      b->ok = false;
+      return;
+    }
+    outbuf_format_double(text, len + 1, v);
+    outbuf_write(b, text, len);
+    free(text);
+  }
+}
+
+void outbuf_le(outbuf *b, uint64_t v, size_t bytes)
+{
+  outbuf_reserve(b, bytes);
+  for (size_t i = 0; i < bytes; i++) {
+    b->data[b->used++] = (v >> (8 * i)) & 0xff;
+  }
+}
+
+void outbuf_f64(outbuf *b, double v)
+{
+  uint64_t bits;
+  memcpy(&bits, &v, sizeof(bits));
+  outbuf_le(b, bits, 8);
+}
+
+void outbuf_append(outbuf *b, outbuf *from)
+{
+  outbuf_write(b, from->data, from->used);
+  if (!from->ok) {
+    b->ok = false;
+  }
+  from->used = 0;
+}
+
+bool outbuf_flush(outbuf *b)
+{
+  if (b->stream == NULL) {
+    return b->ok;
+  }
+  if (b->used > 0 && fwrite(b->data, 1, b->used, b->stream) != b->used) {
+    b->ok = false;
+  }
+  b->used = 0;
+  if (fflush(b->stream) != 0) {
+    b->ok = false;
+  }
+  return b->ok;
+}
+
+bool outbuf_destroy(outbuf *b)
+{
+  bool ok = outbuf_flush(b);
+  free(b->data);
+  free(b);
+  return ok;
+}
+
+size_t outbuf_format_double(char *dst, size_t size, double v)
+{
+  double a = fabs(v);
+  if (!(a < OUTBUF_FAST_LIMIT) || size < 32) {
+    return snprintf(dst, size, "%f", v);
+  }
+
+  // printf rounds the exact value of v, so a scaled value near a tie
+  // could round either way depending on the error in the product
+  double scaled = a * 1e6;
+  double whole = floor(scaled);
+  double frac = scaled - whole;
+  if (fabs(frac - 0.5) < OUTBUF_TIE_MARGIN) {
+    return snprintf(dst, size, "%f", v);
+  }
+  uint64_t r = (uint64_t)whole + (frac > 0.5);
+
+  char digits[24];
+  size_t n = 0;
+  uint64_t units = r / 1000000;
+  uint32_t micros = r % 1000000;
+  do {
+    digits[n++] = '0' + units % 10;
+    units /= 10;
+  } while (units > 0);
+
+  size_t len = 0;
+  if (signbit(v)) {
+    dst[len++] = '-';
+  }
+  while (n > 0) {
+    dst[len++] = digits[--n];
+  }
+  dst[len++] = '.';
+  for (int i = 5; i >= 0; i--) {
+    dst[len + i] = '0' + micros % 10;
+    micros /= 10;
+  }
+  len += 6;
+  dst[len] = '\0';
+  return len;
+}
@@ -0,0 +1,118 @@
+#ifndef __OUTBUF_H__
+#define __OUTBUF_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+struct outbuf;
+typedef struct outbuf outbuf;
+
+/**
+ * Creates a buffer that collects output for the given stream and writes
+ * it in large blocks, so that printing a big matrix costs a few writes
+ * instead of a stdio call per number.  A buffer for a NULL stream keeps
+ * its output in memory, growing as needed, until it is appended to
+ * another buffer with outbuf_append; threads can format output into
+ * buffers of their own that way and have it written in order.
+ *
+ * @param stream a stream, or NULL to keep the output in memory
+ * @param capacity the size of the buffer in bytes, at least 64
+ * @return a pointer to the buffer, or NULL if there was an allocation
+ * error; it is the caller's responsibility to destroy the buffer
+ */
+outbuf *outbuf_create(FILE *stream, size_t capacity);
+
+/**
+ * Appends the given bytes to the given buffer.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param p a pointer to n bytes
+ * @param n the number of bytes
+ */
+void outbuf_write(outbuf *b, const void *p, size_t n);
+
+/**
+ * Appends the given string, without its terminating NUL.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param s a string, non-NULL
+ */
+void outbuf_string(outbuf *b, const char *s);
+
+/**
+ * Appends the given character.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param c a character
+ */
+void outbuf_char(outbuf *b, char c);
+
+/**
+ * Appends the given value formatted exactly as printf("%f") would.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param v a double
+ */
+void outbuf_double(outbuf *b, double v);
+
+/**
+ * Appends the low bytes of the given value, least significant first.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param v a value
+ * @param bytes the number of bytes to write, at most 8
+ */
+void outbuf_le(outbuf *b, uint64_t v, size_t bytes);
+
+/**
+ * Appends the bits of the given double, least significant byte first.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param v a double
+ */
+void outbuf_f64(outbuf *b, double v);
+
+/**
+ * Appends the output kept by the given in-memory buffer to another
+ * buffer and empties the in-memory one.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @param from a pointer to a buffer created for a NULL stream, non-NULL
+ */
+void outbuf_append(outbuf *b, outbuf *from);
+
+/**
+ * Writes everything in the given buffer to its stream and flushes the
+ * stream.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @return false if there has been a write error since the buffer was
+ * created
+ */
+bool outbuf_flush(outbuf *b);
+
+/**
+ * Flushes and destroys the given buffer.
+ *
+ * @param b a pointer to a buffer, non-NULL
+ * @return false if there has been a write error since the buffer was
+ * created
+ */
+bool outbuf_destroy(outbuf *b);
+
+/**
+ * Formats the given value as snprintf(dst, size, "%f", v) would, without
+ * calling snprintf for values that are not too large and not too close to
+ * halfway between two outputs.
+ *
+ * @param dst an array of size chars
+ * @param size the size of that array
+ * @param v a double
+ * @return the length of the formatted value, which was only written if
+ * it is less than size
+ */
+size_t outbuf_format_double(char *dst, size_t size, double v);
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <stdlib.h>
+
+struct parallel_pool;
+typedef struct parallel_pool parallel_pool;
+
+/**
+ * Splits [0, n) into consecutive blocks, one per thread, and calls
+ * body(begin, end, arg) for each block, using the calling thread for one
+ * of them.  Returns once every block is done.  If a thread cannot be
+ * started its block is done on the calling thread instead.
+ *
+ * @param n the number of items
+ * @param threads the number of threads to use, at least 1
+ * @param body a pointer to the function that does the items in
+ * [begin, end), which must be safe to call concurrently on disjoint blocks
+ * @param arg an argument passed to every call to body
+ */
+void parallel_for(size_t n, size_t threads, void (*body)(size_t begin, size_t end, void *arg), void *arg);
+
+/**
+ * Creates a pool of threads that wait for work from parallel_pool_for,
+ * so that a caller that runs many short parallel loops starts its
+ * threads once instead of once per loop.  If some of the threads cannot
+ * be started the pool has fewer.
+ *
+ * @param threads the number of threads to use, counting the calling
+ * thread, at least 1
+ * @return a pointer to the new pool, or NULL if there was an allocation
+ * error; it is the caller's responsibility to destroy the pool
+ */
+parallel_pool *parallel_pool_create(size_t threads);
+
+/**
+ * Does the same as parallel_for, but on the threads of the given pool,
+ * using the calling thread for one of the blocks.  Only one call may use
+ * a pool at a time.
+ *
+ * @param pool a pointer to a pool, non-NULL
+ * @param n the number of items
+ * @param body a pointer to the function that does the items in
+ * [begin, end), which must be safe to call concurrently on disjoint blocks
+ * @param arg an argument passed to every call to body
+ */
+void parallel_pool_for(parallel_pool *pool, size_t n, void (*body)(size_t begin, size_t end, void *arg), void *arg);
+
+/**
+ * Returns the number of threads of the given pool, counting the thread
+ * that calls parallel_pool_for.
+ *
+ * @param pool a pointer to a pool, non-NULL
+ * @return the number of threads
+ */
+size_t parallel_pool_size(const parallel_pool *pool);
+
+/**
+ * Stops the threads of the given pool and destroys it.
+ *
+ * @param pool a pointer to a pool
+ */
+void parallel_pool_destroy(parallel_pool *pool);
+
+/**
+ * Returns the number of processors that are online, or 1 if that cannot
+ * be determined.
+ *
+ * @return the number of processors
+ */
+size_t parallel_processors();
+
+#endif
@@ -0,0 +1,126 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "vecops.h"
+
+/**
+ * Determines if the value at position a ranks ahead of the value at
+ * position b: larger values first, then lower positions.
+ */
+bool vec_ahead(const double *v, size_t a, size_t b);
+
+/**
+ * Restores the heap order below the given position of a heap whose
+ * root is the entry that ranks last.
+ */
+void vec_sift_down(const double *v, size_t *heap, size_t size, size_t i);
+
+void vec_divide(double *out, const double *in, double divisor, size_t n)
+{
+  size_t i = 0;
+#if defined(__AVX2__)
+  __m256d d4 = _mm256_set1_pd(divisor);
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(out + i, _mm256_div_pd(_mm256_loadu_pd(in + i), d4));
+  }
+#elif defined(__SSE2__)
+  __m128d d2 = _mm_set1_pd(divisor);
+  for (; i + 2 <= n; i += 2) {
+    _mm_storeu_pd(out + i, _mm_div_pd(_mm_loadu_pd(in + i), d2));
+  }
+#endif
+  for (; i < n; i++) {
+    out[i] = in[i] / divisor;
+  }
+}
+
+double vec_dot(const double *a, const double *b, size_t n)
+{
+  size_t i = 0;
+  double sum = 0.0;
+#if defined(__AVX2__)
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  for (; i + 8 <= n; i += 8) {
+    acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4)));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#elif defined(__SSE2__)
+  __m128d acc0 = _mm_setzero_pd();
+  __m128d acc1 = _mm_setzero_pd();
+  for (; i + 4 <= n; i += 4) {
+    acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(a + i + 2), _mm_loadu_pd(b + i + 2)));
+  }
+  double lanes[2];
+  _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+  sum = lanes[0] + lanes[1];
+#endif
+  for (; i < n; i++) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+size_t vec_top_k(const double *v, size_t n, size_t k, size_t skip, size_t *top)
+{
+  // top is used as a heap whose root is the selected value that ranks last
+  size_t size = 0;
+  for (size_t i = 0; i < n && k > 0; i++) {
+    if (i == skip) {
+      continue;
+    }
+    if (size < k) {
+      // sift up
+      size_t c = size++;
+      while (c > 0 && vec_ahead(v, top[(c - 1) / 2], i)) {
+        top[c] = top[(c - 1) / 2];
+        c = (c - 1) / 2;
+      }
+      top[c] = i;
+    }
+    else if (vec_ahead(v, i, top[0])) {
+      top[0] = i;
+      vec_sift_down(v, top, size, 0);
+    }
+  }
+
+  // repeatedly move the last-ranked entry to the end
+  for (size_t end = size; end > 1; end--) {
+    size_t last = top[0];
+    top[0] = top[end - 1];
+    top[end - 1] = last;
+    vec_sift_down(v, top, end - 1, 0);
+  }
+
+  return size;
+}
+
+bool vec_ahead(const double *v, size_t a, size_t b)
+{
+  return v[a] > v[b] || (v[a] == v[b] && a < b);
+}
+
+void vec_sift_down(const double *v, size_t *heap, size_t size, size_t i)
+{
+  size_t item = heap[i];
+  while (2 * i + 1 < size) {
+    size_t c = 2 * i + 1;
+    if (c + 1 < size && vec_ahead(v, heap[c], heap[c + 1])) {
+      c++;
+    }
+    if (!vec_ahead(v, item, heap[c])) {
+      break;
+    }
+    heap[i] = heap[c];
+    i = c;
+  }
+  heap[i] = item;
+}
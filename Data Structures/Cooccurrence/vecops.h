@@ -0,0 +1,50 @@
+#ifndef __VECOPS_H__
+#define __VECOPS_H__
+
+#include <stdlib.h>
+
+/**
+ * Kernels for the dense rows of a cooccurrence matrix.  Each one has an
+ * AVX2 version (built when the compiler targets AVX2, for example with
+ * -mavx2 or -march=native), an SSE2 version (the x86-64 baseline) and a
+ * plain C fallback for everything else.
+ */
+
+/**
+ * Writes in[i] / divisor to out[i] for each i.  The results are exactly
+ * those of the scalar division.  out and in may be the same array.
+ *
+ * @param out an array of n doubles
+ * @param in an array of n doubles
+ * @param divisor a nonzero double
+ * @param n the size of the arrays
+ */
+void vec_divide(double *out, const double *in, double divisor, size_t n);
+
+/**
+ * Returns the dot product of the given vectors.
+ *
+ * @param a an array of n doubles
+ * @param b an array of n doubles
+ * @param n the size of the arrays
+ * @return the dot product
+ */
+double vec_dot(const double *a, const double *b, size_t n);
+
+/**
+ * Selects the k largest values in the given array, skipping the given
+ * position, using a bounded heap so only O(n log k) work is done.  The
+ * positions of the selected values are written in decreasing order of
+ * value, with ties going to the lower position.
+ *
+ * @param v an array of n doubles
+ * @param n the size of that array
+ * @param k the number of values to select
+ * @param skip a position to ignore, or n to consider every position
+ * @param top an array that can hold k positions
+ * @return the number of positions written, which is the smaller of k
+ * and the number of positions considered
+ */
+size_t vec_top_k(const double *v, size_t n, size_t k, size_t skip, size_t *top);
+
+#endif
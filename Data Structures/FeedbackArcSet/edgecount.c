@@ -0,0 +1,85 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "edgecount.h"
+
+// the key of a free slot; no pair packs to it since vertices are less
+// than 2^32 - 1
+#define EDGECOUNT_EMPTY UINT64_MAX
+
+typedef struct edgecount_slot
+{
+  uint64_t key;   // from in the high half, to in the low half
+  size_t count;
+} edgecount_slot;
+
+struct edgecount
+{
+  edgecount_slot *slots;
+  size_t mask;    // the number of slots, a power of 2, less one
+};
+
+/**
+ * Returns the slot holding the given key, or the free slot where it
+ * would go.
+ */
+edgecount_slot *edgecount_find(const edgecount *c, uint64_t key);
+
+edgecount *edgecount_create(size_t pairs)
+{
+  edgecount *c = malloc(sizeof(edgecount));
+  if (c == NULL) {
+    return NULL;
+  }
+
+  // at most half full, so probe sequences stay short
+  size_t size = 16;
+  while (size < 2 * pairs) {
+    size *= 2;
+  }
+  c->slots = malloc(sizeof(edgecount_slot) * size);
+  if (c->slots == NULL) {
+    free(c);
+    return NULL;
+  }
+  for (size_t i = 0; i < size; i++) {
+    c->slots[i].key = EDGECOUNT_EMPTY;
+    c->slots[i].count = 0;
+  }
+  c->mask = size - 1;
+  return c;
+}
+
+edgecount_slot *edgecount_find(const edgecount *c, uint64_t key)
+{
+  // Fibonacci hashing spreads the packed pairs, whose low bits are
+  // mostly small vertex numbers; collisions probe linearly
+  size_t i = (size_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & c->mask;
+  while (c->slots[i].key != key && c->slots[i].key != EDGECOUNT_EMPTY) {
+    i = (i + 1) & c->mask;
+  }
+  return &c->slots[i];
+}
+
+void edgecount_add(edgecount *c, size_t from, size_t to)
+{
+  uint64_t key = ((uint64_t)from << 32) | (uint64_t)to;
+  edgecount_slot *slot = edgecount_find(c, key);
+  slot->key = key;
+  slot->count++;
+}
+
+size_t *edgecount_get(edgecount *c, size_t from, size_t to)
+{
+  edgecount_slot *slot = edgecount_find(c, ((uint64_t)from << 32) | (uint64_t)to);
+  return slot->key != EDGECOUNT_EMPTY ? &slot->count : NULL;
+}
+
+void edgecount_destroy(edgecount *c)
+{
+  if (c != NULL) {
+    free(c->slots);
+    free(c);
+  }
+}
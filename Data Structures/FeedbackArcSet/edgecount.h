@@ -0,0 +1,49 @@
+#ifndef __EDGECOUNT_H__
+#define __EDGECOUNT_H__
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+struct edgecount;
+typedef struct edgecount edgecount;
+
+/**
+ * Creates a table counting how many times each directed pair of vertices
+ * occurs.  The table is a single open-addressed hash keyed on the pair
+ * packed into 64 bits, so counting a game is one probe sequence over
+ * integers instead of a string hash in a per-vertex map.  The table does
+ * not grow: it is sized for the given number of distinct pairs.
+ *
+ * @param pairs the most distinct pairs that will be added
+ * @return a pointer to the new table, or NULL if there was an allocation
+ * error; it is the caller's responsibility to destroy the table
+ */
+edgecount *edgecount_create(size_t pairs);
+
+/**
+ * Adds one to the count of the given pair.
+ *
+ * @param c a pointer to a table, non-NULL, with room for the pair
+ * @param from a vertex, less than 2^32
+ * @param to a vertex, less than 2^32
+ */
+void edgecount_add(edgecount *c, size_t from, size_t to);
+
+/**
+ * Returns the count of the given pair, which the caller may change.
+ *
+ * @param c a pointer to a table, non-NULL
+ * @param from a vertex
+ * @param to a vertex
+ * @return a pointer to the count, or NULL if the pair was never added
+ */
+size_t *edgecount_get(edgecount *c, size_t from, size_t to);
+
+/**
+ * Destroys the given table.
+ *
+ * @param c a pointer to a table
+ */
+void edgecount_destroy(edgecount *c);
+
+#endif
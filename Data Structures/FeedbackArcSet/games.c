@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "games.h"
+#include "inbuf.h"
+
+#define GAMES_INITIAL_CAPACITY 1024
+
+// everything read so far: the games as index pairs, and the names with an
+// open-addressed table from the bytes of a name to its index
+typedef struct games_parser
+{
+  size_t *games;
+  size_t total;
+  size_t game_cap;
+  char **names;
+  size_t *lengths;
+  uint64_t *hashes;   // the hash of each name, so the table can be rebuilt
+  size_t n;
+  size_t name_cap;
+  size_t *slots;      // the index of the name in each slot plus 1, 0 if free
+  size_t mask;        // the number of slots, a power of 2, less one
+  games_error *error;
+} games_parser;
+
+/**
+ * Parses the given line, which does not include its newline, and adds
+ * its game.
+ *
+ * @return false if the line is malformed or there was an allocation error
+ */
+bool games_parse_line(games_parser *p, const char *line, size_t len, size_t number);
+
+/**
+ * Finds the index of the given name, adding the name if it is new.
+ *
+ * @return false if there was an allocation error
+ */
+bool games_name_id(games_parser *p, const char *name, size_t len, size_t *id);
+
+/**
+ * Doubles the table of names and puts every name back in it.
+ *
+ * @return false if there was an allocation error
+ */
+bool games_grow_table(games_parser *p);
+
+/**
+ * Records the given error; every failure goes through here.
+ *
+ * @return false
+ */
+bool games_fail(games_parser *p, size_t line, size_t column, const char *message);
+
+/**
+ * Returns the 64-bit FNV-1a hash of the given bytes.
+ */
+uint64_t games_hash(const char *s, size_t len);
+
+/**
+ * Frees everything the given parser holds.
+ */
+void games_free(games_parser *p);
+
+size_t *games_parse(inbuf *in, size_t *total, char ***names, size_t *n, games_error *error)
+{
+  games_parser p;
+  p.game_cap = GAMES_INITIAL_CAPACITY;
+  p.name_cap = GAMES_INITIAL_CAPACITY;
+  p.mask = 2 * GAMES_INITIAL_CAPACITY - 1;
+  p.total = 0;
+  p.n = 0;
+  p.error = error;
+  p.games = malloc(sizeof(size_t) * p.game_cap);
+  p.names = malloc(sizeof(char *) * p.name_cap);
+  p.lengths = malloc(sizeof(size_t) * p.name_cap);
+  p.hashes = malloc(sizeof(uint64_t) * p.name_cap);
+  p.slots = calloc(p.mask + 1, sizeof(size_t));
+  if (p.games == NULL || p.names == NULL || p.lengths == NULL || p.hashes == NULL || p.slots == NULL) {
+    games_fail(&p, 0, 0, "out of memory");
+    games_free(&p);
+    return NULL;
+  }
+
+  // inbuf_lines hands over whole lines, the rest of the file when it is
+  // mapped, and memchr finds where each ends
+  size_t number = 0;
+  size_t block_len;
+  const char *block;
+  while ((block = inbuf_lines(in, &block_len)) != NULL) {
+    const char *end = block + block_len;
+    const char *line = block;
+    while (line < end) {
+      const char *newline = memchr(line, '\n', end - line);
+      const char *line_end = newline != NULL ? newline : end;
+      if (!games_parse_line(&p, line, line_end - line, ++number)) {
+        games_free(&p);
+        return NULL;
+      }
+      line = newline != NULL ? newline + 1 : end;
+    }
+  }
+  if (inbuf_error(in)) {
+    games_fail(&p, 0, 0, "read error");
+    games_free(&p);
+    return NULL;
+  }
+
+  free(p.lengths);
+  free(p.hashes);
+  free(p.slots);
+  *total = p.total;
+  *names = p.names;
+  *n = p.n;
+  return p.games;
+}
+
+bool games_parse_line(games_parser *p, const char *line, size_t len, size_t number)
+{
+  size_t ids[2];
+  size_t i = 0;
+  for (int k = 0; k < 2; k++) {
+    if (k == 1 && i < len && line[i] == ',') {
+      i++;
+    }
+    if (i >= len || line[i] != '"') {
+      return games_fail(p, number, i + 1, "expected '\"'");
+    }
+    const char *name = line + i + 1;
+    const char *close = memchr(name, '"', len - i - 1);
+    if (close == NULL) {
+      return games_fail(p, number, len + 1, "missing closing '\"'");
+    }
+    size_t name_len = close - name;
+    if (name_len == 0) {
+      return games_fail(p, number, i + 2, "empty name");
+    }
+    if (name[0] == ' ') {
+      return games_fail(p, number, i + 2, "name starts with a space");
+    }
+    if (close[-1] == ' ') {
+      return games_fail(p, number, close - line, "name ends with a space");
+    }
+    if (!games_name_id(p, name, name_len, &ids[k])) {
+      return games_fail(p, 0, 0, "out of memory");
+    }
+    i = close - line + 1;
+  }
+  while (i < len && line[i] == ' ') {
+    i++;
+  }
+  if (i < len) {
+    return games_fail(p, number, i + 1, "unexpected character after the second name");
+  }
+
+  if (p->total + 2 > p->game_cap) {
+    size_t *bigger = realloc(p->games, sizeof(size_t) * p->game_cap * 2);
+    if (bigger == NULL) {
+      return games_fail(p, 0, 0, "out of memory");
+    }
+    p->games = bigger;
+    p->game_cap *= 2;
+  }
+  p->games[p->total++] = ids[0];
+  p->games[p->total++] = ids[1];
+  return true;
+}
+
+bool games_name_id(games_parser *p, const char *name, size_t len, size_t *id)
+{
+  uint64_t hash = games_hash(name, len);
+  size_t i = hash & p->mask;
+  while (p->slots[i] != 0) {
+    size_t v = p->slots[i] - 1;
+    if (p->hashes[v] == hash && p->lengths[v] == len && memcmp(p->names[v], name, len) == 0) {
+      *id = v;
+      return true;
+    }
+    i = (i + 1) & p->mask;
+  }
+
+  // a new name: copied out of the input, and the table kept at most half
+  // full
+  if (p->n == p->name_cap) {
+    char **names = realloc(p->names, sizeof(char *) * p->name_cap * 2);
+    if (names != NULL) {
+      p->names = names;
+    }
+    size_t *lengths = realloc(p->lengths, sizeof(size_t) * p->name_cap * 2);
+    if (lengths != NULL) {
+      p->lengths = lengths;
+    }
+    uint64_t *hashes = realloc(p->hashes, sizeof(uint64_t) * p->name_cap * 2);
+    if (hashes != NULL) {
+      p->hashes = hashes;
+    }
+    if (names == NULL || lengths == NULL || hashes == NULL) {
+      return false;
+    }
+    p->name_cap *= 2;
+  }
+  char *copy = malloc(len + 1);
+  if (copy == NULL) {
+    return false;
+  }
+  memcpy(copy, name, len);
+  copy[len] = '\0';
+  p->names[p->n] = copy;
+  p->lengths[p->n] = len;
+  p->hashes[p->n] = hash;
+  p->slots[i] = p->n + 1;
+  *id = p->n++;
+  return 2 * p->n <= p->mask + 1 || games_grow_table(p);
+}
+
+bool games_grow_table(games_parser *p)
+{
+  size_t mask = 2 * (p->mask + 1) - 1;
+  size_t *slots = calloc(mask + 1, sizeof(size_t));
+  if (slots == NULL) {
+    return false;
+  }
+  for (size_t v = 0; v < p->n; v++) {
+    size_t i = p->hashes[v] & mask;
+    while (slots[i] != 0) {
+      i = (i + 1) & mask;
+    }
+    slots[i] = v + 1;
+  }
+  free(p->slots);
+  p->slots = slots;
+  p->mask = mask;
+  return true;
+}
+
+bool games_fail(games_parser *p, size_t line, size_t column, const char *message)
+{
+  p->error->line = line;
+  p->error->column = column;
+  p->error->message = message;
+  return false;
+}
+
+uint64_t games_hash(const char *s, size_t len)
+{
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (unsigned char)s[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+void games_free(games_parser *p)
+{
+  for (size_t i = 0; p->names != NULL && i < p->n; i++) {
+    free(p->names[i]);
+  }
+  free(p->games);
+  free(p->names);
+  free(p->lengths);
+  free(p->hashes);
+  free(p->slots);
+}
@@ -0,0 +1,41 @@
+#ifndef __GAMES_H__
+#define __GAMES_H__
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "inbuf.h"
+
+// where and why the input was rejected
+typedef struct games_error
+{
+  size_t line;           // counting from 1
+  size_t column;         // counting from 1, in bytes
+  const char *message;
+} games_error;
+
+/**
+ * Parses the game results in the given input, one game per line in the
+ * form "winner","loser" (the comma is optional), each name non-empty,
+ * without a quote and not starting or ending with a space, with only
+ * spaces after the second name.  The last line need not end with a
+ * newline.  The input is scanned a block at a time with memchr and each
+ * name is looked up as a slice of the block, so only the first occurrence
+ * of a name is copied; every game becomes a pair of vertex indices, the
+ * indices given out in order of first occurrence.
+ *
+ * @param in a pointer to an input buffer, non-NULL
+ * @param total a pointer to a location for the length of the returned
+ * array, twice the number of games
+ * @param names a pointer to a location for a malloced array of the
+ * malloced names, indexed by vertex
+ * @param n a pointer to a location for the number of names
+ * @param error a pointer to a location for where the input went wrong,
+ * with line and column 0 if it was a read or allocation error
+ * @return a malloced array of the winner and then the loser of each game,
+ * or NULL if the input is malformed or could not be read, in which case
+ * nothing is left for the caller to free
+ */
+size_t *games_parse(inbuf *in, size_t *total, char ***names, size_t *n, games_error *error);
+
+#endif
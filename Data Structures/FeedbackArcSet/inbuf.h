@@ -0,0 +1,88 @@
+#ifndef __INBUF_H__
+#define __INBUF_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+struct inbuf;
+typedef struct inbuf inbuf;
+
+/**
+ * Prepares to read the rest of the given stream in large pieces instead
+ * of a character at a time.  If the stream is a regular file it is
+ * memory-mapped and parsed in place; otherwise (a pipe or a terminal) it
+ * is read with fread into a buffer that grows to hold the longest line.
+ * The stream should not be read by other means while the input buffer
+ * is open.
+ *
+ * @param stream a stream, non-NULL
+ * @return a pointer to the input buffer, or NULL if there was an
+ * allocation error; it is the caller's responsibility to close it
+ */
+inbuf *inbuf_open(FILE *stream);
+
+/**
+ * Returns the next line of the given input, without its newline.  A last
+ * line without a newline is returned too, but nothing after a final
+ * newline.  The line is not NUL-terminated and remains valid until the
+ * next call.
+ *
+ * @param b a pointer to an input buffer, non-NULL
+ * @param len a pointer to a location for the length of the line
+ * @return a pointer to the first character of the line, or NULL at the
+ * end of the input or if there was an error
+ */
+const char *inbuf_line(inbuf *b, size_t *len);
+
+/**
+ * Returns as many whole lines of the given input as can be had without
+ * waiting for more: the rest of a mapped file, or the complete lines in
+ * the buffer.  The block ends with a newline unless it is the last line
+ * of the input, and remains valid until the next call.
+ *
+ * @param b a pointer to an input buffer, non-NULL
+ * @param len a pointer to a location for the length of the block
+ * @return a pointer to the first character of the block, or NULL at the
+ * end of the input or if there was an error
+ */
+const char *inbuf_lines(inbuf *b, size_t *len);
+
+/**
+ * Returns all the input that can be had without waiting for more, at
+ * least one character unless the input is at its end.  The characters
+ * remain valid until the next call.
+ *
+ * @param b a pointer to an input buffer, non-NULL
+ * @param data a pointer to a location for a pointer to the characters
+ * @return the number of characters, or 0 at the end of the input or if
+ * there was an error
+ */
+size_t inbuf_chunk(inbuf *b, const char **data);
+
+/**
+ * Determines whether the given input was cut short by a read or
+ * allocation error rather than by its end.
+ *
+ * @param b a pointer to an input buffer, non-NULL
+ * @return true if there was an error
+ */
+bool inbuf_error(const inbuf *b);
+
+/**
+ * Determines whether the given input is memory-mapped.
+ *
+ * @param b a pointer to an input buffer, non-NULL
+ * @return true if the input is read through a mapping
+ */
+bool inbuf_mapped(const inbuf *b);
+
+/**
+ * Closes the given input buffer, unmapping or freeing its memory.  The
+ * stream it was opened on is left open.
+ *
+ * @param b a pointer to an input buffer
+ */
+void inbuf_close(inbuf *b);
+
+#endif
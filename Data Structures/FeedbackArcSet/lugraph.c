@@ -4,13 +4,16 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "lugraph.h"
 #include "gmap.h"
+#include "inbuf.h"
+#include "games.h"
 #include "string_key.h"
 #include "mergesort.h"
-
-enum state {START, INSIDE, COMMA, SECONDINSIDE, NEWLINE};
+#include "parallel.h"
 
 struct edge
 {
@@ -30,6 +33,8 @@ struct topo_sort
   size_t vertex;
   size_t ratio;
   size_t outdegree;
+  size_t layer;     // how many rounds of removing sources it takes to
+                    // make the vertex a source
 };
 
 struct dfs_struct
@@ -39,12 +44,81 @@ struct dfs_struct
   int indegree;
 };
 
+// what the DFS ranking from every start vertex shares: the order the
+// searches take vertices in, fixed before they start, and the best
+// ranking found so far
+typedef struct dfs_job
+{
+  const lugraph *g;
+  size_t *by_rank;       // every vertex, in dfs_comp order
+  size_t *next;          // each vertex's out-neighbors in dfs_comp order,
+                         // at the graph's out-edge offsets
+  pthread_mutex_t lock;
+  size_t best_score;     // the least weight of wrong-way edges found
+  size_t best_start;     // the first start vertex that found them
+  int *best;
+} dfs_job;
+
+// how many vertices a search places between looks at the best score
+#define DFS_BEST_CHECK 1024
+
+// the strongly connected components of a graph, each to be ranked on its
+// own: the vertices of component c are members[starts[c]] up to
+// members[starts[c + 1]], in vertex order, and local gives each vertex's
+// place among them
+typedef struct component_job
+{
+  const lugraph *g;
+  rank_method method;
+  const size_t *component;
+  const size_t *members;
+  const size_t *starts;
+  const size_t *local;
+  size_t threads;        // the threads each component may use
+  int *ordered;          // the ranking, filled a component at a time
+  bool *failed;          // set for each component that could not be ranked
+} component_job;
+
+// one layer of the subset dynamic program of order_exact: the subsets of
+// k vertices, numbered in colex order, so that the number of the subset
+// with vertices b_1 < ... < b_k is the sum of binom[b_j][j]
+typedef struct exact_job
+{
+  const lugraph *g;
+  size_t n;
+  size_t k;
+  const uint32_t *out;   // each vertex's out-neighbors as a mask
+  const size_t (*binom)[LUGRAPH_EXACT_MAX + 1];
+  const size_t *prev;    // the best score of each subset of k - 1
+  size_t *cur;           // the best score of each subset of k
+  unsigned char *last;   // the vertex best ranked last in each subset,
+                         // indexed by the subset's mask
+} exact_job;
+
+// the fewest subsets in a layer worth splitting across threads
+#define EXACT_PARALLEL_MIN 4096
+
+#define LUGRAPH_NO_COMPONENT SIZE_MAX
+
 struct lugraph
 {
   size_t n;          // the number of vertices
   size_t *list_size; // the size of each adjacency list
   size_t *list_cap;  // the capacity of each adjacency list
   size_t **adj;      // the adjacency lists
+  // once frozen the lists are replaced by compressed sparse rows: the
+  // out-neighbors of v are targets[offsets[v]] up to targets[offsets[v + 1]],
+  // in the order the edges were added, and likewise the in-neighbors in
+  // sources
+  bool frozen;
+  size_t *offsets;
+  size_t *targets;
+  size_t *in_offsets;
+  size_t *sources;
+  // the weight of each edge, in the same places as targets and sources,
+  // or NULL if every edge weighs 1
+  size_t *weights;
+  size_t *in_weights;
   // NEED TO PUT INDEGREE AND OUTDEGREE IN HERE
   // keep track of adj[inedges] of all the things that go into it
   // building up the adjency set and only add to list if count >0
@@ -65,6 +139,7 @@ struct lug_search
   size_t *pred;
   size_t *visited;
   size_t visit_count;
+  size_t *cursor;  // the next edge to follow out of each vertex
 };
 
 enum {DFS_UNSEEN, DFS_ACTIVE, DFS_DONE};
@@ -73,26 +148,59 @@ enum {DFS_UNSEEN, DFS_ACTIVE, DFS_DONE};
 
 int compare(const void *p1, const void *p2);
 
-char *grow_word(char *word, size_t *end, size_t *capacity, const int c);
-
 void lugraph_add_degrees(lugraph *g);
 
 void error(lugraph *g);
 
-void lu_dfs_visit(lugraph* g, lug_search *s, size_t from);
-
-lug_search *ludfs(lugraph *g, size_t from);
 
 int topo_compare(const void *p1, const void *p2);
 
-int* order_array(lugraph *g, int *arr);
+/**
+ * Compares two entries of the topological order queue: the earlier layer
+ * first, then as topo_compare does.
+ */
+int topo_heap_compare(const topo_sort *q1, const topo_sort *q2);
 
-void topo_help(lugraph* g, int* color, int* ordered, int* size);
+/**
+ * Adds the given entry to the given binary heap of size entries.
+ */
+void topo_heap_push(topo_sort *heap, size_t *size, topo_sort entry);
+
+/**
+ * Removes and returns the first entry of the given non-empty heap.
+ */
+topo_sort topo_heap_pop(topo_sort *heap, size_t *size);
 
 int *topological(lugraph *g);
 
 
 
+/**
+ * Allocates a graph with the given number of vertices and the per-vertex
+ * arrays every graph has, but no adjacency lists.
+ *
+ * @return a pointer to the graph, or NULL if there was an allocation error
+ */
+lugraph *lugraph_alloc(size_t n, gmap *vertices, char** names);
+
+/**
+ * Fills the given compressed rows with the given edges: counts the edges
+ * out of each vertex into offsets, then places each edge after the
+ * earlier edges out of the same vertex.  The edge list is read twice.
+ *
+ * @param n the number of vertices
+ * @param edges an array of m (from, to) pairs
+ * @param m the number of edges
+ * @param reverse true to store each edge under its to vertex instead
+ * @param offsets an array of n + 1 sizes
+ * @param targets an array of m vertices
+ * @param weights the weight of each edge, or NULL
+ * @param placed an array of m weights to fill in the same order as
+ * targets, or NULL if weights is
+ */
+void lugraph_fill_rows(size_t n, const size_t *edges, const size_t *weights, size_t m, bool reverse,
+                       size_t *offsets, size_t *targets, size_t *placed);
+
 /**
  * Resizes the adjacency list for the given vertex in the given graph.
  * 
@@ -106,7 +214,21 @@ gmap* indegreee(lugraph *g, char** names, int* color);
 int dfs_comp(const void *p1, const void *p2);
 
 /**
- * Visits the given vertex in the given search of the given graph.
+ * Does the same as dfs, with the searches from the start vertices spread
+ * over the given number of threads, at least 1.
+ */
+bool dfs_threads(lugraph *g, int *ordered, size_t threads);
+
+/**
+ * Runs the DFS ranking from each start vertex in [begin, end) of the
+ * given dfs_job, keeping the ranking if it is the best so far.
+ */
+void dfs_starts(size_t begin, size_t end, void *arg);
+
+/**
+ * Visits the given vertex in the given search of the given graph, and
+ * every vertex reachable from it that the search has not seen, without
+ * recursion, so the depth of the search is not limited by the stack.
  *
  * @param g a pointer to a directed graph
  * @param s a search in that graph
@@ -134,29 +256,68 @@ lug_search *lug_search_create(const lugraph *g, size_t from);
  */
 void lugraph_add_half_edge(lugraph *g, size_t from, size_t to);
 
+/**
+ * Ranks each component in [begin, end) of the given component_job.
+ */
+void rank_component_range(size_t begin, size_t end, void *arg);
+
+/**
+ * Ranks the vertices of the given component with the job's heuristic, on
+ * the subgraph they induce, and writes them into the job's ranking.
+ */
+void rank_component(component_job *job, size_t c);
+
+/**
+ * Finds the best score and last vertex of the subsets in [begin, end) of
+ * the given exact_job's layer.
+ */
+void exact_layer(size_t begin, size_t end, void *arg);
+
+/**
+ * Returns the weight of the edges from the given vertex to the given set
+ * of vertices.
+ */
+size_t exact_cost(const exact_job *job, size_t v, uint32_t above);
+
 void print_adj_list(lugraph *g, char** names) {
   for (size_t i = 0; i < g->n; i++) {
+    size_t count;
+    const size_t *out = lugraph_out_edges(g, i, &count);
     fprintf(stderr, "%s: ", names[i]);
-    for (size_t j = 0; j < g->list_size[i]; j++) {
-      fprintf(stderr, "%ld ", g->adj[i][j]);
+    for (size_t j = 0; j < count; j++) {
+      fprintf(stderr, "%ld ", out[j]);
     }
     fprintf(stderr, "\n");
   }
 }
 
 void error(lugraph *g) {
-  fprintf(stderr, "%ld %ld\n", g->n, g->list_cap[0]);
+  fprintf(stderr, "%ld %ld\n", g->n, g->frozen ? g->offsets[g->n] : g->list_cap[0]);
 
 }
 
 void lugraph_add_degrees(lugraph *g) {
   for (size_t i = 0; i < g->n; i++) {
-    g->outdegrees[i] = g->list_size[i];
+    const size_t *out = lugraph_out_edges(g, i, &g->outdegrees[i]);
+    if (!g->frozen) {
+      for (size_t j = 0; j < g->outdegrees[i]; j++) {
+        g->indegrees[out[j]]++;
+      }
+    }
   }
-  for (size_t i = 0; i < g->n; i++) {
-    for (size_t j = 0; j < g->list_size[i]; j++) {
-      g->indegrees[g->adj[i][j]]++;
-
+  for (size_t i = 0; g->frozen && i < g->n; i++) {
+    g->indegrees[i] = g->in_offsets[i + 1] - g->in_offsets[i];
+  }
+  // with weights a degree is the total weight of the edges, the number of
+  // games won or lost
+  for (size_t i = 0; g->weights != NULL && i < g->n; i++) {
+    g->outdegrees[i] = 0;
+    for (size_t j = g->offsets[i]; j < g->offsets[i + 1]; j++) {
+      g->outdegrees[i] += g->weights[j];
+    }
+    g->indegrees[i] = 0;
+    for (size_t j = g->in_offsets[i]; j < g->in_offsets[i + 1]; j++) {
+      g->indegrees[i] += g->in_weights[j];
     }
   }
   for (size_t i = 0; i < g->n; i++) {
@@ -238,6 +399,40 @@ int* order_degrees(lugraph *g) {
 
 
 lugraph *lugraph_create(size_t n, gmap *vertices, char** names)
+{
+  lugraph *g = lugraph_alloc(n, vertices, names);
+  if (g != NULL)
+    {
+      g->list_size = malloc(sizeof(size_t) * n);
+      g->list_cap = malloc(sizeof(size_t) * n);
+      g->adj = malloc(sizeof(size_t *) * n);
+      
+      if (g->list_size == NULL || g->list_cap == NULL || g->adj == NULL)
+      {
+        free(g->list_size);
+        free(g->list_cap);
+        free(g->adj);
+        free(g->vertices);
+        free(g->outdegrees);
+        free(g->indegrees);
+        free(g->ratios);
+        free(g);
+
+        return NULL;
+      }
+
+      for (size_t i = 0; i < n; i++)
+      {
+        g->list_size[i] = 0;
+        g->adj[i] = malloc(sizeof(size_t) * LUGRAPH_ADJ_LIST_INITIAL_CAPACITY);
+        g->list_cap[i] = g->adj[i] != NULL ? LUGRAPH_ADJ_LIST_INITIAL_CAPACITY : 0;
+      }
+    }
+
+  return g;
+}
+
+lugraph *lugraph_alloc(size_t n, gmap *vertices, char** names)
 {
   if (n < 1)
     {
@@ -248,9 +443,16 @@ lugraph *lugraph_create(size_t n, gmap *vertices, char** names)
   if (g != NULL)
     {
       g->n = n;
-      g->list_size = malloc(sizeof(size_t) * n);
-      g->list_cap = malloc(sizeof(size_t) * n);
-      g->adj = malloc(sizeof(size_t *) * n);
+      g->list_size = NULL;
+      g->list_cap = NULL;
+      g->adj = NULL;
+      g->frozen = false;
+      g->offsets = NULL;
+      g->targets = NULL;
+      g->in_offsets = NULL;
+      g->sources = NULL;
+      g->weights = NULL;
+      g->in_weights = NULL;
       g->outdegrees = malloc(sizeof(size_t) * n);
       g->indegrees = malloc(sizeof(size_t) * n);
       g->ratios = malloc(sizeof(float) * n);
@@ -258,12 +460,8 @@ lugraph *lugraph_create(size_t n, gmap *vertices, char** names)
       g->names = names;
       // g->adjset = adjset;
       
-      if (g->list_size == NULL || g->list_cap == NULL || g->adj == NULL || g->vertices == NULL || g->outdegrees == NULL || g->indegrees == NULL || g->ratios == NULL)
+      if (g->outdegrees == NULL || g->indegrees == NULL || g->ratios == NULL)
       {
-        free(g->list_size);
-        free(g->list_cap);
-        free(g->adj);
-        free(g->vertices);
         free(g->outdegrees);
         free(g->indegrees);
         free(g->ratios);
@@ -274,9 +472,6 @@ lugraph *lugraph_create(size_t n, gmap *vertices, char** names)
 
       for (size_t i = 0; i < n; i++)
       {
-        g->list_size[i] = 0;
-        g->adj[i] = malloc(sizeof(size_t) * LUGRAPH_ADJ_LIST_INITIAL_CAPACITY);
-        g->list_cap[i] = g->adj[i] != NULL ? LUGRAPH_ADJ_LIST_INITIAL_CAPACITY : 0;
         g->outdegrees[i] = 0;
         g->indegrees[i] = 0;
         g->ratios[i] = 0;
@@ -286,6 +481,199 @@ lugraph *lugraph_create(size_t n, gmap *vertices, char** names)
   return g;
 }
 
+lugraph *lugraph_create_edges(size_t n, gmap *vertices, char** names, const size_t *edges, size_t m)
+{
+  return lugraph_create_weighted(n, vertices, names, edges, NULL, m);
+}
+
+lugraph *lugraph_create_weighted(size_t n, gmap *vertices, char** names, const size_t *edges, const size_t *weights, size_t m)
+{
+  // edges add_edge would refuse are dropped first, so the rows can be
+  // filled straight from the list
+  size_t *valid = malloc(sizeof(size_t) * 2 * (m > 0 ? m : 1));
+  size_t *valid_weights = weights != NULL ? malloc(sizeof(size_t) * (m > 0 ? m : 1)) : NULL;
+  if (valid == NULL || (weights != NULL && valid_weights == NULL))
+    {
+      free(valid);
+      free(valid_weights);
+      return NULL;
+    }
+  size_t count = 0;
+  for (size_t e = 0; e < m; e++)
+    {
+      if (edges[2 * e] < n && edges[2 * e + 1] < n && edges[2 * e] != edges[2 * e + 1])
+        {
+          valid[2 * count] = edges[2 * e];
+          valid[2 * count + 1] = edges[2 * e + 1];
+          if (weights != NULL)
+            {
+              valid_weights[count] = weights[e];
+            }
+          count++;
+        }
+    }
+
+  lugraph *g = lugraph_alloc(n, vertices, names);
+  if (g != NULL)
+    {
+      g->offsets = malloc(sizeof(size_t) * (n + 1));
+      g->targets = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+      g->in_offsets = malloc(sizeof(size_t) * (n + 1));
+      g->sources = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+      if (weights != NULL)
+        {
+          g->weights = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+          g->in_weights = malloc(sizeof(size_t) * (count > 0 ? count : 1));
+        }
+      g->frozen = true;
+      if (g->offsets == NULL || g->targets == NULL || g->in_offsets == NULL || g->sources == NULL
+          || (weights != NULL && (g->weights == NULL || g->in_weights == NULL)))
+        {
+          free(valid);
+          free(valid_weights);
+          lugraph_destroy(g);
+          return NULL;
+        }
+      lugraph_fill_rows(n, valid, valid_weights, count, false, g->offsets, g->targets, g->weights);
+      lugraph_fill_rows(n, valid, valid_weights, count, true, g->in_offsets, g->sources, g->in_weights);
+    }
+  free(valid);
+  free(valid_weights);
+  return g;
+}
+
+bool lugraph_freeze(lugraph *g)
+{
+  if (g == NULL || g->frozen)
+    {
+      return g != NULL;
+    }
+
+  size_t m = 0;
+  for (size_t i = 0; i < g->n; i++)
+    {
+      m += g->list_size[i];
+    }
+  size_t *edges = malloc(sizeof(size_t) * 2 * (m > 0 ? m : 1));
+  size_t *offsets = malloc(sizeof(size_t) * (g->n + 1));
+  size_t *targets = malloc(sizeof(size_t) * (m > 0 ? m : 1));
+  size_t *in_offsets = malloc(sizeof(size_t) * (g->n + 1));
+  size_t *sources = malloc(sizeof(size_t) * (m > 0 ? m : 1));
+  if (edges == NULL || offsets == NULL || targets == NULL || in_offsets == NULL || sources == NULL)
+    {
+      free(edges);
+      free(offsets);
+      free(targets);
+      free(in_offsets);
+      free(sources);
+      return false;
+    }
+
+  // the lists, in vertex order, are the edge list
+  size_t e = 0;
+  for (size_t i = 0; i < g->n; i++)
+    {
+      for (size_t j = 0; j < g->list_size[i]; j++)
+        {
+          edges[e++] = i;
+          edges[e++] = g->adj[i][j];
+        }
+      free(g->adj[i]);
+    }
+  lugraph_fill_rows(g->n, edges, NULL, m, false, offsets, targets, NULL);
+  lugraph_fill_rows(g->n, edges, NULL, m, true, in_offsets, sources, NULL);
+  free(edges);
+
+  free(g->adj);
+  free(g->list_cap);
+  free(g->list_size);
+  g->adj = NULL;
+  g->list_cap = NULL;
+  g->list_size = NULL;
+  g->offsets = offsets;
+  g->targets = targets;
+  g->in_offsets = in_offsets;
+  g->sources = sources;
+  g->frozen = true;
+  return true;
+}
+
+void lugraph_fill_rows(size_t n, const size_t *edges, const size_t *weights, size_t m, bool reverse,
+                       size_t *offsets, size_t *targets, size_t *placed)
+{
+  for (size_t i = 0; i <= n; i++)
+    {
+      offsets[i] = 0;
+    }
+  for (size_t e = 0; e < m; e++)
+    {
+      offsets[edges[2 * e + reverse] + 1]++;
+    }
+  for (size_t i = 0; i < n; i++)
+    {
+      offsets[i + 1] += offsets[i];
+    }
+
+  // offsets[v] is used as the next free slot in v's row, which leaves it
+  // at the start of the next row; shifting back restores the starts
+  for (size_t e = 0; e < m; e++)
+    {
+      size_t v = edges[2 * e + reverse];
+      if (weights != NULL)
+        {
+          placed[offsets[v]] = weights[e];
+        }
+      targets[offsets[v]++] = edges[2 * e + !reverse];
+    }
+  for (size_t i = n; i > 0; i--)
+    {
+      offsets[i] = offsets[i - 1];
+    }
+  offsets[0] = 0;
+}
+
+const size_t *lugraph_out_edges(const lugraph *g, size_t v, size_t *count)
+{
+  if (g->frozen)
+    {
+      *count = g->offsets[v + 1] - g->offsets[v];
+      return g->targets + g->offsets[v];
+    }
+  *count = g->list_size[v];
+  return g->adj[v];
+}
+
+const size_t *lugraph_in_edges(const lugraph *g, size_t v, size_t *count)
+{
+  if (!g->frozen)
+    {
+      *count = 0;
+      return NULL;
+    }
+  *count = g->in_offsets[v + 1] - g->in_offsets[v];
+  return g->sources + g->in_offsets[v];
+}
+
+const size_t *lugraph_out_weights(const lugraph *g, size_t v)
+{
+  return g->frozen && g->weights != NULL ? g->weights + g->offsets[v] : NULL;
+}
+
+const size_t *lugraph_in_weights(const lugraph *g, size_t v)
+{
+  return g->frozen && g->in_weights != NULL ? g->in_weights + g->in_offsets[v] : NULL;
+}
+
+bool lugraph_weighted(const lugraph *g)
+{
+  return g->weights != NULL;
+}
+
+bool lugraph_frozen(const lugraph *g)
+{
+  return g->frozen;
+}
+
 size_t lugraph_size(const lugraph *g)
 {
   if (g != NULL)
@@ -300,7 +688,7 @@ size_t lugraph_size(const lugraph *g)
 
 void lugraph_list_embiggen(lugraph *g, size_t from)
 {
-  if (g->list_cap[from] != 0)
+  if (!g->frozen && g->list_cap[from] != 0)
     {
       size_t *bigger = realloc(g->adj[from], sizeof(size_t) * g->list_cap[from] * 2);
       if (bigger != NULL)
@@ -322,6 +710,10 @@ void lugraph_add_edge(lugraph *g, size_t from, size_t to)
 
 void lugraph_add_half_edge(lugraph *g, size_t from, size_t to)
 {
+  if (g->frozen)
+    {
+      return;
+    }
   if (g->list_size[from] == g->list_cap[from])
     {
       lugraph_list_embiggen(g, from);
@@ -338,12 +730,14 @@ bool lugraph_has_edge(const lugraph *g, size_t from, size_t to)
 {
   if (g != NULL && from >= 0 && to >= 0 && from < g->n && to < g->n && from != to)
     {
+      size_t count;
+      const size_t *out = lugraph_out_edges(g, from, &count);
       size_t i = 0;
-      while (i < g->list_size[from] && g->adj[from][i] != to)
+      while (i < count && out[i] != to)
 	{
 	  i++;
 	}
-      return i < g->list_size[from];
+      return i < count;
     }
   else
     {
@@ -355,7 +749,9 @@ size_t lugraph_degree(const lugraph *g, size_t v)
 {
   if (g != NULL && v >= 0 && v < g->n)
     {
-      return g->list_size[v];
+      size_t count;
+      lugraph_out_edges(g, v, &count);
+      return count;
     }
   else
     {
@@ -417,25 +813,6 @@ lug_search *lugraph_dfs(const lugraph *g, size_t from, int *cycle)
 //   }
 // }
 
-int* next_dfs(lugraph *g, size_t from) {
-  //dfs_struct *input = malloc(sizeof(edge)*(g->list_size[from]));
-  dfs_struct input[g->list_size[from]];
-
-  for (int i = 0; i < g->list_size[from]; i++) {
-    input[i].vertex = g->adj[from][i];
-    input[i].outdegree = g->outdegrees[g->adj[from][i]];
-    input[i].indegree = g->indegrees[g->adj[from][i]];
-  }
-
-  dfs_struct out[g->list_size[from]];
-  merge_sort(g->list_size[from], sizeof(dfs_struct), &input, &out, dfs_comp);
-  int *ordered_vertices = malloc(sizeof(int)*g->list_size[from]);
-  for (int i = 0; i < g->list_size[from]; i++) {
-    ordered_vertices[i] = out[i].vertex;
-  }
-  return ordered_vertices;
-}
-
 // int* nexter(lugraph *g, size_t from, char** names) {
 //   //dfs_struct *input = malloc(sizeof(edge)*(g->list_size[from]));
 //   edge *input = malloc(sizeof(edge)*(g->list_size[from]));
@@ -459,20 +836,37 @@ int* next_dfs(lugraph *g, size_t from) {
 // }
 
 
-// TO DO: implement lugraph_dfs_visit helper function
 void lugraph_dfs_visit(const lugraph* g, lug_search *s, size_t from, int *cycle) {
+  // the vertices on the path from from to v are the active ones; pred
+  // leads back along the path and cursor says where each left off
   s->color[from] = DFS_ACTIVE;
   s->visited[s->visit_count++] = from;
-  for (size_t i = 0; i < g->list_size[from]; i++) {    
-    if (s->color[g->adj[from][i]] == DFS_UNSEEN) {
-      s->pred[g->adj[from][i]] = from;
-      lugraph_dfs_visit(g, s, g->adj[from][i], cycle);
+  s->cursor[from] = 0;
+  size_t v = from;
+  while (true) {
+    size_t count;
+    const size_t *adj = lugraph_out_edges(g, v, &count);
+    if (s->cursor[v] < count) {
+      size_t w = adj[s->cursor[v]++];
+      if (s->color[w] == DFS_UNSEEN) {
+        s->pred[w] = v;
+        s->color[w] = DFS_ACTIVE;
+        s->visited[s->visit_count++] = w;
+        s->cursor[w] = 0;
+        v = w;
+      }
+      else if (s->color[w] == DFS_ACTIVE) {
+        *cycle = 1;
+      }
     }
-    else if (s->color[g->adj[from][i]] == DFS_ACTIVE) {
-      *cycle = 1;
+    else {
+      s->color[v] = DFS_DONE;
+      if (v == from) {
+        break;
+      }
+      v = s->pred[v];
     }
   }
-  s->color[from] = DFS_DONE;
 }
 
 bool lugraph_connected(const lugraph *g, size_t from, size_t to, int* cycle)
@@ -499,11 +893,17 @@ void lugraph_destroy(lugraph *g)
 {
   if (g != NULL)
     {
-      for (size_t i = 0; i < g->n; i++)
+      for (size_t i = 0; !g->frozen && g->adj != NULL && i < g->n; i++)
 	{
 	  free(g->adj[i]);
 	}
       free(g->adj);
+      free(g->offsets);
+      free(g->targets);
+      free(g->in_offsets);
+      free(g->sources);
+      free(g->weights);
+      free(g->in_weights);
       free(g->list_cap);
       free(g->list_size);
       free(g->outdegrees);
@@ -527,8 +927,9 @@ lug_search *lug_search_create(const lugraph *g, size_t from)
 	  s->visited = malloc(sizeof(size_t) * g->n);
 	  s->visit_count = 0;
 	  s->pred = malloc(sizeof(size_t) * g->n);
+	  s->cursor = malloc(sizeof(size_t) * g->n);
 
-	  if (s->color != NULL && s->visited != NULL && s->pred != NULL)
+	  if (s->color != NULL && s->visited != NULL && s->pred != NULL && s->cursor != NULL)
 	    {
 	      for (size_t i = 0; i < g->n; i++)
 		{
@@ -538,6 +939,7 @@ lug_search *lug_search_create(const lugraph *g, size_t from)
 	    }
 	  else
 	    {
+	      free(s->cursor);
 	      free(s->pred);
 	      free(s->visited);
 	      free(s->color);
@@ -578,331 +980,56 @@ void lug_search_destroy(lug_search *s)
       free(s->color);
       free(s->visited);
       free(s->pred);
+      free(s->cursor);
       free(s);
     }
 }
 
-char** read_input(FILE *stream, size_t *n, gmap **vertices, size_t *total, char*** names_holder)
+size_t *read_input(FILE *stream, size_t *n, gmap **vertices, size_t *total, char*** names_holder)
 {
-  size_t game_capacity = 10;
-  char **games = malloc(sizeof(char*)*game_capacity);
-  size_t capacity = 2;
-  char **names = malloc(sizeof(char*)*capacity);
-  enum state curr = START;
-  size_t leadingspace = 1;
-  size_t tailingspace = 0;
-  size_t commafound = 0;
-  size_t charpos = 0;
-  size_t size = 30;
-  size_t size2 = 30;
-  size_t index = 0;
-  char *winner = malloc(size*sizeof(char)*size);
-  char *loser = malloc(size*sizeof(char)*size2);
-  char c;
-  size_t lines = 0;
-  size_t exist1 = 0;
-  size_t exist2 = 0;
-  while ((c = getc(stream)) != EOF) {
-      switch (curr) {
-          case START:
-              if (c != '"') {
-                for (size_t i = 0; i < *n; i++) {
-                  free(names[i]);
-                }
-                free(names);
-                for (size_t i = 0; i < *total; i++) {
-                  free(games[i]);
-                }
-                free(games);
-                free(winner);
-                free(loser);
-                  return NULL;
-              }
-              else {
-                  lines++;
-                  curr = INSIDE;
-                  break;
-              }
-          case INSIDE:
-              if (c != '"') {
-                  if (c == ' ' && leadingspace == 1) {
-                      for (size_t i = 0; i < *n; i++) {
-                        free(names[i]);
-                      }
-                      free(names);
-                      for (size_t i = 0; i < *total; i++) {
-                        free(games[i]);
-                      }
-                      free(games);
-                      free(winner);
-                      free(loser);
-                      return NULL;
-                  }
-                  else if (c == ' ') {
-                      if (charpos+2 > size) {
-                          size *=2;
-                          winner = realloc(winner, size*sizeof(char));
-                      }
-                      winner[charpos++] = c;
-                      winner[charpos] = '\0';
-                      tailingspace = 1;
-                      break;
-                  }
-                  if (charpos+2 > size) {
-                      size *=2;
-                      winner = realloc(winner, size*sizeof(char));
-                  }
-                  winner[charpos++] = c;
-                  winner[charpos] = '\0';
-                  // fprintf(stderr, "%s\n",winner);
-                  exist1 = 1;
-                  tailingspace = 0;
-                  leadingspace = 0;
-                  break;
-              }
-              else if(c == '"' && tailingspace == 1) {
-                for (size_t i = 0; i < *n; i++) {
-                  free(names[i]);
-                  }
-                  free(names);
-                  for (size_t i = 0; i < *total; i++) {
-                    free(games[i]);
-                  }
-                  free(games);
-                  free(winner);
-                  free(loser);
-                  return NULL;
-              }
-              else {
-                if (exist1 == 1) {
-                  charpos = 0;
-                  curr = COMMA;
-                  break;
-                }
-                else {
-                  for (size_t i = 0; i < *n; i++) {
-                    free(names[i]);
-                  }
-                  free(names);
-                  for (size_t i = 0; i < *total; i++) {
-                    free(games[i]);
-                  }
-                  free(games);
-                  free(winner);
-                  free(loser);
-                  return NULL;
-                }
-              }
-          case COMMA:
-              if (c == ',' && commafound == 0) {
-                  commafound = 1;
-                  break;
-              }
-              if (c == '"') {
-                  leadingspace = 1;
-                  tailingspace = 0;
-                  curr = SECONDINSIDE;
-                  break;
-              }
-              else {
-                for (size_t i = 0; i < *n; i++) {
-                  free(names[i]);
-                }
-                free(names);
-                for (size_t i = 0; i < *total; i++) {
-                  free(games[i]);
-                }
-                free(games);
-                free(winner);
-                free(loser);
-                return NULL;
-              }
-          case SECONDINSIDE:
-              if (c != '"') {
-                  if (c == ' ' && leadingspace == 1) {
-                      for (size_t i = 0; i < *n; i++) {
-                        free(names[i]);
-                      }
-                      free(names);
-                      for (size_t i = 0; i < *total; i++) {
-                        free(games[i]);
-                      }
-                      free(games);
-                      free(winner);
-                      free(loser);
-                      return NULL;
-                  }
-                  else if (c == ' ') {
-                      if (charpos+2 > size2) {
-                          size2 *=2;
-                          loser = realloc(loser, size2*sizeof(char));
-                      }
-                      loser[charpos++] = c;
-                      loser[charpos] = '\0';
-                      tailingspace = 1;
-                      break;
-                  }
-                  if (charpos+2 > size2) {
-                          size2 *=2;
-                          loser = realloc(loser, size2*sizeof(char));
-                      }
-                  loser[charpos++] = c;
-                  loser[charpos] = '\0';
-                  // fprintf(stderr, "%s\n",loser);
-                  exist2 = 1;
-                  tailingspace = 0;
-                  leadingspace = 0;
-                  break;
-              }
-              else if(c == '"' && tailingspace == 1) {
-                for (size_t i = 0; i < *n; i++) {
-                  free(names[i]);
-                  }
-                  free(names);
-                  for (size_t i = 0; i < *total; i++) {
-                    free(games[i]);
-                  }
-                  free(games);
-                  free(winner);
-                  free(loser);
-                  return NULL;
-              }
-              else {
-                if (exist2 == 1) {
-                  curr = NEWLINE;
-                    break;
-                }
-                else {
-                  for (size_t i = 0; i < *n; i++) {
-                    free(names[i]);
-                  }
-                  free(names);
-                  for (size_t i = 0; i < *total; i++) {
-                    free(games[i]);
-                  }
-                  free(games);
-                  free(winner);
-                  free(loser);
-                  return NULL;
-                }
-                    
-              }
-          case NEWLINE:
-          // need to error check
-              if (c == '\n') {
-                  if (!gmap_contains_key(*vertices, winner)) {
-                      size_t *ptr = malloc(sizeof(size_t));
-                      *ptr = index;
-                      gmap_put(*vertices, winner, ptr);
-                      index++;
-                      (*n)++;
-                      if (*n > capacity) {
-                        names = realloc(names, sizeof(char*)*capacity*2);
-                        capacity *=2;
-                      }
-                      names[*n-1] = duplicate(winner);
-
-                  }
-                  if (!gmap_contains_key(*vertices,loser)) {
-                      size_t *ptr = malloc(sizeof(size_t));
-                      *ptr = index;
-                      gmap_put(*vertices, loser, ptr);
-                      index++;
-                      (*n)++; 
-                      if (*n > capacity) {
-                        names = realloc(names, sizeof(char*)*capacity*2);
-                        capacity *=2;
-                      }
-                      names[*n - 1] = duplicate(loser);
-
-                  }
-                  //fprintf(stderr, "winner: %s, loser: %s\n", winner, loser);
-                  // lugraph_add_edge(g, (size_t)gmap_get(g->vertices, winner), (size_t)gmap_get(g->vertices, loser));
-                  if (*total + 2 > game_capacity) {
-                    games = realloc(games, sizeof(char*)*game_capacity*2);
-                    game_capacity*=2;
-                  }
-                  games[(*total)++] = duplicate(winner);
-                  games[(*total)++] = duplicate(loser);
-                  charpos = 0;
-                  leadingspace = 1;
-                  tailingspace = 0;
-                  commafound = 0;
-                  curr = START;
-                  // lines++;
-                  break;
-              }
-              else if (c == ' '){
-                  break;
-              }
-              else {
-                for (size_t i = 0; i < *n; i++) {
-                  free(names[i]);
-                }
-                free(names);
-                for (size_t i = 0; i < *total; i++) {
-                  free(games[i]);
-                }
-                free(games);
-                free(winner);
-                free(loser);
-                return NULL;
-                     
-              }
-      }
+  // the input is mapped or read in large blocks and parsed in place
+  inbuf *in = inbuf_open(stream);
+  if (in == NULL) {
+    return NULL;
   }
-  if (*total == 0) {
-    free(games);
+  games_error error;
+  char **names;
+  size_t count;
+  size_t *games = games_parse(in, total, &names, &count, &error);
+  inbuf_close(in);
+  if (games == NULL) {
+    if (error.line > 0) {
+      fprintf(stderr, "line %zu, column %zu: %s\n", error.line, error.column, error.message);
+    }
+    else {
+      fprintf(stderr, "%s\n", error.message);
+    }
+    return NULL;
+  }
+
+  // the names are indexed in order of first appearance, and the map from
+  // names to indices is filled from them once
+  bool ok = *total > 0;
+  for (size_t i = 0; ok && i < count; i++) {
+    size_t *ptr = malloc(sizeof(size_t));
+    ok = ptr != NULL && gmap_put(*vertices, names[i], ptr);
+    if (ok) {
+      *ptr = i;
+    }
+    else {
+      free(ptr);
+    }
+  }
+  if (!ok) {
+    for (size_t i = 0; i < count; i++) {
+      free(names[i]);
+    }
     free(names);
-    free(winner);
-    free(loser);
+    free(games);
     return NULL;
   }
-  // if (lines * 2 != *total) {
-  //   for (size_t i = 0; i < *n; i++) {
-  //     free(names[i]);
-  //   }
-  //   for (size_t i = 0; i < *total; i++) {
-  //     free(games[i]);
-  //   }
-  //   free(games);
-  //   free(names);
-  //   free(winner);
-  //   free(loser);
-  //   return NULL;
-  // }
-
-
-  // not gonna work because theyupdate at the same time
-  // if (*total != lines * 2) {
-  //   for (size_t i = 0; i < *n; i++) {
-  //     free(names[i]);
-  //   }
-  //   free(names);
-  //   for (size_t i = 0; i < *total; i++) {
-  //     free(games[i]);
-  //   }
-  //   free(games);
-  //   free(winner);
-  //   free(loser);
-  //   return NULL;
-  // }
+  *n = count;
   *names_holder = names;
-  // if (*total < game_capacity) {
-  //   char** new = realloc(games, (*total)*sizeof(char*));
-  //   if (new != NULL) {
-  //     games = new;
-  //   }
-  // }
-  // if (*n < capacity) {
-  //   char ** new = realloc(names, (*n)*sizeof(char*));
-  //   if (new != NULL) {
-  //     names = new;
-  //   }
-  // }
-  // free(names);
-  free(winner);
-  free(loser);
   return games;
 }
 
@@ -965,17 +1092,13 @@ char** read_input(FILE *stream, size_t *n, gmap **vertices, size_t *total, char*
 bool cycle(lugraph *g) {
   int cycle = 0;
   lug_search *dfs = lugraph_dfs(g, 0, &cycle);
-  for (int i = 0; i < g->n; i++) {
-      if (cycle == 1) {
-        lug_search_destroy(dfs);
-        return true;
-      }
+  for (int i = 0; i < g->n && cycle == 0; i++) {
       if (dfs->color[i] == DFS_UNSEEN) {
         lugraph_dfs_visit(g, dfs, i, &cycle);
       }
   }
   lug_search_destroy(dfs);
-  return false;
+  return cycle == 1;
 }
 
 // int* order(lugraph *g, gmap* holder, char** names) {
@@ -1041,18 +1164,26 @@ bool cycle(lugraph *g) {
 // }
 
 int wrong_way(lugraph *g, int* ordered) {
-  gmap* hold = gmap_create(duplicate, compare_keys, hash29, free);
+  // with the position of every vertex in the ranking an edge is
+  // wrong-way when its head is ranked above its tail
+  size_t *pos = malloc(sizeof(size_t) * g->n);
+  if (pos == NULL) {
+    return -1;
+  }
+  for (size_t i = 0; i < g->n; i++) {
+    pos[ordered[i]] = i;
+  }
   int wrong_way = 0;
-  gmap_put(hold, &ordered[0], NULL);
-  for (int i = 1; i < g->n; i++) {
-    for (int j = 0; j < g->list_size[ordered[i]]; j++) {
-      if (gmap_contains_key(hold, &g->adj[ordered[i]][j])) {
+  for (size_t v = 0; v < g->n; v++) {
+    size_t count;
+    const size_t *adj = lugraph_out_edges(g, v, &count);
+    for (size_t j = 0; j < count; j++) {
+      if (pos[adj[j]] < pos[v]) {
         wrong_way++;
       }
     }
-    gmap_put(hold, &ordered[i], NULL);
   }
-  gmap_destroy(hold);
+  free(pos);
   return wrong_way;
 }
 
@@ -1235,52 +1366,163 @@ int wrong_way(lugraph *g, int* ordered) {
 //   s->color[from] = DFS_DONE;
 // }
 
-void dfs(lugraph *g, int* ordered) {
-  for (int i = 0; i < g->n; i++) {
-    lug_search *dfs = ludfs(g, i);
-    int arr[g->n];
-    for (int j = 0; j < g->n; j++) {
-      arr[j] = j;
-    }
-    int *next = order_array(g, arr);
-    for (int j = 0; j < g->n; j++) {
-        if (dfs->color[next[j]] == DFS_UNSEEN) {
-          lu_dfs_visit(g, dfs, next[j]);
-        }
+bool dfs(lugraph *g, int* ordered) {
+  return dfs_threads(g, ordered, parallel_processors());
+}
+
+bool dfs_threads(lugraph *g, int *ordered, size_t threads) {
+  // a search from start vertex s visits s, then every vertex it can reach,
+  // taking out-neighbors best first by dfs_comp, then starts again from
+  // the best unvisited vertex until all are visited; the ranking is the
+  // order of first visits, and the best ranking of any start is kept,
+  // the earliest start winning ties.  The sorted orders are the same for
+  // every start, so they are computed once here
+  if (!lugraph_freeze(g)) {
+    return false;
+  }
+  dfs_job job;
+  job.g = g;
+  job.by_rank = malloc(sizeof(size_t) * g->n);
+  job.next = malloc(sizeof(size_t) * (g->offsets[g->n] > 0 ? g->offsets[g->n] : 1));
+  size_t *fill = malloc(sizeof(size_t) * g->n);
+  dfs_struct *input = malloc(sizeof(dfs_struct) * g->n);
+  dfs_struct *out = malloc(sizeof(dfs_struct) * g->n);
+  if (job.by_rank == NULL || job.next == NULL || fill == NULL || input == NULL || out == NULL) {
+    free(job.by_rank);
+    free(job.next);
+    free(fill);
+    free(input);
+    free(out);
+    return false;
+  }
+
+  for (size_t i = 0; i < g->n; i++) {
+    input[i].vertex = i;
+    input[i].outdegree = g->outdegrees[i];
+    input[i].indegree = g->indegrees[i];
+  }
+  merge_sort(g->n, sizeof(dfs_struct), input, out, dfs_comp);
+  for (size_t i = 0; i < g->n; i++) {
+    job.by_rank[i] = out[i].vertex;
+    fill[i] = g->offsets[i];
+  }
+  free(input);
+  free(out);
+
+  // taking the vertices in order and appending each to the rows of its
+  // in-neighbors sorts every row at once
+  for (size_t i = 0; i < g->n; i++) {
+    size_t v = job.by_rank[i];
+    size_t count;
+    const size_t *in = lugraph_in_edges(g, v, &count);
+    for (size_t j = 0; j < count; j++) {
+      job.next[fill[in[j]]++] = v;
     }
-    free(next);
-    
+  }
+  free(fill);
+
+  pthread_mutex_init(&job.lock, NULL);
+  job.best_score = SIZE_MAX;
+  job.best_start = g->n;
+  job.best = ordered;
+  parallel_for(g->n, threads, dfs_starts, &job);
+  pthread_mutex_destroy(&job.lock);
+  free(job.by_rank);
+  free(job.next);
+
+  // a block of starts that could not allocate its search found nothing,
+  // and if none could there is no ranking
+  return g->n == 0 || job.best_start < g->n;
+}
+
+void dfs_starts(size_t begin, size_t end, void *arg) {
+  dfs_job *job = arg;
+  const lugraph *g = job->g;
+  unsigned char *seen = malloc(g->n);
+  size_t *stack = malloc(sizeof(size_t) * g->n);
+  size_t *cursor = malloc(sizeof(size_t) * g->n);
+  int *visited = malloc(sizeof(int) * g->n);
+  if (seen == NULL || stack == NULL || cursor == NULL || visited == NULL) {
+    free(seen);
+    free(stack);
+    free(cursor);
+    free(visited);
+    return;
+  }
 
-    if (i == 0) {
-      for (int j = 0; j < g->n; j++) {
-        ordered[j] = (int)dfs->visited[j];
-        fprintf(stderr, "%d ", ordered[j]);
-        
+  for (size_t start = begin; start < end; start++) {
+    pthread_mutex_lock(&job->lock);
+    size_t best_score = job->best_score;
+    size_t best_start = job->best_start;
+    pthread_mutex_unlock(&job->lock);
+
+    memset(seen, 0, g->n);
+    size_t count = 0;
+    size_t score = 0;
+    size_t next_root = 0;
+    size_t root = start;
+    bool beaten = false;
+    while (!beaten && count < g->n) {
+      // a vertex's wrong-way edges are its edges to vertices placed
+      // before it, so the score is known as the ranking is built and a
+      // search that cannot win is abandoned
+      size_t depth = 0;
+      stack[depth++] = root;
+      seen[root] = 1;
+      visited[count++] = root;
+      cursor[root] = g->offsets[root];
+      while (depth > 0 && !beaten) {
+        size_t v = stack[depth - 1];
+        if (cursor[v] == g->offsets[v]) {
+          for (size_t j = g->offsets[v]; j < g->offsets[v + 1]; j++) {
+            if (seen[g->targets[j]] && g->targets[j] != v) {
+              score += g->weights != NULL ? g->weights[j] : 1;
+            }
+          }
+          if (count % DFS_BEST_CHECK == 0) {
+            pthread_mutex_lock(&job->lock);
+            best_score = job->best_score;
+            best_start = job->best_start;
+            pthread_mutex_unlock(&job->lock);
+          }
+          beaten = score > best_score || (score == best_score && start > best_start);
+        }
+        while (cursor[v] < g->offsets[v + 1] && seen[job->next[cursor[v]]]) {
+          cursor[v]++;
+        }
+        if (cursor[v] < g->offsets[v + 1]) {
+          size_t w = job->next[cursor[v]++];
+          seen[w] = 1;
+          visited[count++] = w;
+          cursor[w] = g->offsets[w];
+          stack[depth++] = w;
+        }
+        else {
+          depth--;
+        }
       }
-      fprintf(stderr, "\n");
-    }
-    else {
-      int* pos = malloc(sizeof(int)*g->n);
-      for (int j = 0; j < g->n; j++) {
-        pos[j] = (int)dfs->visited[j];
-        fprintf(stderr, "%d ", pos[j]);
+      while (count < g->n && seen[job->by_rank[next_root]]) {
+        next_root++;
       }
-      fprintf(stderr, "\n");
-      int curr = wrong_way(g, pos);
-      int min = wrong_way(g, ordered);
-      if (curr < min) {
-        //fprintf(stderr, "here");
-        for (int j = 0; j < g->n; j++) {
-          ordered[j] = (int)dfs->visited[j];
-        } 
+      if (count < g->n) {
+        root = job->by_rank[next_root];
       }
-      free(pos);
     }
-    lug_search_destroy(dfs);
-    
+
+    if (!beaten) {
+      pthread_mutex_lock(&job->lock);
+      if (score < job->best_score || (score == job->best_score && start < job->best_start)) {
+        job->best_score = score;
+        job->best_start = start;
+        memcpy(job->best, visited, sizeof(int) * g->n);
+      }
+      pthread_mutex_unlock(&job->lock);
+    }
   }
-    
-  
+  free(seen);
+  free(stack);
+  free(cursor);
+  free(visited);
 }
 
 int dfs_comp(const void *p1, const void *p2)
@@ -1311,51 +1553,6 @@ int dfs_comp(const void *p1, const void *p2)
   }
 }
 
-void lu_dfs_visit(lugraph* g, lug_search *s, size_t from) {
-  s->color[from] = DFS_ACTIVE;
-  s->visited[s->visit_count++] = from;
-  int *next = next_dfs(g, from);
-  for (size_t i = 0; i < g->list_size[from]; i++) {    
-    if (s->color[next[i]] == DFS_UNSEEN) {
-      s->pred[next[i]] = from;
-      lu_dfs_visit(g, s, next[i]);
-    }
-  }
-  s->color[from] = DFS_DONE;
-  free(next);
-}
-
-lug_search *ludfs(lugraph *g, size_t from)
-{
-  if (g == NULL || from < 0 || from >= g->n)
-    {
-      return NULL;
-    }
-  // TO DO: initialize search results and start recursion
-  lug_search *s = lug_search_create(g, from);
-  lu_dfs_visit(g, s, from);
-  return s;
-}
-
-int* order_array(lugraph *g, int *arr) {
-  //dfs_struct *input = malloc(sizeof(edge)*(g->list_size[from]));
-  dfs_struct input[g->n];
-
-  for (int i = 0; i < g->n; i++) {
-    input[i].vertex = arr[i];
-    input[i].outdegree = g->outdegrees[arr[i]];
-    input[i].indegree = g->indegrees[arr[i]];
-  }
-
-  dfs_struct out[g->n];
-  merge_sort(g->n, sizeof(dfs_struct), &input, &out, dfs_comp);
-  int *ordered_vertices = malloc(sizeof(int)*g->n);
-  for (int i = 0; i < g->n; i++) {
-    ordered_vertices[i] = out[i].vertex;
-  }
-  return ordered_vertices;
-}
-
 // int *updated_topo(lugraph *g, int* indeg, int *ordered, int* size) {
 //   int number = 0;
 //   if (*size == 0) {
@@ -1399,107 +1596,487 @@ int* order_array(lugraph *g, int *arr) {
 // }
 
 int *topological(lugraph *g) {
-  int *color = calloc(g->n, sizeof(int));
-  if (color == NULL) {
+  // Kahn's algorithm: the sources go first, best by topo_compare, then
+  // the vertices that removing them makes sources, and so on.  Taking
+  // the queue a layer at a time gives the vertices of each layer in
+  // topo_compare order; a vertex is in the layer after that of the last
+  // of its in-neighbors to be removed
+  size_t *indegree = malloc(sizeof(size_t) * g->n);
+  topo_sort *heap = malloc(sizeof(topo_sort) * g->n);
+  int *ordered = malloc(sizeof(int) * g->n);
+  if (indegree == NULL || heap == NULL || ordered == NULL) {
+    free(indegree);
+    free(heap);
+    free(ordered);
     return NULL;
   }
-  int number = 0;
-  for (int i = 0; i < g->n; i++) {
-    if (g->indegrees[i] == 0) {
-      number++;
+
+  // the counters count edges: in a weighted graph g->indegrees holds
+  // weights, which would keep a vertex from ever becoming a source
+  size_t queued = 0;
+  for (size_t i = 0; i < g->n; i++) {
+    indegree[i] = g->frozen ? g->in_offsets[i + 1] - g->in_offsets[i] : g->indegrees[i];
+    if (indegree[i] == 0) {
+      topo_sort entry = {i, 0, g->outdegrees[i], 0};
+      topo_heap_push(heap, &queued, entry);
     }
   }
-  // look at the outvertices of what you have then remove one from each of the indegrees
-  //fprintf(stderr, "number: %d\n", number);
-  // for the ones you are subtracting, just look at those to see if they are 0. 
-  topo_sort input[number];
-  int count = 0;
-  for (int i = 0; i < g->n; i++) {
-    if (g->indegrees[i] == 0) {
-      input[count].vertex = i;
-      input[count].outdegree = g->outdegrees[i];
-      color[i] = 1;
-      count++;
+
+  size_t size = 0;
+  while (queued > 0) {
+    topo_sort next = topo_heap_pop(heap, &queued);
+    ordered[size++] = next.vertex;
+    size_t count;
+    const size_t *adj = lugraph_out_edges(g, next.vertex, &count);
+    for (size_t j = 0; j < count; j++) {
+      if (--indegree[adj[j]] == 0) {
+        topo_sort entry = {adj[j], 0, g->outdegrees[adj[j]], next.layer + 1};
+        topo_heap_push(heap, &queued, entry);
+      }
     }
   }
-  topo_sort out[number];
-  int* size = malloc(sizeof(int));
-  if (size == NULL) {
-    free(color);
+  free(indegree);
+  free(heap);
+
+  // the vertices on or after a cycle never become sources
+  if (size < g->n) {
+    free(ordered);
     return NULL;
   }
-  *size = 0;
-  merge_sort(number, sizeof(topo_sort), &input, &out, topo_compare);
-  int *ordered = malloc(sizeof(int)*g->n);
-  if (ordered == NULL) {
-    free(color);
-    free(size);
+  return ordered;
+}
+
+size_t lugraph_components(const lugraph *g, size_t *component)
+{
+  // Tarjan's algorithm with an explicit stack for the search.  A vertex
+  // is on the component stack while its component is LUGRAPH_NO_COMPONENT;
+  // a component is complete when the search leaves its first vertex, sinks
+  // first, so the numbers are reversed at the end
+  size_t *index = malloc(sizeof(size_t) * g->n);
+  size_t *low = malloc(sizeof(size_t) * g->n);
+  size_t *cursor = malloc(sizeof(size_t) * g->n);
+  size_t *path = malloc(sizeof(size_t) * g->n);
+  size_t *stack = malloc(sizeof(size_t) * g->n);
+  if (index == NULL || low == NULL || cursor == NULL || path == NULL || stack == NULL) {
+    free(index);
+    free(low);
+    free(cursor);
+    free(path);
+    free(stack);
+    return 0;
+  }
+  for (size_t v = 0; v < g->n; v++) {
+    index[v] = LUGRAPH_NO_COMPONENT;
+    component[v] = LUGRAPH_NO_COMPONENT;
+  }
+
+  size_t next_index = 0;
+  size_t found = 0;
+  size_t top = 0;
+  for (size_t root = 0; root < g->n; root++) {
+    if (index[root] != LUGRAPH_NO_COMPONENT) {
+      continue;
+    }
+    size_t depth = 0;
+    path[depth++] = root;
+    index[root] = low[root] = next_index++;
+    stack[top++] = root;
+    cursor[root] = 0;
+    while (depth > 0) {
+      size_t v = path[depth - 1];
+      size_t count;
+      const size_t *adj = lugraph_out_edges(g, v, &count);
+      if (cursor[v] < count) {
+        size_t w = adj[cursor[v]++];
+        if (index[w] == LUGRAPH_NO_COMPONENT) {
+          index[w] = low[w] = next_index++;
+          stack[top++] = w;
+          cursor[w] = 0;
+          path[depth++] = w;
+        }
+        else if (component[w] == LUGRAPH_NO_COMPONENT && index[w] < low[v]) {
+          low[v] = index[w];
+        }
+      }
+      else {
+        depth--;
+        if (depth > 0 && low[v] < low[path[depth - 1]]) {
+          low[path[depth - 1]] = low[v];
+        }
+        if (low[v] == index[v]) {
+          size_t w;
+          do {
+            w = stack[--top];
+            component[w] = found;
+          } while (w != v);
+          found++;
+        }
+      }
+    }
+  }
+  for (size_t v = 0; v < g->n; v++) {
+    component[v] = found - 1 - component[v];
+  }
+  free(index);
+  free(low);
+  free(cursor);
+  free(path);
+  free(stack);
+  return found;
+}
+
+int *order_components(lugraph *g, rank_method method)
+{
+  // the components are ranked in topological order, so no edge between
+  // two of them is wrong-way, and each is ranked on its own, in parallel
+  component_job job;
+  size_t *component = malloc(sizeof(size_t) * g->n);
+  size_t *members = malloc(sizeof(size_t) * g->n);
+  size_t *local = malloc(sizeof(size_t) * g->n);
+  size_t *starts = malloc(sizeof(size_t) * (g->n + 1));
+  int *ordered = malloc(sizeof(int) * g->n);
+  bool *failed = calloc(g->n, sizeof(bool));
+  size_t count = component != NULL ? lugraph_components(g, component) : 0;
+  if (count == 0 || members == NULL || local == NULL || starts == NULL || ordered == NULL || failed == NULL) {
+    free(component);
+    free(members);
+    free(local);
+    free(starts);
+    free(ordered);
+    free(failed);
     return NULL;
   }
-  for (int i = 0; i < number; i++) {
-    ordered[*size] = out[i].vertex;
-    *size = *size + 1;
+
+  for (size_t c = 0; c <= count; c++) {
+    starts[c] = 0;
+  }
+  for (size_t v = 0; v < g->n; v++) {
+    starts[component[v] + 1]++;
+  }
+  for (size_t c = 0; c < count; c++) {
+    starts[c + 1] += starts[c];
+  }
+  // starts[c] is used as the next free slot in c's members, as in
+  // lugraph_fill_rows
+  for (size_t v = 0; v < g->n; v++) {
+    members[starts[component[v]]++] = v;
+  }
+  for (size_t c = count; c > 0; c--) {
+    starts[c] = starts[c - 1];
+  }
+  starts[0] = 0;
+  for (size_t c = 0; c < count; c++) {
+    for (size_t i = starts[c]; i < starts[c + 1]; i++) {
+      local[members[i]] = i - starts[c];
+    }
+  }
+  fprintf(stderr, "%zu strongly connected components\n", count);
+
+  job.g = g;
+  job.method = method;
+  job.component = component;
+  job.members = members;
+  job.starts = starts;
+  job.local = local;
+  job.ordered = ordered;
+  job.failed = failed;
+  // the components are spread over the processors, each ranked on one
+  // thread, except that the exact solver's table doubles with every
+  // vertex, so its components are solved one at a time, each across all
+  // the processors
+  size_t processors = parallel_processors();
+  job.threads = method == RANK_EXACT ? processors : 1;
+  if (method == RANK_EXACT) {
+    size_t large = 0;
+    for (size_t c = 0; c < count; c++) {
+      large += starts[c + 1] - starts[c] > LUGRAPH_EXACT_MAX;
+    }
+    if (large > 0) {
+      fprintf(stderr, "%zu components of more than %d vertices ranked by DFS, not exactly\n",
+              large, LUGRAPH_EXACT_MAX);
+    }
+  }
+  parallel_for(count, method == RANK_EXACT ? 1 : processors, rank_component_range, &job);
+
+  bool ok = true;
+  for (size_t c = 0; c < count; c++) {
+    ok = ok && !failed[c];
+  }
+  free(component);
+  free(members);
+  free(local);
+  free(starts);
+  free(failed);
+  if (!ok) {
+    free(ordered);
+    return NULL;
   }
-  topo_help(g, color, ordered, size);
-  free(color);
-  free(size);
   return ordered;
 }
 
-void topo_help(lugraph* g, int* color, int* ordered, int* size) {
-  int indegree[g->n];
-  for (int i = 0; i < g->n; i++) {
-    indegree[i] = 0;
+void rank_component_range(size_t begin, size_t end, void *arg)
+{
+  for (size_t c = begin; c < end; c++) {
+    rank_component(arg, c);
   }
-  for (int i = 0; i < g->n; i++) {
-    if (color[i] == 0) {
-      for (int j = 0; j < g->list_size[i]; j++) {
-        if (color[g->adj[i][j]] == 0) {
-          indegree[g->adj[i][j]]++;
+}
+
+void rank_component(component_job *job, size_t c)
+{
+  const lugraph *g = job->g;
+  size_t first = job->starts[c];
+  size_t k = job->starts[c + 1] - first;
+  int *ordered = job->ordered + first;
+  for (size_t i = 0; i < k; i++) {
+    ordered[i] = job->members[first + i];
+  }
+  if (k < 2) {
+    return;
+  }
+
+  size_t m = 0;
+  for (size_t i = 0; i < k; i++) {
+    size_t count;
+    const size_t *adj = lugraph_out_edges(g, job->members[first + i], &count);
+    for (size_t j = 0; j < count; j++) {
+      m += job->component[adj[j]] == c;
+    }
+  }
+  size_t *edges = malloc(sizeof(size_t) * 2 * m);
+  size_t *weights = lugraph_weighted(g) ? malloc(sizeof(size_t) * m) : NULL;
+  int *sub = malloc(sizeof(int) * k);
+  if (edges == NULL || sub == NULL || (lugraph_weighted(g) && weights == NULL)) {
+    free(edges);
+    free(weights);
+    free(sub);
+    job->failed[c] = true;
+    return;
+  }
+  size_t e = 0;
+  for (size_t i = 0; i < k; i++) {
+    size_t count;
+    const size_t *adj = lugraph_out_edges(g, job->members[first + i], &count);
+    const size_t *adj_weights = lugraph_out_weights(g, job->members[first + i]);
+    for (size_t j = 0; j < count; j++) {
+      if (job->component[adj[j]] == c) {
+        if (weights != NULL) {
+          weights[e / 2] = adj_weights[j];
         }
+        edges[e++] = i;
+        edges[e++] = job->local[adj[j]];
       }
     }
-    else {
-      indegree[i] = -1;
-    }
   }
+  lugraph *h = lugraph_create_weighted(k, NULL, NULL, edges, weights, m);
+  free(edges);
+  free(weights);
+  if (h == NULL) {
+    free(sub);
+    job->failed[c] = true;
+    return;
+  }
+  lugraph_add_degrees(h);
+
+  // a component of more than one vertex has a cycle, so the topological
+  // heuristic has nothing to go on inside it and the degrees are used
+  int *found = NULL;
+  bool ranked;
+  if (job->method == RANK_EXACT && k <= LUGRAPH_EXACT_MAX) {
+    ranked = (found = order_exact(h, job->threads)) != NULL;
+  }
+  else if (job->method == RANK_DFS || job->method == RANK_EXACT) {
+    ranked = dfs_threads(h, sub, job->threads);
+  }
+  else {
+    ranked = (found = order_degrees(h)) != NULL;
+  }
+  for (size_t i = 0; ranked && i < k; i++) {
+    ordered[i] = job->members[first + (found != NULL ? found[i] : sub[i])];
+  }
+  job->failed[c] = !ranked;
+  free(found);
+  free(sub);
+  lugraph_destroy(h);
+}
 
-  int number = 0;
-  for (int i = 0; i < g->n; i++) {
-    if (indegree[i] == 0) {
-      number++;
+int *order_exact(const lugraph *g, size_t threads)
+{
+  size_t n = g->n;
+  if (n > LUGRAPH_EXACT_MAX) {
+    return NULL;
+  }
+  size_t binom[LUGRAPH_EXACT_MAX + 1][LUGRAPH_EXACT_MAX + 1];
+  for (size_t b = 0; b <= n; b++) {
+    binom[b][0] = 1;
+    for (size_t j = 1; j <= n; j++) {
+      binom[b][j] = b == 0 ? 0 : binom[b - 1][j - 1] + binom[b - 1][j];
     }
   }
-  topo_sort input[number];
-  int count = 0;
-  for (int i = 0; i < g->n; i++) {
-    if (indegree[i] == 0) {
-      input[count].vertex = i;
-      input[count].outdegree = g->outdegrees[i];
-      color[i] = 1;
-      count++;
+  size_t widest = binom[n][n / 2];
+  int *ordered = malloc(sizeof(int) * (n > 0 ? n : 1));
+  uint32_t *out = malloc(sizeof(uint32_t) * (n > 0 ? n : 1));
+  size_t *prev = malloc(sizeof(size_t) * widest);
+  size_t *cur = malloc(sizeof(size_t) * widest);
+  unsigned char *last = malloc((size_t)1 << n);
+  if (ordered == NULL || out == NULL || prev == NULL || cur == NULL || last == NULL) {
+    free(ordered);
+    free(out);
+    free(prev);
+    free(cur);
+    free(last);
+    return NULL;
+  }
+  for (size_t v = 0; v < n; v++) {
+    size_t count;
+    const size_t *adj = lugraph_out_edges(g, v, &count);
+    out[v] = 0;
+    for (size_t j = 0; j < count; j++) {
+      out[v] |= (uint32_t)1 << adj[j];
     }
   }
-  topo_sort out[number];
-  merge_sort(number, sizeof(topo_sort), &input, &out, topo_compare);
-  for (int i = 0; i < number; i++) {
-    ordered[*size] = out[i].vertex;
-    *size = *size + 1;
+
+  exact_job job;
+  job.g = g;
+  job.n = n;
+  job.out = out;
+  job.binom = (const size_t (*)[LUGRAPH_EXACT_MAX + 1])binom;
+  job.last = last;
+  prev[0] = 0;
+  for (size_t k = 1; k <= n; k++) {
+    job.k = k;
+    job.prev = prev;
+    job.cur = cur;
+    parallel_for(binom[n][k], binom[n][k] < EXACT_PARALLEL_MIN ? 1 : threads, exact_layer, &job);
+    size_t *swap = prev;
+    prev = cur;
+    cur = swap;
+  }
+  fprintf(stderr, "exact: %zu vertices, least weight of wrong-way edges %zu\n", n, n > 0 ? prev[0] : 0);
+
+  // the last vertex of the whole set goes at the bottom, then the last
+  // of what is left above it, and so on up
+  uint32_t s = n > 0 ? (uint32_t)(((uint64_t)1 << n) - 1) : 0;
+  for (size_t i = n; i > 0; i--) {
+    ordered[i - 1] = last[s];
+    s &= ~((uint32_t)1 << last[s]);
   }
+  free(out);
+  free(prev);
+  free(cur);
+  free(last);
+  return ordered;
+}
 
-  int check = 0;
-  //fprintf(stderr, "Color: ");
-  for (int i = 0; i < g->n; i++) {
-    if (color[i]==0 && check == 0) {
-      check = 1;
+void exact_layer(size_t begin, size_t end, void *arg)
+{
+  const exact_job *job = arg;
+  size_t k = job->k;
+
+  // the subset numbered begin: its largest vertex is the largest b with
+  // binom[b][k] at most begin, then the rest of the number picks the
+  // other k - 1 below it the same way
+  uint32_t s = 0;
+  size_t r = begin;
+  size_t b = job->n;
+  for (size_t j = k; j > 0; j--) {
+    do {
+      b--;
+    } while (job->binom[b][j] > r);
+    s |= (uint32_t)1 << b;
+    r -= job->binom[b][j];
+  }
+
+  size_t bits[LUGRAPH_EXACT_MAX];
+  size_t after[LUGRAPH_EXACT_MAX];
+  for (size_t i = begin; i < end; i++) {
+    size_t count = 0;
+    for (uint32_t rest = s; rest != 0; rest &= rest - 1) {
+      bits[count++] = __builtin_ctz(rest);
+    }
+    // taking out bits[t] leaves the vertices below it in their places in
+    // the number and moves each one above it down a place
+    after[k - 1] = 0;
+    for (size_t t = k - 1; t > 0; t--) {
+      after[t - 1] = after[t] + job->binom[bits[t]][t];
+    }
+    size_t before = 0;
+    size_t best = SIZE_MAX;
+    size_t best_v = 0;
+    for (size_t t = 0; t < k; t++) {
+      size_t v = bits[t];
+      size_t score = job->prev[before + after[t]] + exact_cost(job, v, s & ~((uint32_t)1 << v));
+      if (score < best) {
+        best = score;
+        best_v = v;
+      }
+      before += job->binom[v][t + 1];
+    }
+    job->cur[i] = best;
+    job->last[s] = best_v;
+
+    // the next subset in colex order is the next larger mask with k bits
+    // set (Gosper's hack)
+    if (i + 1 < end) {
+      uint32_t low = s & -s;
+      uint32_t up = s + low;
+      s = (((up ^ s) >> 2) / low) | up;
     }
-    //fprintf(stderr, "%d ", color[i]);
   }
-  //fprintf(stderr, "\n");
-  if (check == 1) {
-    topo_help(g, color, ordered, size);
+}
+
+size_t exact_cost(const exact_job *job, size_t v, uint32_t above)
+{
+  const size_t *weights = lugraph_out_weights(job->g, v);
+  if (weights == NULL) {
+    return __builtin_popcount(job->out[v] & above);
   }
-  
+  size_t count;
+  const size_t *adj = lugraph_out_edges(job->g, v, &count);
+  size_t cost = 0;
+  for (size_t j = 0; j < count; j++) {
+    if (above >> adj[j] & 1) {
+      cost += weights[j];
+    }
+  }
+  return cost;
+}
+
+int topo_heap_compare(const topo_sort *q1, const topo_sort *q2)
+{
+  if (q1->layer != q2->layer) {
+    return q1->layer < q2->layer ? -1 : 1;
+  }
+  return topo_compare(q1, q2);
+}
+
+void topo_heap_push(topo_sort *heap, size_t *size, topo_sort entry)
+{
+  size_t i = (*size)++;
+  while (i > 0 && topo_heap_compare(&entry, &heap[(i - 1) / 2]) < 0) {
+    heap[i] = heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  heap[i] = entry;
+}
+
+topo_sort topo_heap_pop(topo_sort *heap, size_t *size)
+{
+  topo_sort top = heap[0];
+  topo_sort last = heap[--(*size)];
+  size_t i = 0;
+  while (2 * i + 1 < *size) {
+    size_t child = 2 * i + 1;
+    if (child + 1 < *size && topo_heap_compare(&heap[child + 1], &heap[child]) < 0) {
+      child++;
+    }
+    if (topo_heap_compare(&heap[child], &last) >= 0) {
+      break;
+    }
+    heap[i] = heap[child];
+    i = child;
+  }
+  heap[i] = last;
+  return top;
 }
 
 int topo_compare(const void *p1, const void *p2)
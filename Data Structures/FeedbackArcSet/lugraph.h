@@ -1,6 +1,7 @@
 #ifndef __LUGRAPH_H__
 #define __LUGRAPH_H__
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include "gmap.h"
@@ -13,6 +14,14 @@ typedef struct dfs_struct dfs_struct;
 typedef struct degree_sort degree_sort;
 typedef struct topo_sort topo_sort;
 
+// the heuristics order_components can run inside each component, or the
+// exact solver
+typedef enum {RANK_DEGREE, RANK_TOPO, RANK_DFS, RANK_EXACT} rank_method;
+
+// the most vertices order_exact takes; its table needs a byte for every
+// subset of the vertices, 32MB at 25
+#define LUGRAPH_EXACT_MAX 25
+
 /**
  * Creates a new undirected graph with the given number of vertices.  The
  * vertices will be numbered 0, ..., n-1.
@@ -22,6 +31,117 @@ typedef struct topo_sort topo_sort;
  */
 lugraph *lugraph_create(size_t n, gmap *vertices, char** names);
  
+/**
+ * Creates a new graph with the given number of vertices and the given
+ * directed edges, stored as compressed sparse rows: one array of the
+ * out-neighbors of every vertex, in vertex order, with an array of
+ * offsets into it, and likewise for in-neighbors.  The rows are filled in
+ * two passes over the edge list, counting and then placing, so a graph
+ * with millions of edges costs a few large allocations.  The graph is
+ * frozen: lugraph_add_edge does nothing.  Edges that lugraph_add_edge
+ * would not add are left out.
+ *
+ * @param n a positive integer
+ * @param vertices the map from names to vertex indices
+ * @param names the name of each vertex
+ * @param edges an array of m pairs of vertex indices, each the from
+ * vertex followed by the to vertex
+ * @param m the number of edges
+ * @return a pointer to the new graph, or NULL if there was an allocation
+ * error
+ */
+lugraph *lugraph_create_edges(size_t n, gmap *vertices, char** names, const size_t *edges, size_t m);
+
+/**
+ * Creates a graph as lugraph_create_edges does, with a weight on each
+ * edge.  The degrees, the hueristics and rank_eval then count an edge as
+ * many times as its weight.
+ *
+ * @param n a positive integer
+ * @param vertices the map from names to vertex indices
+ * @param names the name of each vertex
+ * @param edges an array of m pairs of vertex indices, each the from
+ * vertex followed by the to vertex
+ * @param weights the weight of each edge, or NULL for an unweighted graph
+ * @param m the number of edges
+ * @return a pointer to the new graph, or NULL if there was an allocation
+ * error
+ */
+lugraph *lugraph_create_weighted(size_t n, gmap *vertices, char** names, const size_t *edges, const size_t *weights, size_t m);
+
+/**
+ * Freezes the given graph: its adjacency lists are replaced by
+ * compressed sparse rows as built by lugraph_create_edges, keeping the
+ * order of each list, and no more edges can be added.  Searches and
+ * rankings read frozen graphs from contiguous memory.
+ *
+ * @param g a pointer to a graph, non-NULL
+ * @return false if there was an allocation error, in which case the
+ * graph is unchanged
+ */
+bool lugraph_freeze(lugraph *g);
+
+/**
+ * Determines whether the given graph is frozen.
+ *
+ * @param g a pointer to a graph, non-NULL
+ * @return true if the graph is stored as compressed sparse rows
+ */
+bool lugraph_frozen(const lugraph *g);
+
+/**
+ * Returns the out-neighbors of the given vertex in the order their edges
+ * were added.  The graph retains ownership of the array, which remains
+ * valid until the graph changes.
+ *
+ * @param g a pointer to a graph, non-NULL
+ * @param v the index of a vertex in the given graph
+ * @param count a pointer to a location for the number of neighbors
+ * @return a pointer to the first neighbor
+ */
+const size_t *lugraph_out_edges(const lugraph *g, size_t v, size_t *count);
+
+/**
+ * Returns the in-neighbors of the given vertex of a frozen graph in the
+ * order their edges were added.  The graph retains ownership of the
+ * array.
+ *
+ * @param g a pointer to a frozen graph, non-NULL
+ * @param v the index of a vertex in the given graph
+ * @param count a pointer to a location for the number of neighbors, 0
+ * if the graph is not frozen
+ * @return a pointer to the first neighbor
+ */
+const size_t *lugraph_in_edges(const lugraph *g, size_t v, size_t *count);
+
+/**
+ * Returns the weights of the edges out of the given vertex, in the same
+ * order as lugraph_out_edges.
+ *
+ * @param g a pointer to a graph, non-NULL
+ * @param v the index of a vertex in the given graph
+ * @return a pointer to the first weight, or NULL if every edge weighs 1
+ */
+const size_t *lugraph_out_weights(const lugraph *g, size_t v);
+
+/**
+ * Returns the weights of the edges into the given vertex, in the same
+ * order as lugraph_in_edges.
+ *
+ * @param g a pointer to a graph, non-NULL
+ * @param v the index of a vertex in the given graph
+ * @return a pointer to the first weight, or NULL if every edge weighs 1
+ */
+const size_t *lugraph_in_weights(const lugraph *g, size_t v);
+
+/**
+ * Determines whether the given graph has weights on its edges.
+ *
+ * @param g a pointer to a graph, non-NULL
+ * @return true if the graph was created with weights
+ */
+bool lugraph_weighted(const lugraph *g);
+
 /**
  * checks for errror in the graph creation
  * @param g a pointer to an undirected graph, non-NULL
@@ -48,7 +168,7 @@ size_t lugraph_size(const lugraph *g);
 /**
  * Adds an undirected edge between the given pair of vertices to
  * the given undirected graph.  The behavior is undefined if the edge
- * already exists.
+ * already exists.  Does nothing if the graph is frozen.
  *
  * @param g a pointer to an undirected graph, non-NULL
  * @param v1 the index of a vertex in the given graph
@@ -129,15 +249,18 @@ size_t *lug_search_visited(const lug_search *s, size_t *n);
 void lug_search_destroy(lug_search *s);
 
 /**
- * reads the input of the fine character by character and returns a list with all the team battles
- * @param g a pointer to an undirected graph, non-NULL
+ * reads the input with games_parse (see games.h) and returns a list with all the team battles
+ * as vertex indices, putting each name in vertices once; malformed input is reported on
+ * standard error by line and column
+ * @param stream the input
  * @param n point to int
  * @param vertices pointer to a gmap
- * @param total pointer to an int
+ * @param total pointer to an int, set to twice the number of games
  * @param names_holder pointer to an array to hold the names of the teams
- * @return the number of vertices in that graph
+ * @return a malloced array of the winner and then the loser of each game,
+ * or NULL if the input is malformed or empty
  */
-char** read_input(FILE *stream, size_t *n, gmap **vertices, size_t *total, char*** names_holder);
+size_t *read_input(FILE *stream, size_t *n, gmap **vertices, size_t *total, char*** names_holder);
 
 /**
  * checks for cycles
@@ -147,20 +270,25 @@ char** read_input(FILE *stream, size_t *n, gmap **vertices, size_t *total, char*
 bool cycle(lugraph *g);
 
 /**
- * checks for wrong way edges
+ * checks for wrong way edges, edges from a vertex to one ranked above it,
+ * in one pass over the edges using the position of each vertex (see
+ * rank_eval.h to rescore a ranking as it changes)
  * @param ordered a pointer to a malloced array
  * @param g a pointer to an undirected graph, non-NULL
- * @return the number of vertices in that graph
+ * @return the number of wrong way edges, or -1 if there was an
+ * allocation error
  */
 int wrong_way(lugraph *g, int* ordered);
 
 /**
  * sorts dfs hueristic
- * @param ordered a pointer to a malloced array
+ * @param ordered a pointer to a malloced array of one entry per vertex,
+ * set to the ranking, best first
  * @param g a pointer to an undirected graph, non-NULL
- * @return the number of vertices in that graph
+ * @return true if ordered was set, false if the graph could not be frozen
+ * or there was an allocation error
  */
-void dfs(lugraph *g, int* ordered);
+bool dfs(lugraph *g, int* ordered);
 
 /**
  * for adding degrees to a struct
@@ -198,10 +326,61 @@ float* lugraph_ratios(lugraph *g);
 int* order_degrees(lugraph *g);
 
 /**
- * sorts with the topological hueristic
+ * sorts with the topological hueristic, in O((V + E) log V) time
  * @param g a pointer to an undirected graph, non-NULL
- * @return the number of vertices in that graph
+ * @return a malloced array of the vertices in topological order, or NULL
+ * if the graph has a cycle or there was an allocation error
  */
 int *topological(lugraph *g);
 
+/**
+ * finds the strongly connected components of the given graph with
+ * Tarjan's algorithm, in O(V + E) time without recursion.  The components
+ * are numbered in topological order: every edge between two components
+ * goes from the lower number to the higher
+ * @param g a pointer to a graph, non-NULL
+ * @param component an array of one entry per vertex, set to the number of
+ * the vertex's component
+ * @return the number of components, or 0 if there was an allocation error
+ */
+size_t lugraph_components(const lugraph *g, size_t *component);
+
+/**
+ * finds a ranking with the least weight of wrong way edges (their number
+ * if the graph is unweighted) by dynamic programming over subsets: the
+ * best score of ranking a set of vertices first is the least, over its
+ * vertices v, of the best score of the rest plus the weight of v's edges
+ * into the rest, which for an unweighted graph is the popcount of v's
+ * out-neighbor mask and the rest.  The sets are done a layer of equal
+ * size at a time, across the given number of threads, keeping the scores
+ * of only two layers and a byte per set for the vertex ranked last, so it
+ * takes O(2^n n) time and about 2^n + 16 C(n, n/2) bytes.  Ties go to the
+ * ranking that puts lower numbered vertices last, so the result does not
+ * depend on the number of threads.  Parallel edges count once in an
+ * unweighted graph
+ * @param g a pointer to a graph, non-NULL, with at most LUGRAPH_EXACT_MAX
+ * vertices
+ * @param threads the number of threads to use, at least 1
+ * @return a malloced array of the vertices, best first, or NULL if g has
+ * too many vertices or there was an allocation error
+ */
+int *order_exact(const lugraph *g, size_t threads);
+
+/**
+ * sorts each strongly connected component with the given hueristic, in
+ * parallel, and the components in topological order, so that no edge
+ * between components is wrong way.  Inside a component of more than one
+ * vertex the topological hueristic falls back to the degree one.  With
+ * RANK_EXACT each component is solved exactly, one at a time across all
+ * the processors, which makes the whole ranking optimal since an optimal
+ * ranking never needs an edge between components to be wrong way;
+ * components of more than LUGRAPH_EXACT_MAX vertices fall back to the DFS
+ * hueristic
+ * @param g a pointer to a graph, non-NULL
+ * @param method the hueristic to run inside each component
+ * @return a malloced array of the vertices, best first, or NULL if there
+ * was an allocation error
+ */
+int *order_components(lugraph *g, rank_method method);
+
 #endif
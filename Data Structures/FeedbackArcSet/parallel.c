@@ -0,0 +1,228 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+typedef struct parallel_block
+{
+  size_t begin;
+  size_t end;
+  void (*body)(size_t, size_t, void *);
+  void *arg;
+  pthread_t thread;
+  bool started;
+} parallel_block;
+
+typedef struct parallel_worker
+{
+  struct parallel_pool *pool;
+  size_t index;   // the block this thread does
+  pthread_t thread;
+} parallel_worker;
+
+struct parallel_pool
+{
+  size_t threads;   // workers started, plus the calling thread
+  parallel_worker *workers;
+  pthread_mutex_t lock;
+  pthread_cond_t work;  // signalled when a loop starts or the pool stops
+  pthread_cond_t done;  // signalled when the last worker finishes a loop
+
+  // the current loop; each worker does its block once per generation
+  void (*body)(size_t, size_t, void *);
+  void *arg;
+  size_t n;
+  size_t generation;
+  size_t pending;   // workers still busy with the current loop
+  bool stop;
+};
+
+void *parallel_run(void *p);
+
+/**
+ * Waits for loops from parallel_pool_for and does the given worker's
+ * block of each until the pool is destroyed.
+ */
+void *parallel_serve(void *p);
+
+void parallel_for(size_t n, size_t threads, void (*body)(size_t begin, size_t end, void *arg), void *arg)
+{
+  if (threads > n) {
+    threads = n;
+  }
+  if (threads <= 1) {
+    if (n > 0) {
+      body(0, n, arg);
+    }
+    return;
+  }
+
+  parallel_block *blocks = malloc(sizeof(parallel_block) * threads);
+  if (blocks == NULL) {
+    body(0, n, arg);
+    return;
+  }
+
+  // block t gets items [t * n / threads, (t + 1) * n / threads); the
+  // calling thread does block 0 after starting the others
+  for (size_t t = 0; t < threads; t++) {
+    blocks[t].begin = t * n / threads;
+    blocks[t].end = (t + 1) * n / threads;
+    blocks[t].body = body;
+    blocks[t].arg = arg;
+    blocks[t].started = t > 0 && pthread_create(&blocks[t].thread, NULL, parallel_run, &blocks[t]) == 0;
+  }
+
+  for (size_t t = 0; t < threads; t++) {
+    if (!blocks[t].started) {
+      body(blocks[t].begin, blocks[t].end, arg);
+    }
+  }
+  for (size_t t = 1; t < threads; t++) {
+    if (blocks[t].started) {
+      pthread_join(blocks[t].thread, NULL);
+    }
+  }
+  free(blocks);
+}
+
+void *parallel_run(void *p)
+{
+  parallel_block *block = p;
+  block->body(block->begin, block->end, block->arg);
+  return NULL;
+}
+
+parallel_pool *parallel_pool_create(size_t threads)
+{
+  parallel_pool *pool = malloc(sizeof(parallel_pool));
+  if (pool == NULL) {
+    return NULL;
+  }
+  pool->workers = malloc(sizeof(parallel_worker) * (threads > 1 ? threads - 1 : 1));
+  if (pool->workers == NULL) {
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pool->body = NULL;
+  pool->arg = NULL;
+  pool->n = 0;
+  pool->generation = 0;
+  pool->pending = 0;
+  pool->stop = false;
+
+  // worker t - 1 does block t; if a thread cannot be started the pool
+  // makes do with those that were
+  pool->threads = 1;
+  while (pool->threads < threads) {
+    parallel_worker *w = &pool->workers[pool->threads - 1];
+    w->pool = pool;
+    w->index = pool->threads;
+    if (pthread_create(&w->thread, NULL, parallel_serve, w) != 0) {
+      break;
+    }
+    pool->threads++;
+  }
+  return pool;
+}
+
+void parallel_pool_for(parallel_pool *pool, size_t n, void (*body)(size_t begin, size_t end, void *arg), void *arg)
+{
+  if (pool->threads <= 1 || n <= 1) {
+    if (n > 0) {
+      body(0, n, arg);
+    }
+    return;
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->body = body;
+  pool->arg = arg;
+  pool->n = n;
+  pool->generation++;
+  pool->pending = pool->threads - 1;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  if (n / pool->threads > 0) {
+    body(0, n / pool->threads, arg);
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void *parallel_serve(void *p)
+{
+  parallel_worker *w = p;
+  parallel_pool *pool = w->pool;
+  size_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (pool->generation == seen && !pool->stop) {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+    if (pool->stop) {
+      break;
+    }
+    seen = pool->generation;
+
+    // the same split as parallel_for; with fewer items than threads some
+    // blocks are empty
+    size_t begin = w->index * pool->n / pool->threads;
+    size_t end = (w->index + 1) * pool->n / pool->threads;
+    void (*body)(size_t, size_t, void *) = pool->body;
+    void *arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+    if (begin < end) {
+      body(begin, end, arg);
+    }
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+size_t parallel_pool_size(const parallel_pool *pool)
+{
+  return pool->threads;
+}
+
+void parallel_pool_destroy(parallel_pool *pool)
+{
+  if (pool == NULL) {
+    return;
+  }
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t t = 1; t < pool->threads; t++) {
+    pthread_join(pool->workers[t - 1].thread, NULL);
+  }
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->workers);
+  free(pool);
+}
+
+size_t parallel_processors()
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+}
@@ -0,0 +1,201 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "games.h"
+#include "gmap.h"
+#include "inbuf.h"
+#include "lugraph.h"
+#include "string_key.h"
+
+/**
+ * Benchmarks reading game results: games_parse on its own, and
+ * read_input, which also fills the map from names to vertices that Rank
+ * uses.
+ *
+ * USAGE: ParseBench [-games N] [-teams T] [-seed X] [-file FILE]
+ *
+ * By default the input is N games between teams drawn uniformly from T
+ * teams, written to a temporary file; with -file the given file is parsed
+ * instead.  For a realistic load use tens of millions of games.
+ */
+
+/**
+ * Returns the next value of the given splitmix64 generator, so that the
+ * generated games are the same on every platform.
+ */
+uint64_t next_random(uint64_t *state);
+
+/**
+ * Writes the given number of random games to the given stream.
+ *
+ * @return the number of bytes written
+ */
+size_t generate_games(FILE *out, size_t games, size_t teams, uint64_t seed);
+
+void free_value(const void *key, void *value, void *arg);
+
+double now();
+long peak_rss_kb();
+
+int main(int argc, char **argv)
+{
+    size_t games = 1000000;
+    size_t teams = 1000;
+    uint64_t seed = 1;
+    const char *path = NULL;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "-games") == 0 && a + 1 < argc && atol(argv[a + 1]) > 0) {
+            games = atol(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-teams") == 0 && a + 1 < argc && atol(argv[a + 1]) > 1) {
+            teams = atol(argv[++a]);
+        }
+        else if (strcmp(argv[a], "-seed") == 0 && a + 1 < argc) {
+            seed = strtoull(argv[++a], NULL, 10);
+        }
+        else if (strcmp(argv[a], "-file") == 0 && a + 1 < argc) {
+            path = argv[++a];
+        }
+        else {
+            fprintf(stderr, "USAGE: %s [-games N] [-teams T] [-seed X] [-file FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    FILE *text = path != NULL ? fopen(path, "r") : tmpfile();
+    if (text == NULL) {
+        fprintf(stderr, "Could not open input\n");
+        return 1;
+    }
+    size_t bytes;
+    if (path == NULL) {
+        double start = now();
+        bytes = generate_games(text, games, teams, seed);
+        fflush(text);
+        printf("generate     %10.6f s\n", now() - start);
+    }
+    else {
+        fseek(text, 0, SEEK_END);
+        bytes = ftell(text);
+    }
+
+    // games_parse alone
+    rewind(text);
+    double start = now();
+    inbuf *in = inbuf_open(text);
+    if (in == NULL) {
+        fprintf(stderr, "Allocation error\n");
+        return 1;
+    }
+    bool mapped = inbuf_mapped(in);
+    size_t total;
+    size_t n;
+    char **names;
+    games_error error;
+    size_t *ids = games_parse(in, &total, &names, &n, &error);
+    inbuf_close(in);
+    double parse_time = now() - start;
+    if (ids == NULL) {
+        fprintf(stderr, "line %zu, column %zu: %s\n", error.line, error.column, error.message);
+        return 1;
+    }
+    uint64_t checksum = 0;
+    for (size_t i = 0; i < total; i++) {
+        checksum = checksum * 31 + ids[i];
+    }
+    for (size_t i = 0; i < n; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(ids);
+
+    // read_input, as Rank reads its input
+    rewind(text);
+    gmap *vertices = gmap_create(duplicate, compare_keys, hash29, free);
+    if (vertices == NULL) {
+        fprintf(stderr, "Allocation error\n");
+        return 1;
+    }
+    size_t read_n = 0;
+    size_t read_total = 0;
+    start = now();
+    ids = read_input(text, &read_n, &vertices, &read_total, &names);
+    double read_time = now() - start;
+    if (ids == NULL) {
+        return 1;
+    }
+    uint64_t read_checksum = 0;
+    for (size_t i = 0; i < read_total; i++) {
+        read_checksum = read_checksum * 31 + ids[i];
+    }
+
+    printf("input: %zu games, %zu teams, %zu bytes, %s\n", total / 2, n, bytes, mapped ? "mapped" : "buffered");
+    printf("games_parse  %10.6f s %14.0f games/s %10.1f MB/s\n", parse_time, total / 2 / parse_time, bytes / parse_time / 1e6);
+    printf("read_input   %10.6f s %14.0f games/s %10.1f MB/s, games %s\n", read_time, read_total / 2 / read_time,
+           bytes / read_time / 1e6, read_checksum == checksum && read_total == total ? "match" : "DIFFER");
+    printf("checksum: %llu\n", (unsigned long long)checksum);
+    printf("peak RSS: %ld KB\n", peak_rss_kb());
+
+    for (size_t i = 0; i < read_n; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(ids);
+    gmap_for_each(vertices, free_value, NULL);
+    gmap_destroy(vertices);
+    fclose(text);
+    return 0;
+}
+
+size_t generate_games(FILE *out, size_t games, size_t teams, uint64_t seed)
+{
+    uint64_t state = seed;
+    size_t bytes = 0;
+    for (size_t i = 0; i < games; i++) {
+        size_t winner = next_random(&state) % teams;
+        size_t loser = next_random(&state) % (teams - 1);
+        if (loser >= winner) {
+            loser++;
+        }
+        int len = fprintf(out, "\"Team %zu\",\"Team %zu\"\n", winner, loser);
+        bytes += len > 0 ? len : 0;
+    }
+    return bytes;
+}
+
+uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+void free_value(const void *key, void *value, void *arg)
+{
+    free(value);
+}
+
+double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long peak_rss_kb()
+{
+    // ru_maxrss is in kilobytes on Linux
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return usage.ru_maxrss;
+}
@@ -0,0 +1,299 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "rank_eval.h"
+#include "lugraph.h"
+#include "mergesort.h"
+
+// a neighbor of a vertex being moved: where it is, and how the score
+// changes when the vertex moves past it
+typedef struct rank_move
+{
+  size_t pos;
+  long change;
+} rank_move;
+
+struct rank_eval
+{
+  const lugraph *g;
+  size_t n;
+  int *order;     // the ranking, best first
+  size_t *pos;    // the inverse: the position of each vertex
+  size_t score;   // the total weight of the wrong-way edges
+  rank_move *moves;  // room for the neighbors of any one vertex
+  rank_move *sorted;
+};
+
+/**
+ * Compares two rank_moves by position.
+ */
+int rank_move_compare(const void *p1, const void *p2);
+
+/**
+ * Adds up the weights of the edges to the neighbors in the given row whose
+ * positions are in [lo, hi), counting 1 for each if weights is NULL.
+ */
+long rank_eval_count_between(const rank_eval *e, const size_t *row, const size_t *weights, size_t count,
+                             size_t lo, size_t hi);
+
+rank_eval *rank_eval_create(const lugraph *g, const int *ordered)
+{
+  if (!lugraph_frozen(g)) {
+    return NULL;
+  }
+
+  rank_eval *e = malloc(sizeof(rank_eval));
+  if (e == NULL) {
+    return NULL;
+  }
+  e->g = g;
+  e->n = lugraph_size(g);
+  size_t most = 1;
+  for (size_t v = 0; v < e->n; v++) {
+    size_t out_count, in_count;
+    lugraph_out_edges(g, v, &out_count);
+    lugraph_in_edges(g, v, &in_count);
+    if (out_count + in_count > most) {
+      most = out_count + in_count;
+    }
+  }
+  e->order = malloc(sizeof(int) * e->n);
+  e->pos = malloc(sizeof(size_t) * e->n);
+  e->moves = malloc(sizeof(rank_move) * most);
+  e->sorted = malloc(sizeof(rank_move) * most);
+  if (e->order == NULL || e->pos == NULL || e->moves == NULL || e->sorted == NULL) {
+    free(e->order);
+    free(e->pos);
+    free(e->moves);
+    free(e->sorted);
+    free(e);
+    return NULL;
+  }
+
+  memcpy(e->order, ordered, sizeof(int) * e->n);
+  for (size_t i = 0; i < e->n; i++) {
+    e->pos[ordered[i]] = i;
+  }
+
+  // one pass over the rows: an edge is wrong-way when its head is ranked
+  // above its tail
+  e->score = 0;
+  for (size_t v = 0; v < e->n; v++) {
+    size_t count;
+    const size_t *out = lugraph_out_edges(g, v, &count);
+    const size_t *weights = lugraph_out_weights(g, v);
+    for (size_t j = 0; j < count; j++) {
+      if (e->pos[out[j]] < e->pos[v]) {
+        e->score += weights != NULL ? weights[j] : 1;
+      }
+    }
+  }
+  return e;
+}
+
+size_t rank_eval_score(const rank_eval *e)
+{
+  return e->score;
+}
+
+const int *rank_eval_order(const rank_eval *e)
+{
+  return e->order;
+}
+
+size_t rank_eval_position(const rank_eval *e, int v)
+{
+  return e->pos[v];
+}
+
+long rank_eval_count_between(const rank_eval *e, const size_t *row, const size_t *weights, size_t count,
+                             size_t lo, size_t hi)
+{
+  long found = 0;
+  for (size_t j = 0; j < count; j++) {
+    size_t p = e->pos[row[j]];
+    if (p >= lo && p < hi) {
+      found += weights != NULL ? (long)weights[j] : 1;
+    }
+  }
+  return found;
+}
+
+long rank_eval_move_delta(const rank_eval *e, size_t from, size_t to)
+{
+  if (from == to) {
+    return 0;
+  }
+
+  // only the order of the moving vertex and the vertices it passes
+  // changes: moving down, its out-edges to them become wrong-way and its
+  // in-edges from them become right, and the other way around moving up
+  int v = e->order[from];
+  size_t out_count, in_count;
+  const size_t *out = lugraph_out_edges(e->g, v, &out_count);
+  const size_t *in = lugraph_in_edges(e->g, v, &in_count);
+  const size_t *out_weights = lugraph_out_weights(e->g, v);
+  const size_t *in_weights = lugraph_in_weights(e->g, v);
+  if (from < to) {
+    return rank_eval_count_between(e, out, out_weights, out_count, from + 1, to + 1)
+      - rank_eval_count_between(e, in, in_weights, in_count, from + 1, to + 1);
+  }
+  else {
+    return rank_eval_count_between(e, in, in_weights, in_count, to, from)
+      - rank_eval_count_between(e, out, out_weights, out_count, to, from);
+  }
+}
+
+long rank_eval_move(rank_eval *e, size_t from, size_t to)
+{
+  long delta = rank_eval_move_delta(e, from, to);
+  int v = e->order[from];
+  if (from < to) {
+    memmove(e->order + from, e->order + from + 1, sizeof(int) * (to - from));
+    for (size_t i = from; i < to; i++) {
+      e->pos[e->order[i]] = i;
+    }
+  }
+  else if (to < from) {
+    memmove(e->order + to + 1, e->order + to, sizeof(int) * (from - to));
+    for (size_t i = to + 1; i <= from; i++) {
+      e->pos[e->order[i]] = i;
+    }
+  }
+  e->order[to] = v;
+  e->pos[v] = to;
+  e->score += delta;
+  return delta;
+}
+
+long rank_eval_swap_delta(const rank_eval *e, size_t i, size_t j)
+{
+  if (i == j) {
+    return 0;
+  }
+  if (j < i) {
+    size_t t = i;
+    i = j;
+    j = t;
+  }
+
+  // u moves down past everything in (i, j], v included, and v moves up
+  // past everything in (i, j); the edges between u and v are counted
+  // with u's
+  int u = e->order[i];
+  int v = e->order[j];
+  size_t u_out_count, u_in_count, v_out_count, v_in_count;
+  const size_t *u_out = lugraph_out_edges(e->g, u, &u_out_count);
+  const size_t *u_in = lugraph_in_edges(e->g, u, &u_in_count);
+  const size_t *v_out = lugraph_out_edges(e->g, v, &v_out_count);
+  const size_t *v_in = lugraph_in_edges(e->g, v, &v_in_count);
+  return rank_eval_count_between(e, u_out, lugraph_out_weights(e->g, u), u_out_count, i + 1, j + 1)
+    - rank_eval_count_between(e, u_in, lugraph_in_weights(e->g, u), u_in_count, i + 1, j + 1)
+    + rank_eval_count_between(e, v_in, lugraph_in_weights(e->g, v), v_in_count, i + 1, j)
+    - rank_eval_count_between(e, v_out, lugraph_out_weights(e->g, v), v_out_count, i + 1, j);
+}
+
+long rank_eval_swap(rank_eval *e, size_t i, size_t j)
+{
+  long delta = rank_eval_swap_delta(e, i, j);
+  int u = e->order[i];
+  e->order[i] = e->order[j];
+  e->order[j] = u;
+  e->pos[e->order[i]] = i;
+  e->pos[e->order[j]] = j;
+  e->score += delta;
+  return delta;
+}
+
+size_t rank_eval_best_move(rank_eval *e, size_t from, long *delta)
+{
+  // moving down past a vertex it has an edge to makes that edge wrong-way
+  // and moving up past one fixes it; the other way around for edges in
+  int v = e->order[from];
+  size_t out_count, in_count;
+  const size_t *out = lugraph_out_edges(e->g, v, &out_count);
+  const size_t *in = lugraph_in_edges(e->g, v, &in_count);
+  const size_t *out_weights = lugraph_out_weights(e->g, v);
+  const size_t *in_weights = lugraph_in_weights(e->g, v);
+  size_t count = 0;
+  for (size_t j = 0; j < out_count; j++) {
+    long weight = out_weights != NULL ? (long)out_weights[j] : 1;
+    e->moves[count].pos = e->pos[out[j]];
+    e->moves[count++].change = e->pos[out[j]] > from ? weight : -weight;
+  }
+  for (size_t j = 0; j < in_count; j++) {
+    long weight = in_weights != NULL ? (long)in_weights[j] : 1;
+    e->moves[count].pos = e->pos[in[j]];
+    e->moves[count++].change = e->pos[in[j]] > from ? -weight : weight;
+  }
+  merge_sort(count, sizeof(rank_move), e->moves, e->sorted, rank_move_compare);
+
+  // the score only changes as the vertex passes a neighbor, so the best
+  // places are at neighbors; neighbors below are passed nearest first
+  // going down, and those above nearest first going up
+  size_t first_below = 0;
+  while (first_below < count && e->sorted[first_below].pos < from) {
+    first_below++;
+  }
+  size_t best = from;
+  long best_delta = 0;
+  long sum = 0;
+  for (size_t j = first_below; j < count; j++) {
+    sum += e->sorted[j].change;
+    if ((j + 1 == count || e->sorted[j + 1].pos != e->sorted[j].pos) && sum < best_delta) {
+      best = e->sorted[j].pos;
+      best_delta = sum;
+    }
+  }
+  sum = 0;
+  for (size_t j = first_below; j > 0; j--) {
+    sum += e->sorted[j - 1].change;
+    if ((j == 1 || e->sorted[j - 2].pos != e->sorted[j - 1].pos)
+        && (sum < best_delta || (sum == best_delta && sum < 0 && from - e->sorted[j - 1].pos < best - from))) {
+      best = e->sorted[j - 1].pos;
+      best_delta = sum;
+    }
+  }
+  *delta = best_delta;
+  return best;
+}
+
+long rank_eval_sift(rank_eval *e, size_t first, size_t count)
+{
+  long total = 0;
+  for (size_t v = first; v < first + count; v++) {
+    long delta;
+    size_t to = rank_eval_best_move(e, e->pos[v], &delta);
+    if (delta < 0) {
+      total += rank_eval_move(e, e->pos[v], to);
+    }
+  }
+  return total;
+}
+
+int rank_move_compare(const void *p1, const void *p2)
+{
+  const rank_move *m1 = p1;
+  const rank_move *m2 = p2;
+  if (m1->pos < m2->pos) {
+    return -1;
+  }
+  else if (m1->pos > m2->pos) {
+    return 1;
+  }
+  else {
+    return 0;
+  }
+}
+
+void rank_eval_destroy(rank_eval *e)
+{
+  if (e != NULL) {
+    free(e->order);
+    free(e->pos);
+    free(e->moves);
+    free(e->sorted);
+    free(e);
+  }
+}
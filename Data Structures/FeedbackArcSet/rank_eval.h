@@ -0,0 +1,136 @@
+#ifndef __RANK_EVAL_H__
+#define __RANK_EVAL_H__
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "lugraph.h"
+
+struct rank_eval;
+typedef struct rank_eval rank_eval;
+
+/**
+ * Creates an evaluator for rankings of the vertices of the given graph,
+ * starting at the given ranking.  The evaluator keeps the ranking, the
+ * position of every vertex in it and its score, the total weight of the
+ * wrong-way edges (edges from a vertex to one ranked above it), which for
+ * an unweighted graph is their number.  It updates them as vertices are
+ * moved, looking only at the edges of the vertices that move.
+ *
+ * @param g a pointer to a frozen graph, non-NULL, which must outlive the
+ * evaluator
+ * @param ordered an array holding each vertex of g once, best first
+ * @return a pointer to the evaluator, or NULL if g is not frozen or there
+ * was an allocation error; it is the caller's responsibility to destroy
+ * the evaluator
+ */
+rank_eval *rank_eval_create(const lugraph *g, const int *ordered);
+
+/**
+ * Returns the total weight of the wrong-way edges of the current ranking.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @return the score
+ */
+size_t rank_eval_score(const rank_eval *e);
+
+/**
+ * Returns the current ranking.  The evaluator retains ownership of the
+ * array, which changes as vertices are moved.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @return an array of the vertices, best first
+ */
+const int *rank_eval_order(const rank_eval *e);
+
+/**
+ * Returns the position of the given vertex in the current ranking.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param v a vertex
+ * @return its position, 0 for the best
+ */
+size_t rank_eval_position(const rank_eval *e, int v);
+
+/**
+ * Returns how much the score would change if the
+ * vertex at position from were moved to position to, the vertices in
+ * between shifting over by one, without moving it.  Takes time
+ * proportional to the degree of the vertex.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param from a position in the ranking
+ * @param to a position in the ranking
+ * @return the change in the score, negative for an improvement
+ */
+long rank_eval_move_delta(const rank_eval *e, size_t from, size_t to);
+
+/**
+ * Moves the vertex at position from to position to, shifting the
+ * vertices in between over by one, and updates the score.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param from a position in the ranking
+ * @param to a position in the ranking
+ * @return the change in the score
+ */
+long rank_eval_move(rank_eval *e, size_t from, size_t to);
+
+/**
+ * Returns how much the score would change if the
+ * vertices at the two given positions traded places, without swapping
+ * them.  Takes time proportional to the degrees of the two vertices.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param i a position in the ranking
+ * @param j a position in the ranking
+ * @return the change in the score, negative for an improvement
+ */
+long rank_eval_swap_delta(const rank_eval *e, size_t i, size_t j);
+
+/**
+ * Swaps the vertices at the two given positions and updates the score.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param i a position in the ranking
+ * @param j a position in the ranking
+ * @return the change in the score
+ */
+long rank_eval_swap(rank_eval *e, size_t i, size_t j);
+
+/**
+ * Finds the position the vertex at the given position would best be
+ * moved to: the one with the lowest score, the nearest of those
+ * if there is a tie.  Only the positions next to the vertex's neighbors
+ * can be best, so this takes time proportional to d log d for a vertex
+ * of degree d.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param from a position in the ranking
+ * @param delta a pointer to a location for the change in the score a
+ * move there would make, 0 if from is best
+ * @return the best position, from if no move improves the ranking
+ */
+size_t rank_eval_best_move(rank_eval *e, size_t from, long *delta);
+
+/**
+ * Sifts the given vertices: moves each in turn to its best position if
+ * that improves the ranking.  Repeating until a pass over all the vertices
+ * changes nothing gives a ranking that no single move improves.
+ *
+ * @param e a pointer to an evaluator, non-NULL
+ * @param first the first vertex to sift
+ * @param count the number of vertices to sift, with first + count at most
+ * the number of vertices
+ * @return the change in the score, 0 or negative
+ */
+long rank_eval_sift(rank_eval *e, size_t first, size_t count);
+
+/**
+ * Destroys the given evaluator.
+ *
+ * @param e a pointer to an evaluator
+ */
+void rank_eval_destroy(rank_eval *e);
+
+#endif
@@ -1,19 +1,86 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <time.h>
 
 #include "lugraph.h"
+#include "rank_eval.h"
+#include "edgecount.h"
 #include "gmap.h"
 #include "string_key.h"
 
+// how many vertices are sifted between looks at the clock
+#define REFINE_CHUNK 256
+
+// how repeated games between two teams become an edge: one unweighted
+// edge for the majority, one edge weighted by the net margin, or an edge
+// each way weighted by the wins
+typedef enum {WEIGHT_NONE, WEIGHT_MARGIN, WEIGHT_TOTAL} weight_mode;
+
 void free_value(const void *key, void *value, void *arg);
 
+/**
+ * Prints the score line of the given ranking: the number of wrong-way
+ * edges and, for a weighted graph, their total weight after it.
+ *
+ * @param g a pointer to a frozen graph, non-NULL
+ * @param ordered an array holding each vertex of g once, best first
+ * @param wrong the number of wrong-way edges of the ranking
+ */
+void print_score(const lugraph *g, const int *ordered, int wrong);
+
+/**
+ * Improves the given ranking by sifting vertices to their best positions
+ * until no move helps or the given number of seconds is up, reporting the
+ * score (the weight of the wrong-way edges) after each pass on standard
+ * error.
+ *
+ * @param g a pointer to a frozen graph, non-NULL
+ * @param ordered an array holding each vertex of g once, best first,
+ * replaced by the refined ranking
+ * @param seconds the time allowed
+ */
+void refine(const lugraph *g, int *ordered, double seconds);
+
+/**
+ * Returns the number of seconds since some fixed time.
+ */
+double now(void);
+
 int main(int argc, char **argv)
 {
-    if (argc != 2) {
-        fprintf(stderr, "Only two arguments allowed\n");
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s -degree|-topo|-dfs|-exact [-scc] [-refine seconds] [-margin|-total]\n", argv[0]);
         return 1;
     }
+    double refine_seconds = 0.0;
+    bool scc = false;
+    weight_mode weighting = WEIGHT_NONE;
+    for (int a = 2; a < argc; a++) {
+        if (strcmp(argv[a], "-scc") == 0) {
+            scc = true;
+        }
+        else if (strcmp(argv[a], "-margin") == 0) {
+            weighting = WEIGHT_MARGIN;
+        }
+        else if (strcmp(argv[a], "-total") == 0) {
+            weighting = WEIGHT_TOTAL;
+        }
+        else if (strcmp(argv[a], "-refine") == 0 && a + 1 < argc) {
+            refine_seconds = atof(argv[++a]);
+            if (refine_seconds <= 0.0) {
+                fprintf(stderr, "Invalid refine time\n");
+                return 1;
+            }
+        }
+        else {
+            fprintf(stderr, "usage: %s -degree|-topo|-dfs|-exact [-scc] [-refine seconds] [-margin|-total]\n", argv[0]);
+            return 1;
+        }
+    }
 
     gmap *vertices = gmap_create(duplicate, compare_keys, hash29, free);
     if (vertices == NULL) {
@@ -24,7 +91,7 @@ int main(int argc, char **argv)
     size_t n = 0;
     size_t total = 0;
     char **names_holder = NULL;
-    char** games = read_input(stdin, &n, &vertices, &total, &names_holder);
+    size_t *games = read_input(stdin, &n, &vertices, &total, &names_holder);
     if (games == NULL || names_holder == NULL) {
         gmap_for_each(vertices, free_value, NULL);
         gmap_destroy(vertices);
@@ -32,7 +99,7 @@ int main(int argc, char **argv)
         return 1;
     }
     for (int i=0; i < total; i++) {
-        fprintf(stderr, "%s, %s\n", games[i], games[i + 1]);
+        fprintf(stderr, "%s, %s\n", names_holder[games[i]], names_holder[games[i + 1]]);
         i++;
     }
 
@@ -54,48 +121,16 @@ int main(int argc, char **argv)
     }
     fprintf(stderr, "\n");
 
-    gmap** adjset = malloc(sizeof(gmap*)*n);
+    // the head-to-head counts, keyed on (winner, loser) pairs; there are
+    // at most as many distinct pairs as games
+    edgecount *adjset = edgecount_create(total / 2);
     if (adjset == NULL) {
         gmap_for_each(vertices, free_value, NULL);
         gmap_destroy(vertices);
         return 1;
     }
-    for (int i = 0; i < n; i++) {
-        adjset[i] = gmap_create(duplicate, compare_keys, hash29, free);
-        if (adjset[i] == NULL) {
-            free(adjset);
-            gmap_for_each(vertices, free_value, NULL);
-            gmap_destroy(vertices);
-            return 1;
-        }
-    }
-    for (int i = 0; i < total; i++) {
-        char* winner = games[i];
-        char* loser = games[i+1];
-        size_t winner_vertex = *(size_t*)gmap_get(vertices, winner);
-        //int loser_vertex = *(int*)gmap_get(vertices, loser);
-        if (gmap_contains_key(adjset[winner_vertex], loser)) {
-            size_t* reciever = (size_t*)gmap_get(adjset[winner_vertex], loser);
-            //int other = *(int*)gmap_get(adjset[loser_vertex], winner);
-            (*reciever)++;
-            // fprintf(stderr, "winner - loser: %s - %s %d\n", winner, loser, *(int*)gmap_get(adjset[winner_vertex], loser));
-        }
-        else {
-            size_t* ptr = malloc(sizeof(size_t));
-            if (ptr == NULL) {
-                free(adjset);
-                gmap_for_each(vertices, free_value, NULL);
-                gmap_destroy(vertices);
-            }
-            *ptr = 1;
-
-            if (!gmap_put(adjset[winner_vertex], loser, ptr)) {
-                // ADD FREES
-                return 1;
-            }
-            // fprintf(stderr, "winner: %s %d\n", winner, *ptr);
-        }
-        i++;
+    for (size_t i = 0; i < total; i += 2) {
+        edgecount_add(adjset, games[i], games[i + 1]);
     }
 
 
@@ -133,36 +168,57 @@ int main(int argc, char **argv)
     // }
 
     // char** final = malloc(sizeof(char*)*total);
-    char* final[total];
+    lugraph *g = NULL;
+    int status = 0;
+    size_t *final = malloc(sizeof(size_t) * (total > 0 ? total : 1));
+    size_t *weights = weighting != WEIGHT_NONE ? malloc(sizeof(size_t) * (total / 2 > 0 ? total / 2 : 1)) : NULL;
+    if (final == NULL || (weighting != WEIGHT_NONE && weights == NULL)) {
+        fprintf(stderr, "Allocation error\n");
+        status = 1;
+        goto destroy;
+    }
     // int *other;
     size_t number = 0;
     for (size_t i = 0; i < total; i++) {
-        char* winner = games[i];
-        char* loser = games[i+1];
-
-        size_t loss = *(size_t*)gmap_get(vertices, loser);
-        size_t win = *(size_t*)gmap_get(vertices, winner);
+        size_t win = games[i];
+        size_t loss = games[i+1];
 
-        size_t* other = (size_t*)gmap_get(adjset[win], loser);
-        size_t* reciever = (size_t*)gmap_get(adjset[loss], winner);
+        size_t* other = edgecount_get(adjset, win, loss);
+        size_t* reciever = edgecount_get(adjset, loss, win);
 
-        if (reciever == NULL) {
+        if (weighting == WEIGHT_TOTAL) {
+            // every pair that won a game keeps its edge, weighted by the
+            // wins, whatever the other way
+            if (*other != 0) {
+                weights[number / 2] = *other;
+                final[number++] = win;
+                final[number++] = loss;
+                *other = 0;
+            }
+        }
+        else if (reciever == NULL) {
             if (*other != 0) {
-                final[number++] = names_holder[win];
-                final[number++] = names_holder[loss];
+                if (weights != NULL) {
+                    weights[number / 2] = *other;
+                }
+                final[number++] = win;
+                final[number++] = loss;
                 *other = 0;
                 
-                fprintf(stderr, "here: %ld\n",*(size_t*)gmap_get(adjset[win], loser));
+                fprintf(stderr, "here: %ld\n", *other);
                 //fprintf(stderr,"HEEEEEE\n");
                 }
         }
         //fprintf(stderr, "# of wins by winner: %d...# of wins by loser: %d\n", *other, *reciever);
         else if (*reciever < *other) {
-            final[number++] = names_holder[win];
-            final[number++] = names_holder[loss];
+            if (weights != NULL) {
+                weights[number / 2] = *other - *reciever;
+            }
+            final[number++] = win;
+            final[number++] = loss;
             *other = 0;
             *reciever = 0;
-            //fprintf(stderr, "here: %ld\n",*(size_t*)gmap_get(adjset[loss], winner));
+            //fprintf(stderr, "here: %ld\n", *reciever);
         }
 
         i++;
@@ -188,19 +244,20 @@ int main(int argc, char **argv)
     //     i++;
     // }
     for (size_t i=0; i < number; i++) {
-        fprintf(stderr, "%s, %s\n", final[i], final[i + 1]);
+        fprintf(stderr, "%s, %s\n", names_holder[final[i]], names_holder[final[i + 1]]);
         i++;
     }
 
-    lugraph* g = lugraph_create(n, vertices, names_holder);
+    // the graph is built in one go from the edge list as compressed rows
+    g = lugraph_create_weighted(n, vertices, names_holder, final, weights, number / 2);
+    free(final);
+    free(weights);
+    final = NULL;
+    weights = NULL;
     if (g == NULL) {
         fprintf(stderr, "Graph create error\n");
-        return 1;
-    }
-
-    for (size_t i = 0; i < number; i++) {
-        lugraph_add_edge(g, *(size_t*)gmap_get(vertices, final[i]), *(size_t*)gmap_get(vertices, final[i+1]));
-        i++;
+        status = 1;
+        goto destroy;
     }
     fprintf(stderr, "\n");
     print_adj_list(g, names_holder);
@@ -223,10 +280,18 @@ int main(int argc, char **argv)
     if (strcmp(argv[1], "-degree") == 0) {
         // gmap *holder = degree(g, names_holder);
         // int *ordered = order(g, holder, names_holder);
-        int *ordered = order_degrees(g);
+        int *ordered = scc ? order_components(g, RANK_DEGREE) : order_degrees(g);
+        if (ordered == NULL) {
+            fprintf(stderr, "Ranking error\n");
+            status = 1;
+            goto destroy;
+        }
+        if (refine_seconds > 0.0) {
+            refine(g, ordered, refine_seconds);
+        }
         int wrong = wrong_way(g, ordered);
         fprintf(stderr, "\n");
-        printf("%d\n", wrong);
+        print_score(g, ordered, wrong);
         for (int i = 0; i < n; i++) {
             printf("%s\n", names_holder[ordered[i]]);
         }
@@ -235,38 +300,51 @@ int main(int argc, char **argv)
         
     }
     else if (strcmp(argv[1], "-topo") == 0) {
-        if (!cycle(g)) {
-            int *ordered = topological(g);
-            if (ordered == NULL) {
-                goto destroy;
-            }
-            int wrong = wrong_way(g, ordered);
-            fprintf(stderr, "\n");
-            printf("%d\n", wrong);
-            for (int i = 0; i < n; i++) {
-                printf("%s\n", names_holder[ordered[i]]);
-            }
-            fprintf(stderr, "\n");
-            free(ordered);
+        // with a cycle the components can still be sorted topologically
+        bool components = scc || cycle(g);
+        if (components) {
+            fprintf(stderr, "sorting the strongly connected components\n");
         }
-        else {
-            fprintf(stderr, "there is a cycle so can't sort topologically\n");
+        int *ordered = components ? order_components(g, RANK_TOPO) : topological(g);
+        if (ordered == NULL) {
+            fprintf(stderr, "Ranking error\n");
+            status = 1;
+            goto destroy;
         }
-        
-        
+        if (refine_seconds > 0.0) {
+            refine(g, ordered, refine_seconds);
+        }
+        int wrong = wrong_way(g, ordered);
+        fprintf(stderr, "\n");
+        print_score(g, ordered, wrong);
+        for (int i = 0; i < n; i++) {
+            printf("%s\n", names_holder[ordered[i]]);
+        }
+        fprintf(stderr, "\n");
+        free(ordered);
     }
     else if (strcmp(argv[1], "-dfs") == 0) {
         
-        int *ordered = malloc(sizeof(int)*n);
+        int *ordered = scc ? order_components(g, RANK_DFS) : malloc(sizeof(int)*n);
         if (ordered == NULL) {
+            fprintf(stderr, "Ranking error\n");
+            status = 1;
             goto destroy;
         }
         //ordered = NULL;
-        dfs(g, ordered);
+        if (!scc && !dfs(g, ordered)) {
+            free(ordered);
+            fprintf(stderr, "Ranking error\n");
+            status = 1;
+            goto destroy;
+        }
+        if (refine_seconds > 0.0) {
+            refine(g, ordered, refine_seconds);
+        }
         int wrong = wrong_way(g, ordered);
         
         fprintf(stderr, "\n");
-        printf("%d\n", wrong);
+        print_score(g, ordered, wrong);
         for (int i = 0; i < n; i++) {
             //fprintf(stderr, "%d ", ordered[i]);
             printf("%s\n", names_holder[ordered[i]]);
@@ -274,30 +352,105 @@ int main(int argc, char **argv)
         fprintf(stderr, "\n");
         free(ordered);
     }
+    else if (strcmp(argv[1], "-exact") == 0) {
+        // an optimal ranking never needs an edge between components to
+        // be wrong way, so each component is solved on its own
+        int *ordered = order_components(g, RANK_EXACT);
+        if (ordered == NULL) {
+            fprintf(stderr, "Ranking error\n");
+            status = 1;
+            goto destroy;
+        }
+        if (refine_seconds > 0.0) {
+            refine(g, ordered, refine_seconds);
+        }
+        int wrong = wrong_way(g, ordered);
+        fprintf(stderr, "\n");
+        print_score(g, ordered, wrong);
+        for (int i = 0; i < n; i++) {
+            printf("%s\n", names_holder[ordered[i]]);
+        }
+        fprintf(stderr, "\n");
+        free(ordered);
+    }
     else {
         fprintf(stderr, "Invalid method\n");
+        status = 1;
     }
 
     destroy:
-    for (size_t i = 0; i < total; i++) {
-        free(games[i]);
-        free(games[i+1]);
-        i++;
-    }
+    free(final);
+    free(weights);
     free(games);
 
     for (size_t i = 0; i < n; i++) {
-        gmap_for_each(adjset[i], free_value, NULL);
-        gmap_destroy(adjset[i]);
         free(names_holder[i]);
     }
     free(names_holder);
-    free(adjset);
+    edgecount_destroy(adjset);
     gmap_for_each(vertices, free_value, NULL);
     gmap_destroy(vertices);
     lugraph_destroy(g);
-    fprintf(stderr, "success\n");
-    return 0;
+    if (status == 0) {
+        fprintf(stderr, "success\n");
+    }
+    return status;
+}
+
+void print_score(const lugraph *g, const int *ordered, int wrong)
+{
+    if (!lugraph_weighted(g)) {
+        printf("%d\n", wrong);
+        return;
+    }
+    rank_eval *e = rank_eval_create(g, ordered);
+    if (e == NULL) {
+        fprintf(stderr, "could not evaluate ranking\n");
+        printf("%d\n", wrong);
+        return;
+    }
+    printf("%d %zu\n", wrong, rank_eval_score(e));
+    rank_eval_destroy(e);
+}
+
+void refine(const lugraph *g, int *ordered, double seconds)
+{
+    rank_eval *e = rank_eval_create(g, ordered);
+    if (e == NULL) {
+        fprintf(stderr, "refine: could not evaluate ranking\n");
+        return;
+    }
+
+    // each pass sifts every vertex once; the clock is checked between
+    // chunks so that one pass over a large graph can't overrun by much
+    size_t n = lugraph_size(g);
+    size_t before = rank_eval_score(e);
+    double start = now();
+    double elapsed = 0.0;
+    int pass = 0;
+    long improved = -1;
+    while (improved != 0 && elapsed < seconds) {
+        improved = 0;
+        for (size_t first = 0; first < n && elapsed < seconds; first += REFINE_CHUNK) {
+            size_t count = n - first < REFINE_CHUNK ? n - first : REFINE_CHUNK;
+            improved += rank_eval_sift(e, first, count);
+            elapsed = now() - start;
+        }
+        pass++;
+        fprintf(stderr, "refine: pass %d: score %zu after %.3f s\n", pass, rank_eval_score(e), elapsed);
+    }
+    fprintf(stderr, "refine: score %zu -> %zu in %.3f s%s\n", before, rank_eval_score(e), elapsed,
+            improved == 0 ? " (local optimum)" : "");
+
+    memcpy(ordered, rank_eval_order(e), sizeof(int) * n);
+    rank_eval_destroy(e);
+}
+
+double now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
 }
 
 void free_value(const void *key, void *value, void *arg)